@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "genann.h"
+#include "mnist_stream.h"
+
+/*
+ * Heap against arena allocation in an MNIST training loop. Every epoch
+ * trains on shuffled batches gathered into batch tensors, then snapshots the
+ * network and scores the snapshot on the test set. The heap loop mallocs
+ * and frees the batch tensors, the trainer's scratch, the snapshot and the
+ * inference scratch as it goes; the arena loop carves them all from one
+ * region set up before the first epoch and reset at the end of each. The
+ * allocation hook counts heap allocations per epoch.
+ *
+ *   ./bench_arena [epochs] [hidden] [batch] [samples]
+ */
+
+static long allocations, allocated;
+
+static void count(size_t size, void *user)
+{
+    (void)user;
+#pragma omp atomic
+    allocations++;
+#pragma omp atomic
+    allocated += size;
+}
+
+
+/* Reads the training or test set, from the cache file if there is one. */
+static const char *pick(const char *cache, const char *images, const char **labels, const char *idx_labels)
+{
+    *labels = NULL;
+    if (mnist_file_count(cache, NULL) > 0) return cache;
+    *labels = idx_labels;
+    return images;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int epochs = argc > 1 ? atoi(argv[1]) : 3;
+    const int hidden = argc > 2 ? atoi(argv[2]) : 64;
+    const int batch = argc > 3 ? atoi(argv[3]) : 32;
+    const char *labels, *images = pick("mnist/train-images-idx3-ubyte.cache", "mnist/train-images-idx3-ubyte", &labels, "mnist/train-labels-idx1-ubyte");
+    const char *test_labels, *test_images = pick("mnist/t10k-images-idx3-ubyte.cache", "mnist/t10k-images-idx3-ubyte", &test_labels, "mnist/t10k-labels-idx1-ubyte");
+    unsigned int samples = mnist_file_count(images, labels);
+    const unsigned int tests = mnist_file_count(test_images, test_labels);
+    if (argc > 4 && (unsigned int)atoi(argv[4]) < samples) samples = atoi(argv[4]);
+    double *input = malloc(sizeof(double) * samples * 28*28);
+    double *class = malloc(sizeof(double) * samples * 10);
+    double *test_input = malloc(sizeof(double) * tests * 28*28);
+    double *test_class = malloc(sizeof(double) * tests * 10);
+    unsigned int *order = malloc(sizeof(unsigned int) * samples);
+    if (!samples || !tests || !input || !class || !test_input || !test_class || !order || batch < 1
+        || mnist_read_range(images, labels, 0, samples, input, class)
+        || mnist_read_range(test_images, test_labels, 0, tests, test_input, test_class)) {
+        printf("could not read %s\n", images);
+        return 1;
+    }
+
+    srand(1);
+    genann *start = genann_init(28*28, 1, hidden, 10);
+    int arena_mode, e, k;
+    unsigned int s, b;
+
+    printf("784-%d-10 net, %d samples, batch %d, %d threads\n", hidden, samples, batch, omp_get_max_threads());
+    printf("%-6s %5s %12s %14s %10s %10s\n", "mode", "epoch", "allocations", "bytes", "seconds", "accuracy");
+
+    for (arena_mode = 0; arena_mode < 2; ++arena_mode) {
+        genann *ann = genann_copy(start);
+        genann_arena arena;
+        size_t epoch_mark = 0;
+        srand(2); /* the same batches in both modes */
+
+        /* Batch tensors, the trainer's per-thread scratch, a snapshot and
+         * the test guesses, with room for alignment. */
+        if (arena_mode) {
+            const size_t size = sizeof(double) * (size_t)batch * (28*28 + 10) + 2 * 64
+                              + sizeof(double) * (size_t)omp_get_max_threads() * (2 * ann->total_neurons + ann->total_weights + 3 * 8) + 64
+                              + genann_arena_size(ann)
+                              + sizeof(double) * (size_t)tests * 10 + 64
+                              + sizeof(double) * 2 * 64 * (hidden > 10 ? hidden : 10) + 64;
+            if (genann_arena_init(&arena, 0, size)) return 1;
+            epoch_mark = genann_arena_mark(&arena);
+        }
+
+        for (e = 0; e < epochs; ++e) {
+            const double t0 = omp_get_wtime();
+            allocations = allocated = 0;
+            genann_set_alloc_hook(count, 0);
+
+            for (s = 0; s < samples; ++s) order[s] = s;
+            for (s = samples - 1; s > 0; --s) {
+                const unsigned int r = rand() % (s + 1), t = order[s];
+                order[s] = order[r];
+                order[r] = t;
+            }
+
+            for (s = 0; s < samples; s += batch) {
+                const unsigned int n = samples - s < (unsigned int)batch ? samples - s : (unsigned int)batch;
+                const size_t mark = arena_mode ? genann_arena_mark(&arena) : 0;
+                double *in = arena_mode ? genann_arena_alloc(&arena, sizeof(double) * n * 28*28) : genann_heap_alloc(0, sizeof(double) * n * 28*28);
+                double *cls = arena_mode ? genann_arena_alloc(&arena, sizeof(double) * n * 10) : genann_heap_alloc(0, sizeof(double) * n * 10);
+                if (!in || !cls) return 1;
+                for (b = 0; b < n; ++b) {
+                    memcpy(in + (size_t)b * 28*28, input + (size_t)order[s + b] * 28*28, sizeof(double) * 28*28);
+                    memcpy(cls + (size_t)b * 10, class + (size_t)order[s + b] * 10, sizeof(double) * 10);
+                }
+
+                if (arena_mode) {
+                    genann_train_batch_arena_omp(ann, in, cls, .1, 28*28, 10, n, n, &arena);
+                    genann_arena_reset(&arena, mark);
+                } else {
+                    genann_train_batch_omp(ann, in, cls, .1, 28*28, 10, n, n);
+                    free(in);
+                    free(cls);
+                }
+            }
+
+            /* Score a snapshot, as a driver checkpointing each epoch would. */
+            genann *snap = arena_mode ? genann_copy_arena(ann, &arena) : genann_copy(ann);
+            double *guess = arena_mode ? genann_arena_alloc(&arena, sizeof(double) * tests * 10) : genann_heap_alloc(0, sizeof(double) * tests * 10);
+            if (!snap || !guess || (arena_mode ? genann_run_batch_arena(snap, test_input, tests, guess, &arena) : genann_run_batch(snap, test_input, tests, guess))) return 1;
+            int correct = 0;
+            for (s = 0; s < tests; ++s) {
+                int best = 0;
+                for (k = 1; k < 10; ++k) if (guess[s*10 + k] > guess[s*10 + best]) best = k;
+                correct += test_class[s*10 + best] == 1.0;
+            }
+            if (arena_mode) {
+                genann_arena_reset(&arena, epoch_mark);
+            } else {
+                genann_free(snap);
+                free(guess);
+            }
+
+            genann_set_alloc_hook(0, 0);
+            printf("%-6s %5d %12ld %14ld %10.2f %9.1f%%\n", arena_mode ? "arena" : "heap", e + 1, allocations, allocated, omp_get_wtime() - t0, 100.0 * correct / tests);
+        }
+
+        if (arena_mode) {
+            printf("arena: %zu bytes, %zu used at peak\n", arena.size, arena.peak);
+            genann_arena_free(&arena);
+        }
+        genann_free(ann);
+    }
+
+    genann_free(start);
+    free(input);
+    free(class);
+    free(test_input);
+    free(test_class);
+    free(order);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "genann.h"
+#include "genann_mpi.h"
+#include "mnist_stream.h"
+
+/*
+ * Compressed gradient exchange on MNIST. Trains the same network from the
+ * same starting weights once per exchange mode, every rank on its own
+ * shard, and reports for each mode the bytes a rank sends per epoch, the
+ * time per epoch and the final test accuracy, against the uncompressed
+ * MPI_Allreduce baseline.
+ *
+ * The rate applies to the mean gradient of a step, batch samples on each
+ * rank, and the compression ratio is against the baseline's bytes, so it
+ * is left out with one rank, where nothing is sent.
+ *
+ *   mpirun -n 4 ./bench_compress [epochs] [hidden] [batch] [rate]
+ */
+
+static const char *modes[] = {"none", "fp16", "bf16", "int8", "topk:0.01", "topk:0.001"};
+
+
+/* Reads the training or test set, from the cache file if there is one. */
+static const char *pick(const char *cache, const char *images, const char **labels, const char *idx_labels)
+{
+    *labels = NULL;
+    if (mnist_file_count(cache, NULL) > 0) return cache;
+    *labels = idx_labels;
+    return images;
+}
+
+
+static int accuracy(genann const *ann, double const *input, double const *class, int n)
+{
+    double *guess = malloc(sizeof(double) * n * 10);
+    int s, k, correct = 0;
+    if (!guess || genann_run_batch(ann, input, n, guess)) return -1;
+    for (s = 0; s < n; ++s) {
+        int best = 0;
+        for (k = 1; k < 10; ++k) if (guess[s*10 + k] > guess[s*10 + best]) best = k;
+        correct += class[s*10 + best] == 1.0;
+    }
+    free(guess);
+    return correct;
+}
+
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    int ranks, rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    const int epochs = argc > 1 ? atoi(argv[1]) : 5;
+    const int hidden = argc > 2 ? atoi(argv[2]) : 128;
+    const int batch = argc > 3 ? atoi(argv[3]) : 16;
+    const double rate = argc > 4 ? atof(argv[4]) : 1;
+    const int blocks = 8;
+    int m, e, s;
+
+    const char *labels, *images = pick("mnist/train-images-idx3-ubyte.cache", "mnist/train-images-idx3-ubyte", &labels, "mnist/train-labels-idx1-ubyte");
+    const unsigned int samples = mnist_file_count(images, labels);
+    const unsigned int shard_max = samples ? mnist_shard_max(samples, ranks, blocks) : 0;
+    double *input = malloc(sizeof(double) * shard_max * 28*28);
+    double *class = malloc(sizeof(double) * shard_max * 10);
+    const int n = samples && input && class ? mnist_read_shard(images, labels, samples, rank, ranks, blocks, 0, 0, input, class) : -1;
+    if (n < 0) {
+        printf("could not read %s\n", images);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    const int steps = (shard_max + batch - 1) / batch;
+
+    double *test_input = NULL, *test_class = NULL;
+    unsigned int tests = 0;
+    if (rank == 0) {
+        const char *test_labels, *test_images = pick("mnist/t10k-images-idx3-ubyte.cache", "mnist/t10k-images-idx3-ubyte", &test_labels, "mnist/t10k-labels-idx1-ubyte");
+        tests = mnist_file_count(test_images, test_labels);
+        test_input = malloc(sizeof(double) * tests * 28*28);
+        test_class = malloc(sizeof(double) * tests * 10);
+        if (!tests || mnist_read_range(test_images, test_labels, 0, tests, test_input, test_class)) {
+            printf("could not read the test set\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        printf("%d ranks, 784-%d-10 net (%d weights), batch %d per rank, %d epochs\n", ranks, hidden, 785*hidden + (hidden+1)*10, batch, epochs);
+        printf("%-11s %14s %12s %12s %10s\n", "mode", "bytes/epoch", "ratio", "s/epoch", "accuracy");
+    }
+
+    for (m = 0; m < (int)(sizeof(modes) / sizeof(modes[0])); ++m) {
+        double ratio;
+        genann_compressor c;
+        const int mode = genann_compress_parse(modes[m], &ratio);
+        srand(1);
+        genann *ann = genann_init(28*28, 1, hidden, 10);
+        double *grad = malloc(sizeof(double) * ann->total_weights);
+        if (genann_compress_init(&c, mode, ann->total_weights, ratio) != 0 || !grad) {
+            printf("could not set up %s\n", modes[m]);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        void *msgs = malloc(genann_compress_size(&c) * ranks);
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        const double t0 = MPI_Wtime();
+        for (e = 0; e < epochs; ++e) {
+            for (s = 0; s < steps; ++s) {
+                const int first = s * batch < n ? s * batch : n;
+                const int end = (s + 1) * batch < n ? (s + 1) * batch : n;
+                memset(grad, 0, sizeof(double) * ann->total_weights);
+                genann_backprop_layers(ann, input + (size_t)first*28*28, class + (size_t)first*10, end - first, grad, NULL, NULL);
+                genann_allreduce_compressed(&c, grad, msgs, MPI_COMM_WORLD);
+                genann_apply(ann, grad, rate / ((double)batch * ranks));
+            }
+        }
+        double t = MPI_Wtime() - t0;
+        MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+        if (rank == 0) {
+            genann_compressor base;
+            genann_compress_init(&base, GENANN_COMPRESS_NONE, ann->total_weights, 0);
+            const double bytes = genann_allreduce_bytes(&c, ranks) * steps;
+            const int correct = accuracy(ann, test_input, test_class, tests);
+            char ratio_text[32] = "-";
+            if (bytes > 0) snprintf(ratio_text, sizeof(ratio_text), "%.1fx", genann_allreduce_bytes(&base, ranks) * steps / bytes);
+            printf("%-11s %14.0f %12s %12.3f %9.1f%%\n", modes[m], bytes, ratio_text, t / epochs, 100.0 * correct / tests);
+            genann_compress_free(&base);
+        }
+
+        free(msgs);
+        free(grad);
+        genann_compress_free(&c);
+        genann_free(ann);
+    }
+
+    free(input);
+    free(class);
+    free(test_input);
+    free(test_class);
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "genann.h"
+#include "mnist_stream.h"
+
+/*
+ * One shared model against a model per thread for multi-threaded inference.
+ * For 1, 2, 4 ... threads up to the given maximum, every thread runs its
+ * share of the MNIST test images through a 784-hidden(xlayers)-10 net,
+ * either with its own genann_copy and genann_run (what a server has to do
+ * without contexts) or with genann_run_ctx on the one model and a
+ * genann_ctx of its own. Reports the bytes the threads allocate for their
+ * state (counted with the allocation hook), samples per second, and whether
+ * the outputs match genann_run's bit for bit.
+ *
+ *   ./bench_ctx [hidden] [layers] [max threads] [passes]
+ */
+
+enum { COPY, CTX, MODES };
+static const char *mode_names[] = {"copy", "ctx"};
+
+static long allocated;
+
+static void count(size_t size, void *user)
+{
+    (void)user;
+#pragma omp atomic
+    allocated += size;
+}
+
+
+/* Reads the test set, from the cache file if there is one. */
+static const char *pick(const char *cache, const char *images, const char **labels, const char *idx_labels)
+{
+    *labels = NULL;
+    if (mnist_file_count(cache, NULL) > 0) return cache;
+    *labels = idx_labels;
+    return images;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int hidden = argc > 1 ? atoi(argv[1]) : 512;
+    const int layers = argc > 2 ? atoi(argv[2]) : 2;
+    const int max_threads = argc > 3 ? atoi(argv[3]) : omp_get_num_procs();
+    const int passes = argc > 4 ? atoi(argv[4]) : 2;
+    const char *labels, *images = pick("mnist/t10k-images-idx3-ubyte.cache", "mnist/t10k-images-idx3-ubyte", &labels, "mnist/t10k-labels-idx1-ubyte");
+    const unsigned int tests = mnist_file_count(images, labels);
+    double *input = malloc(sizeof(double) * tests * 28*28);
+    double *class = malloc(sizeof(double) * tests * 10);
+    double *ref = malloc(sizeof(double) * tests * 10);
+    double *result = malloc(sizeof(double) * tests * 10);
+    if (!tests || !input || !class || !ref || !result || passes < 1
+        || mnist_read_range(images, labels, 0, tests, input, class)) {
+        printf("could not read %s\n", images);
+        return 1;
+    }
+
+    srand(1);
+    genann *model = genann_init(28*28, layers, hidden, 10);
+    const long total = (long)tests * passes;
+    unsigned int s;
+    int threads, m;
+    if (!model) return 1;
+
+    /* Reference outputs, one thread. */
+    for (s = 0; s < tests; ++s) {
+        memcpy(ref + s*10, genann_run(model, input + (size_t)s * 28*28), sizeof(double) * 10);
+    }
+
+    printf("784-%d(x%d)-10 net: %d weights, %zu bytes shared; %d samples x %d passes\n",
+           hidden, layers, model->total_weights, genann_arena_size(model), tests, passes);
+    printf("%-8s %-6s %16s %14s %9s %6s\n", "threads", "mode", "thread bytes", "samples/s", "speedup", "match");
+
+    double rate[MODES];
+    for (threads = 1; ; threads *= 2) {
+        if (threads > max_threads) threads = max_threads;
+        omp_set_num_threads(threads);
+
+        for (m = 0; m < MODES; ++m) {
+            double t0 = 0, t1 = 0;
+            int failed = 0;
+            memset(result, 0, sizeof(double) * tests * 10);
+            allocated = 0;
+            genann_set_alloc_hook(count, 0);
+
+#pragma omp parallel
+            {
+                genann *mine = m == COPY ? genann_copy(model) : 0;
+                genann_ctx *ctx = m == CTX ? genann_ctx_init(model) : 0;
+                long i;
+                if (!mine && !ctx) {
+#pragma omp atomic write
+                    failed = 1;
+                }
+#pragma omp barrier
+#pragma omp single
+                t0 = omp_get_wtime();
+
+                if (!failed) {
+#pragma omp for schedule(static)
+                    for (i = 0; i < total; ++i) {
+                        const size_t k = i % tests;
+                        double const *out = m == COPY ? genann_run(mine, input + k * 28*28) : genann_run_ctx(model, ctx, input + k * 28*28);
+                        memcpy(result + k*10, out, sizeof(double) * 10);
+                    }
+                }
+
+#pragma omp single
+                t1 = omp_get_wtime();
+                if (mine) genann_free(mine);
+                if (ctx) genann_ctx_free(ctx);
+            }
+
+            genann_set_alloc_hook(0, 0);
+            if (failed) {
+                printf("%d threads: could not allocate\n", threads);
+                return 1;
+            }
+            const double r = total / (t1 - t0);
+            if (threads == 1) rate[m] = r;
+            printf("%-8d %-6s %16ld %14.0f %8.2fx %6s\n", threads, mode_names[m], allocated, r, r / rate[m],
+                   memcmp(result, ref, sizeof(double) * tests * 10) ? "no" : "yes");
+        }
+        if (threads >= max_threads) break;
+    }
+
+    genann_free(model);
+    free(input);
+    free(class);
+    free(ref);
+    free(result);
+    return 0;
+}
@@ -0,0 +1,147 @@
+#define USE_MNIST_LOADER
+#define MNIST_DOUBLE
+#include "mnist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "genann.h"
+#include "genannf.h"
+#include <time.h>
+
+/*
+ * Compares the double, float and bf16 networks on MNIST: training time,
+ * inference throughput over the test set and final test accuracy.
+ * Both networks start from the same random weights.
+ *
+ *   ./bench_float [loops]
+ */
+
+double *input, *class;
+float *inputf, *classf;
+unsigned int samples;
+
+
+void load_mnist(char *images_fname, char *labels_fname)
+{
+    mnist_data *data_t;
+    unsigned int cnt;
+    int ret;
+
+    if (ret = mnist_load(images_fname, labels_fname, &data_t, &cnt)) {
+        printf("An error occured: %d\n", ret);
+        exit(-1);
+    }
+
+    input = (double *) malloc(sizeof(double) * cnt * 28*28);
+    class = (double *) malloc(sizeof(double) * cnt * 10);
+    inputf = (float *) malloc(sizeof(float) * cnt * 28*28);
+    classf = (float *) malloc(sizeof(float) * cnt * 10);
+    if (!input || !class || !inputf || !classf)
+    {
+        printf("malloc error");
+        exit(-1);
+    }
+
+    int i, j;
+    for (i = 0; i < cnt; ++i) {
+        for (j = 0; j < 28*28; ++j) {
+            input[i*28*28 + j] = data_t[i].data[j/28][j%28];
+            inputf[i*28*28 + j] = (float)input[i*28*28 + j];
+        }
+        for (j = 0; j < 10; ++j) {
+            class[i*10 + j] = (j == (int)data_t[i].label);
+            classf[i*10 + j] = (float)class[i*10 + j];
+        }
+    }
+    samples = cnt;
+    free(data_t);
+}
+
+
+void free_mnist(void)
+{
+    free(input); free(class);
+    free(inputf); free(classf);
+}
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Index of the largest output, for double or float outputs. */
+#define ARGMAX(guess, n, best) do { int _k; best = 0; \
+    for (_k = 1; _k < (n); ++_k) if ((guess)[_k] > (guess)[best]) best = _k; } while (0)
+
+
+int main(int argc, char *argv[])
+{
+    int loops = argc > 1 ? atoi(argv[1]) : 10;
+    int i, j, best;
+
+    load_mnist("mnist/train-images-idx3-ubyte","mnist/train-labels-idx1-ubyte");
+
+    srand(1);
+    genann *ann = genann_init(28*28, 3, 10, 10);
+    srand(1);
+    genannf *annf = genannf_init(28*28, 3, 10, 10);
+
+    double t0 = now();
+    for (i = 0; i < loops; ++i)
+        for (j = 0; j < samples; ++j)
+            genann_train(ann, input + j*28*28, class + j*10, .1);
+    double train_d = now() - t0;
+
+    t0 = now();
+    for (i = 0; i < loops; ++i)
+        for (j = 0; j < samples; ++j)
+            genannf_train(annf, inputf + j*28*28, classf + j*10, .1f);
+    double train_f = now() - t0;
+
+    if (genannf_pack_bf16(annf)) {
+        printf("bf16 malloc error");
+        exit(-1);
+    }
+
+    free_mnist();
+    load_mnist("mnist/t10k-images-idx3-ubyte","mnist/t10k-labels-idx1-ubyte");
+
+    int correct_d = 0, correct_f = 0, correct_b = 0;
+
+    t0 = now();
+    for (j = 0; j < samples; ++j) {
+        ARGMAX(genann_run(ann, input + j*28*28), 10, best);
+        correct_d += class[j*10 + best] == 1.0;
+    }
+    double run_d = now() - t0;
+
+    t0 = now();
+    for (j = 0; j < samples; ++j) {
+        ARGMAX(genannf_run(annf, inputf + j*28*28), 10, best);
+        correct_f += classf[j*10 + best] == 1.0f;
+    }
+    double run_f = now() - t0;
+
+    t0 = now();
+    for (j = 0; j < samples; ++j) {
+        ARGMAX(genannf_run_bf16(annf, inputf + j*28*28), 10, best);
+        correct_b += classf[j*10 + best] == 1.0f;
+    }
+    double run_b = now() - t0;
+
+    printf("%-8s %12s %14s %12s %10s\n", "type", "weight bytes", "train time(s)", "infer/s", "accuracy");
+    printf("%-8s %12zu %14.3f %12.0f %9.2f%%\n", "double", sizeof(double) * ann->total_weights, train_d, samples / run_d, 100.0 * correct_d / samples);
+    printf("%-8s %12zu %14.3f %12.0f %9.2f%%\n", "float", sizeof(float) * annf->total_weights, train_f, samples / run_f, 100.0 * correct_f / samples);
+    printf("%-8s %12zu %14s %12.0f %9.2f%%\n", "bf16", sizeof(uint16_t) * annf->total_weights, "-", samples / run_b, 100.0 * correct_b / samples);
+
+    free_mnist();
+    genann_free(ann);
+    genannf_free(annf);
+
+    return 0;
+}
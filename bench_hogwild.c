@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "genann.h"
+#include "mnist_stream.h"
+
+/*
+ * Hogwild against synchronous mini-batch training on MNIST. For 1, 2, 4 ...
+ * threads up to the given maximum, trains the same network from the same
+ * starting weights with genann_train_hogwild_omp, genann_train_batch_omp and
+ * the old shared-scratch genann_train_omp, and reports samples per second,
+ * speedup over one thread of the same mode, and test accuracy.
+ *
+ *   ./bench_hogwild [epochs] [hidden] [batch] [max threads]
+ */
+
+enum { HOGWILD, BATCH, SHARED, MODES };
+static const char *mode_names[] = {"hogwild", "batch", "shared"};
+
+
+/* Reads the training or test set, from the cache file if there is one. */
+static const char *pick(const char *cache, const char *images, const char **labels, const char *idx_labels)
+{
+    *labels = NULL;
+    if (mnist_file_count(cache, NULL) > 0) return cache;
+    *labels = idx_labels;
+    return images;
+}
+
+
+static int accuracy(genann const *ann, double const *input, double const *class, int n)
+{
+    double *guess = malloc(sizeof(double) * n * 10);
+    int s, k, correct = 0;
+    if (!guess || genann_run_batch(ann, input, n, guess)) return -1;
+    for (s = 0; s < n; ++s) {
+        int best = 0;
+        for (k = 1; k < 10; ++k) if (guess[s*10 + k] > guess[s*10 + best]) best = k;
+        correct += class[s*10 + best] == 1.0;
+    }
+    free(guess);
+    return correct;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int epochs = argc > 1 ? atoi(argv[1]) : 2;
+    const int hidden = argc > 2 ? atoi(argv[2]) : 32;
+    const int batch = argc > 3 ? atoi(argv[3]) : 16;
+    const int max_threads = argc > 4 ? atoi(argv[4]) : omp_get_num_procs();
+    int threads, m, e;
+
+    const char *labels, *images = pick("mnist/train-images-idx3-ubyte.cache", "mnist/train-images-idx3-ubyte", &labels, "mnist/train-labels-idx1-ubyte");
+    const char *test_labels, *test_images = pick("mnist/t10k-images-idx3-ubyte.cache", "mnist/t10k-images-idx3-ubyte", &test_labels, "mnist/t10k-labels-idx1-ubyte");
+    const unsigned int samples = mnist_file_count(images, labels);
+    const unsigned int tests = mnist_file_count(test_images, test_labels);
+    double *input = malloc(sizeof(double) * samples * 28*28);
+    double *class = malloc(sizeof(double) * samples * 10);
+    double *test_input = malloc(sizeof(double) * tests * 28*28);
+    double *test_class = malloc(sizeof(double) * tests * 10);
+    if (!samples || !tests || !input || !class || !test_input || !test_class
+        || mnist_read_range(images, labels, 0, samples, input, class)
+        || mnist_read_range(test_images, test_labels, 0, tests, test_input, test_class)) {
+        printf("could not read %s\n", images);
+        return 1;
+    }
+
+    /* Hogwild trains a padded net, which starts with the same weights. */
+    srand(1);
+    genann *start = genann_init(28*28, 1, hidden, 10);
+    srand(1);
+    genann *start_padded = genann_init_padded(28*28, 1, hidden, 10);
+    double rate[MODES];
+
+    printf("784-%d-10 net, %d samples, %d epochs, batch %d for the batch mode\n", hidden, samples, epochs, batch);
+    printf("%-8s %-8s %14s %9s %10s\n", "threads", "mode", "samples/s", "speedup", "accuracy");
+
+    for (threads = 1; ; threads *= 2) {
+        if (threads > max_threads) threads = max_threads;
+        omp_set_num_threads(threads);
+        for (m = 0; m < MODES; ++m) {
+            genann *ann = genann_copy(m == HOGWILD ? start_padded : start);
+            const double t0 = omp_get_wtime();
+            for (e = 0; e < epochs; ++e) {
+                if (m == HOGWILD) genann_train_hogwild_omp(ann, input, class, .1, 28*28, 10, samples);
+                else if (m == BATCH) genann_train_batch_omp(ann, input, class, .1, 28*28, 10, samples, batch);
+                else genann_train_omp(ann, input, class, .1, 28*28, 10, samples);
+            }
+            const double r = (double)samples * epochs / (omp_get_wtime() - t0);
+            if (threads == 1) rate[m] = r;
+
+            const int correct = accuracy(ann, test_input, test_class, tests);
+            printf("%-8d %-8s %14.0f %8.2fx %9.1f%%\n", threads, mode_names[m], r, r / rate[m], 100.0 * correct / tests);
+            genann_free(ann);
+        }
+        if (threads >= max_threads) break;
+    }
+
+    genann_free(start);
+    genann_free(start_padded);
+    free(input);
+    free(class);
+    free(test_input);
+    free(test_class);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "genann.h"
+#include "mnist_stream.h"
+
+/*
+ * Uniform against tapered hidden layers on MNIST. Trains 784-256-256-10
+ * (what genann_init allows) and 784-256-64-10, packed, with every layer
+ * aligned to 64 bytes, and with padded rows (genann_init_layers), from the
+ * training set for the given number of epochs, and reports weights,
+ * training and batched inference samples per second, and test accuracy.
+ *
+ *   ./bench_layers [epochs] [samples]
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Reads the training or test set, from the cache file if there is one. */
+static const char *pick(const char *cache, const char *images, const char **labels, const char *idx_labels)
+{
+    *labels = NULL;
+    if (mnist_file_count(cache, NULL) > 0) return cache;
+    *labels = idx_labels;
+    return images;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int epochs = argc > 1 ? atoi(argv[1]) : 1;
+    const char *labels, *images = pick("mnist/train-images-idx3-ubyte.cache", "mnist/train-images-idx3-ubyte", &labels, "mnist/train-labels-idx1-ubyte");
+    const char *test_labels, *test_images = pick("mnist/t10k-images-idx3-ubyte.cache", "mnist/t10k-images-idx3-ubyte", &test_labels, "mnist/t10k-labels-idx1-ubyte");
+    unsigned int samples = mnist_file_count(images, labels);
+    const unsigned int tests = mnist_file_count(test_images, test_labels);
+    if (argc > 2 && (unsigned int)atoi(argv[2]) < samples) samples = atoi(argv[2]);
+    double *input = malloc(sizeof(double) * samples * 28*28);
+    double *class = malloc(sizeof(double) * samples * 10);
+    double *test_input = malloc(sizeof(double) * tests * 28*28);
+    double *test_class = malloc(sizeof(double) * tests * 10);
+    double *guess = malloc(sizeof(double) * tests * 10);
+    if (!samples || !tests || !input || !class || !test_input || !test_class || !guess
+        || mnist_read_range(images, labels, 0, samples, input, class)
+        || mnist_read_range(test_images, test_labels, 0, tests, test_input, test_class)) {
+        printf("could not read %s\n", images);
+        return 1;
+    }
+
+    const genann_layer uniform[] = {{28*28}, {256}, {256}, {10}};
+    const genann_layer tapered[] = {{28*28}, {256}, {64}, {10}};
+    const genann_layer aligned[] = {{28*28}, {256, 0, 8}, {64, 0, 8}, {10, 0, 8}};
+    const genann_layer padded[] = {{28*28}, {256, 0, 0, 1}, {64, 0, 0, 1}, {10, 0, 0, 1}};
+    genann_layer const *nets[] = {uniform, tapered, aligned, padded};
+    const char *names[] = {"784-256-256-10", "784-256-64-10", "784-256-64-10 aligned", "784-256-64-10 padded"};
+    int n, e;
+    unsigned int s;
+
+    printf("%d samples, %d epochs\n", samples, epochs);
+    printf("%-22s %8s %12s %12s %10s\n", "net", "weights", "train/s", "run/s", "accuracy");
+
+    for (n = 0; n < 4; ++n) {
+        srand(1);
+        genann *ann = genann_init_layers(4, nets[n]);
+        if (!ann) return 1;
+
+        double t0 = now();
+        for (e = 0; e < epochs; ++e) {
+            for (s = 0; s < samples; ++s) {
+                genann_train(ann, input + (size_t)s * 28*28, class + (size_t)s * 10, .1);
+            }
+        }
+        const double train = (double)samples * epochs / (now() - t0);
+
+        t0 = now();
+        if (genann_run_batch(ann, test_input, tests, guess)) return 1;
+        const double run = tests / (now() - t0);
+
+        int k, correct = 0;
+        for (s = 0; s < tests; ++s) {
+            int best = 0;
+            for (k = 1; k < 10; ++k) if (guess[s*10 + k] > guess[s*10 + best]) best = k;
+            correct += test_class[s*10 + best] == 1.0;
+        }
+
+        printf("%-22s %8d %12.0f %12.0f %9.1f%%\n", names[n], ann->total_weights, train, run, 100.0 * correct / tests);
+        genann_free(ann);
+    }
+
+    free(input);
+    free(class);
+    free(test_input);
+    free(test_class);
+    free(guess);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "genann.h"
+
+/*
+ * Save and load times and file sizes of the text (genann_write/genann_read)
+ * and binary (genann_write_binary/genann_read_binary/genann_mmap) model
+ * formats, for a wide network.
+ *
+ *   ./bench_model [hidden]
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+
+/* Largest output difference between two anns on one random input. */
+static double compare(genann const *a, genann const *b)
+{
+    double *in = malloc(sizeof(double) * a->inputs);
+    double *ref = malloc(sizeof(double) * a->outputs);
+    double diff = 0;
+    int i;
+    for (i = 0; i < a->inputs; ++i) in[i] = GENANN_RANDOM();
+    memcpy(ref, genann_run(a, in), sizeof(double) * a->outputs);
+    double const *out = genann_run(b, in);
+    for (i = 0; i < a->outputs; ++i) diff = fmax(diff, fabs(ref[i] - out[i]));
+    free(in);
+    free(ref);
+    return diff;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int hidden = argc > 1 ? atoi(argv[1]) : 1024;
+    const char *text = "bench_model.txt", *bin = "bench_model.bin";
+    double t0;
+    FILE *f;
+
+    genann *ann = genann_init(28*28, 2, hidden, 10);
+    printf("784-2x%d-10, %d weights (%ld bytes raw)\n", hidden, ann->total_weights, (long)sizeof(double) * ann->total_weights);
+
+    t0 = now();
+    f = fopen(text, "w");
+    genann_write(ann, f);
+    fclose(f);
+    printf("%-20s %8.1f ms  %10ld bytes\n", "genann_write", (now() - t0) * 1e3, file_size(text));
+
+    t0 = now();
+    f = fopen(bin, "wb");
+    if (genann_write_binary(ann, f) != 0) {
+        printf("write failed\n");
+        return 1;
+    }
+    fclose(f);
+    printf("%-20s %8.1f ms  %10ld bytes\n", "genann_write_binary", (now() - t0) * 1e3, file_size(bin));
+
+    t0 = now();
+    f = fopen(text, "r");
+    genann *a = genann_read(f);
+    fclose(f);
+    printf("%-20s %8.1f ms  max diff %g\n", "genann_read", (now() - t0) * 1e3, compare(ann, a));
+
+    t0 = now();
+    f = fopen(bin, "rb");
+    genann *b = genann_read_binary(f);
+    fclose(f);
+    printf("%-20s %8.1f ms  max diff %g\n", "genann_read_binary", (now() - t0) * 1e3, compare(ann, b));
+
+    t0 = now();
+    genann *c = genann_mmap(bin);
+    printf("%-20s %8.1f ms  max diff %g\n", "genann_mmap", (now() - t0) * 1e3, compare(ann, c));
+
+    genann_free(a);
+    genann_free(b);
+    genann_free(c);
+    genann_free(ann);
+    remove(text);
+    remove(bin);
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "genann.h"
+#include "genann_numa.h"
+#include "mnist_stream.h"
+
+/*
+ * NUMA placement for Hogwild training on MNIST. Trains the same network from
+ * the same starting weights three ways and reports samples per second and
+ * test accuracy:
+ *
+ *   flat      - genann_train_hogwild_omp on the set as loaded by the main
+ *               thread, so all of it sits on the main thread's node;
+ *   sharded   - genann_train_numa_omp with a shard of the set per node and
+ *               the one copy of the weights, trained in place;
+ *   replicas  - the same with a copy of the weights per node, merged
+ *               every sync samples per thread.
+ *
+ * Pin the threads (OMP_PROC_BIND=spread OMP_PLACES=cores). On a machine with
+ * fewer nodes, GENANN_NUMA_NODES=2 or 4 lays things out as if there were
+ * more, which shows the cost of the scheme but not its benefit.
+ *
+ *   ./bench_numa [epochs] [hidden] [sync]
+ */
+
+enum { FLAT, SHARDED, REPLICAS, MODES };
+static const char *mode_names[] = {"flat", "sharded", "replicas"};
+
+
+/* Reads the training or test set, from the cache file if there is one. */
+static const char *pick(const char *cache, const char *images, const char **labels, const char *idx_labels)
+{
+    *labels = NULL;
+    if (mnist_file_count(cache, NULL) > 0) return cache;
+    *labels = idx_labels;
+    return images;
+}
+
+
+static int accuracy(genann const *ann, double const *input, double const *class, int n)
+{
+    double *guess = malloc(sizeof(double) * n * 10);
+    int s, k, correct = 0;
+    if (!guess || genann_run_batch(ann, input, n, guess)) return -1;
+    for (s = 0; s < n; ++s) {
+        int best = 0;
+        for (k = 1; k < 10; ++k) if (guess[s*10 + k] > guess[s*10 + best]) best = k;
+        correct += class[s*10 + best] == 1.0;
+    }
+    free(guess);
+    return correct;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int epochs = argc > 1 ? atoi(argv[1]) : 2;
+    const int hidden = argc > 2 ? atoi(argv[2]) : 32;
+    const unsigned int sync = argc > 3 ? atoi(argv[3]) : 16;
+    int m, e, k;
+
+    const char *labels, *images = pick("mnist/train-images-idx3-ubyte.cache", "mnist/train-images-idx3-ubyte", &labels, "mnist/train-labels-idx1-ubyte");
+    const char *test_labels, *test_images = pick("mnist/t10k-images-idx3-ubyte.cache", "mnist/t10k-images-idx3-ubyte", &test_labels, "mnist/t10k-labels-idx1-ubyte");
+    const unsigned int samples = mnist_file_count(images, labels);
+    const unsigned int tests = mnist_file_count(test_images, test_labels);
+    double *input = malloc(sizeof(double) * samples * 28*28);
+    double *class = malloc(sizeof(double) * samples * 10);
+    double *test_input = malloc(sizeof(double) * tests * 28*28);
+    double *test_class = malloc(sizeof(double) * tests * 10);
+    if (!samples || !tests || !input || !class || !test_input || !test_class
+        || mnist_read_range(images, labels, 0, samples, input, class)
+        || mnist_read_range(test_images, test_labels, 0, tests, test_input, test_class)) {
+        printf("could not read %s\n", images);
+        return 1;
+    }
+
+    genann_numa_set set;
+    double t0 = omp_get_wtime();
+    if (genann_numa_set_load(&set, input, class, 28*28, 10, samples)) {
+        printf("could not lay out the training set\n");
+        return 1;
+    }
+    printf("%d threads on %d nodes (", set.threads, set.nodes);
+    for (k = 0; k < set.nodes; ++k) printf("%snode %d: %d threads, %u samples", k ? "; " : "", set.node_id[k], set.node_threads[k], set.count[k]);
+    printf("), sharding took %.3f s\n", omp_get_wtime() - t0);
+
+    srand(1);
+    genann *start = genann_init_padded(28*28, 1, hidden, 10);
+
+    printf("784-%d-10 net, %d epochs, replicas merged every %u samples per thread\n", hidden, epochs, sync);
+    printf("%-9s %14s %10s\n", "mode", "samples/s", "accuracy");
+    for (m = 0; m < MODES; ++m) {
+        genann *ann = genann_copy(start);
+        t0 = omp_get_wtime();
+        for (e = 0; e < epochs; ++e) {
+            if (m == FLAT) genann_train_hogwild_omp(ann, input, class, .1, 28*28, 10, samples);
+            else genann_train_numa_omp(ann, &set, .1, m == REPLICAS, sync);
+        }
+        const double r = (double)samples * epochs / (omp_get_wtime() - t0);
+        const int correct = accuracy(ann, test_input, test_class, tests);
+        printf("%-9s %14.0f %9.1f%%\n", mode_names[m], r, 100.0 * correct / tests);
+        genann_free(ann);
+    }
+
+    genann_numa_set_free(&set);
+    genann_free(start);
+    free(input);
+    free(class);
+    free(test_input);
+    free(test_class);
+    return 0;
+}
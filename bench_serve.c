@@ -0,0 +1,255 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "genann.h"
+#include "genann_serve.h"
+#include "mnist_stream.h"
+
+/*
+ * Load generator for genann_serve. Client threads send MNIST test images
+ * to a 784-hidden-10 net for the given number of seconds, each keeping
+ * depth requests in flight, as an RPC layer with that many connections
+ * would. Three ways of serving them are compared:
+ *
+ *   direct   every client runs its own requests with genann_run_ctx, one
+ *            forward pass per request (depth does not apply);
+ *   serve    through genann_serve with max batch 1: the queue and workers,
+ *            but no batching;
+ *   batched  through genann_serve with the given max batch and wait.
+ *
+ * Reports requests per second, the mean batch, p50 and p99 latency (the
+ * server's counters, or the clients' own timings for direct) and the
+ * largest difference from genann_run's outputs.
+ *
+ *   ./bench_serve [clients] [depth] [seconds] [max batch] [max wait us] [workers] [hidden]
+ */
+
+enum { DIRECT, SERVE, BATCHED, MODES };
+static const char *mode_names[] = {"direct", "serve", "batched"};
+
+/* Latencies each direct client keeps for the percentiles. */
+#define KEEP (1 << 20)
+
+static genann *model;
+static genann_serve *srv;
+static double *input, *ref;
+static unsigned int tests;
+static int depth;
+static double seconds;
+
+typedef struct client {
+    pthread_t thread;
+    int id, mode;
+    unsigned long long requests;
+    double max_error;
+    long long *latency;         /* direct only */
+    int kept;
+} client;
+
+
+static long long now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static double error(double const *out, unsigned int k)
+{
+    double e = 0;
+    int j;
+    for (j = 0; j < 10; ++j) {
+        const double d = fabs(out[j] - ref[k*10 + j]);
+        if (d > e) e = d;
+    }
+    return e;
+}
+
+
+static void *client_main(void *arg)
+{
+    client *c = arg;
+    const long long end = now() + (long long)(seconds * 1e9);
+    unsigned int next = c->id * 7919u % tests;
+    int k;
+
+    if (c->mode == DIRECT) {
+        genann_ctx *ctx = genann_ctx_init(model);
+        if (!ctx) return 0;
+        while (now() < end) {
+            const long long t0 = now();
+            double const *out = genann_run_ctx(model, ctx, input + (size_t)next * 28*28);
+            const long long t1 = now();
+            if (c->kept < KEEP) c->latency[c->kept++] = t1 - t0;
+            const double e = error(out, next);
+            if (e > c->max_error) c->max_error = e;
+            ++c->requests;
+            next = (next + 1) % tests;
+        }
+        genann_ctx_free(ctx);
+        return 0;
+    }
+
+    genann_request *req = calloc(depth, sizeof(genann_request));
+    double *out = malloc(sizeof(double) * depth * 10);
+    unsigned int *sample = malloc(sizeof(unsigned int) * depth);
+    int live = 0;
+    if (!req || !out || !sample) return 0;
+
+    for (k = 0; k < depth; ++k) {
+        req[k].output = out + k*10;
+        req[k].finished = 1;
+    }
+
+    /* Keep every slot busy until time is up, then let them drain. */
+    for (;;) {
+        const int open = now() < end;
+        int moved = 0;
+        live = 0;
+        for (k = 0; k < depth; ++k) {
+            if (!genann_serve_done(req + k)) {
+                ++live;
+                continue;
+            }
+            if (req[k].input) {
+                const double e = error(req[k].output, sample[k]);
+                if (e > c->max_error) c->max_error = e;
+                ++c->requests;
+                req[k].input = 0;
+                moved = 1;
+            }
+            if (open) {
+                sample[k] = next;
+                req[k].input = input + (size_t)next * 28*28;
+                if (genann_serve_submit(srv, req + k) == 0) {
+                    next = (next + 1) % tests;
+                    ++live;
+                } else {
+                    req[k].input = 0;
+                    req[k].finished = 1;
+                }
+            }
+        }
+        if (!open && !live) break;
+        if (!moved) sched_yield();
+    }
+
+    free(req);
+    free(out);
+    free(sample);
+    return 0;
+}
+
+
+static int cmp(const void *a, const void *b)
+{
+    const long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int clients = argc > 1 ? atoi(argv[1]) : 4;
+    depth = argc > 2 ? atoi(argv[2]) : 16;
+    seconds = argc > 3 ? atof(argv[3]) : 2;
+    const int max_batch = argc > 4 ? atoi(argv[4]) : 32;
+    const int max_wait = argc > 5 ? atoi(argv[5]) : 200;
+    const int workers = argc > 6 ? atoi(argv[6]) : 0;
+    const int hidden = argc > 7 ? atoi(argv[7]) : 256;
+    const char *labels = "mnist/t10k-labels-idx1-ubyte", *images = "mnist/t10k-images-idx3-ubyte";
+    if (mnist_file_count("mnist/t10k-images-idx3-ubyte.cache", NULL) > 0) {
+        images = "mnist/t10k-images-idx3-ubyte.cache";
+        labels = NULL;
+    }
+    tests = mnist_file_count(images, labels);
+    input = malloc(sizeof(double) * tests * 28*28);
+    double *class = malloc(sizeof(double) * tests * 10);
+    ref = malloc(sizeof(double) * tests * 10);
+    client *c = calloc(clients > 0 ? clients : 1, sizeof(client));
+    unsigned int s;
+    int m, i;
+    if (!tests || !input || !class || !ref || !c || clients < 1 || depth < 1 || max_batch < 1
+        || mnist_read_range(images, labels, 0, tests, input, class)) {
+        printf("could not read %s\n", images);
+        return 1;
+    }
+
+    srand(1);
+    model = genann_init(28*28, 1, hidden, 10);
+    if (!model) return 1;
+    for (s = 0; s < tests; ++s) {
+        memcpy(ref + s*10, genann_run(model, input + (size_t)s * 28*28), sizeof(double) * 10);
+    }
+
+    printf("784-%d-10 net, %d clients x %d in flight, %.1f s per mode, max batch %d, max wait %d us\n",
+           hidden, clients, depth, seconds, max_batch, max_wait);
+    printf("%-8s %9s %12s %10s %10s %10s\n", "mode", "batch", "requests/s", "p50 us", "p99 us", "max error");
+
+    for (m = 0; m < MODES; ++m) {
+        genann_serve_stats st;
+        double max_error = 0;
+        unsigned long long requests = 0;
+        memset(&st, 0, sizeof(st));
+
+        if (m != DIRECT) {
+            genann_serve_config config = {workers, m == BATCHED ? max_batch : 1, m == BATCHED ? max_wait : 0, 0, 1};
+            srv = genann_serve_start(model, &config);
+            if (!srv) {
+                printf("could not start the server\n");
+                return 1;
+            }
+        }
+
+        const long long t0 = now();
+        for (i = 0; i < clients; ++i) {
+            c[i].id = i;
+            c[i].mode = m;
+            c[i].requests = 0;
+            c[i].max_error = 0;
+            c[i].kept = 0;
+            c[i].latency = m == DIRECT ? malloc(sizeof(long long) * KEEP) : NULL;
+            if ((m == DIRECT && !c[i].latency) || pthread_create(&c[i].thread, 0, client_main, c + i)) return 1;
+        }
+        for (i = 0; i < clients; ++i) {
+            pthread_join(c[i].thread, 0);
+            requests += c[i].requests;
+            if (c[i].max_error > max_error) max_error = c[i].max_error;
+        }
+        const double elapsed = (now() - t0) * 1e-9;
+
+        if (m == DIRECT) {
+            long long *all = malloc(sizeof(long long) * (size_t)KEEP * clients);
+            size_t n = 0;
+            if (!all) return 1;
+            for (i = 0; i < clients; ++i) {
+                memcpy(all + n, c[i].latency, sizeof(long long) * c[i].kept);
+                n += c[i].kept;
+                free(c[i].latency);
+            }
+            qsort(all, n, sizeof(long long), cmp);
+            st.mean_batch = 1;
+            st.p50_us = n ? all[(n - 1) / 2] * 1e-3 : 0;
+            st.p99_us = n ? all[(n - 1) * 99 / 100] * 1e-3 : 0;
+            free(all);
+        } else {
+            genann_serve_get_stats(srv, &st);
+            genann_serve_stop(srv);
+        }
+
+        printf("%-8s %9.1f %12.0f %10.1f %10.1f %10.1e\n", mode_names[m], st.mean_batch, requests / elapsed,
+               st.p50_us, st.p99_us, max_error);
+    }
+
+    genann_free(model);
+    free(input);
+    free(class);
+    free(ref);
+    free(c);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "genann.h"
+#include "genann_static.hpp"
+
+/*
+ * Latency of one inference call, genann_run on a struct genann against
+ * genann_static::run on the same weights (loaded back from a genann_write
+ * file). Two shapes: the example.c network, where the 784-wide first layer
+ * dominates, and a small one, where per-call overhead dominates.
+ *
+ *   ./bench_static [calls]
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+template <class Net>
+static void bench(int calls)
+{
+    const int n_in = 64;
+    int i, j;
+
+    genann *ann = genann_init(Net::inputs, Net::hidden_layers, Net::hidden, Net::outputs);
+    ann->activation_hidden = Net::activation_hidden::function();
+    ann->activation_output = Net::activation_output::function();
+
+    /* Round-trip through a genann_write file. */
+    FILE *f = tmpfile();
+    genann_write(ann, f);
+    rewind(f);
+    static Net net;
+    if (!net.read(f)) {
+        printf("read failed\n");
+        exit(1);
+    }
+    fclose(f);
+
+    double *in = (double *) malloc(sizeof(double) * n_in * Net::inputs);
+    for (i = 0; i < n_in * Net::inputs; ++i) in[i] = GENANN_RANDOM();
+
+    double out[Net::outputs], diff = 0, sink = 0;
+    for (i = 0; i < n_in; ++i) {
+        double const *ref = genann_run(ann, in + i*Net::inputs);
+        net.run(in + i*Net::inputs, out);
+        for (j = 0; j < Net::outputs; ++j) diff = fmax(diff, fabs(ref[j] - out[j]));
+    }
+
+    double t0 = now();
+    for (i = 0; i < calls; ++i) sink += genann_run(ann, in + (i % n_in)*Net::inputs)[0];
+    double t_dyn = now() - t0;
+
+    t0 = now();
+    for (i = 0; i < calls; ++i) {
+        net.run(in + (i % n_in)*Net::inputs, out);
+        sink += out[0];
+    }
+    double t_static = now() - t0;
+
+    printf("%d-%dx%d-%d %-6s: genann_run %8.1f ns, genann_static %8.1f ns, max diff %g (%g)\n",
+            Net::inputs, Net::hidden_layers, Net::hidden, Net::outputs,
+            ann->activation_hidden == genann_act_sigmoid_fast ? "fast" : "cached",
+            t_dyn / calls * 1e9, t_static / calls * 1e9, diff, sink);
+
+    free(in);
+    genann_free(ann);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int calls = argc > 1 ? atoi(argv[1]) : 200000;
+
+    bench<genann_static<28*28, 3, 10, 10> >(calls);
+    bench<genann_static<16, 3, 10, 4> >(calls * 10);
+    bench<genann_static<28*28, 3, 10, 10, genann_static_sigmoid_fast> >(calls);
+    bench<genann_static<16, 3, 10, 4, genann_static_sigmoid_fast> >(calls * 10);
+
+    return 0;
+}
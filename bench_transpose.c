@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "genann.h"
+
+/*
+ * Microbenchmark for the backward pass at hidden widths 128, 512 and 2048.
+ *
+ * First the hidden-layer delta loop alone, three ways:
+ *   column  - the original walk down a column of the next layer's weights
+ *   row     - axpy over each row of the next layer (what genann_backprop does)
+ *   wt      - dot products over a transposed copy (genann_backprop_t),
+ *             including the cost of building the copy once per batch
+ * then a whole genann_backprop against genann_backprop_t.
+ *
+ *   ./bench_transpose [batch]
+ */
+
+#define INPUTS 64
+#define LAYERS 3
+#define OUTPUTS 10
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Hidden deltas only; output deltas in d are taken as given. */
+static void deltas_column(genann const *ann, double *d)
+{
+    int h, j, k;
+    for (h = ann->hidden_layers - 1; h >= 0; --h) {
+        double const *dd = d + (h+1) * ann->hidden;
+        double const *ww = ann->weight + (ann->inputs+1) * ann->hidden + (ann->hidden+1) * ann->hidden * h;
+        const int next = (h == ann->hidden_layers-1 ? ann->outputs : ann->hidden);
+        for (j = 0; j < ann->hidden; ++j) {
+            double sum = 0;
+            for (k = 0; k < next; ++k) sum += dd[k] * ww[k * (ann->hidden + 1) + (j + 1)];
+            d[h * ann->hidden + j] = sum * 0.25;
+        }
+    }
+}
+
+
+static void deltas_row(genann const *ann, double *d)
+{
+    int h, j, k;
+    for (h = ann->hidden_layers - 1; h >= 0; --h) {
+        double const *dd = d + (h+1) * ann->hidden;
+        double const *ww = ann->weight + (ann->inputs+1) * ann->hidden + (ann->hidden+1) * ann->hidden * h;
+        const int next = (h == ann->hidden_layers-1 ? ann->outputs : ann->hidden);
+        double *dh = d + h * ann->hidden;
+        memset(dh, 0, sizeof(double) * ann->hidden);
+        for (k = 0; k < next; ++k) {
+            double const *row = ww + k * (ann->hidden + 1) + 1;
+            for (j = 0; j < ann->hidden; ++j) dh[j] += dd[k] * row[j];
+        }
+        for (j = 0; j < ann->hidden; ++j) dh[j] *= 0.25;
+    }
+}
+
+
+static void deltas_wt(genann const *ann, double const *wt, double *d)
+{
+    int h, j, k;
+    for (h = ann->hidden_layers - 1; h >= 0; --h) {
+        double const *dd = d + (h+1) * ann->hidden;
+        double const *wwt = wt + h * ann->hidden * ann->hidden;
+        const int next = (h == ann->hidden_layers-1 ? ann->outputs : ann->hidden);
+        for (j = 0; j < ann->hidden; ++j) {
+            double sum = 0;
+            for (k = 0; k < next; ++k) sum += wwt[j * next + k] * dd[k];
+            d[h * ann->hidden + j] = sum * 0.25;
+        }
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    const int batch = argc > 1 ? atoi(argv[1]) : 32;
+    const int widths[] = {128, 512, 2048};
+    int w, s, i;
+
+    printf("simd: %s, batch %d, net %d-%dxH-%d, us per sample\n", genann_simd_name(), batch, INPUTS, LAYERS, OUTPUTS);
+    printf("%8s %10s %10s %10s %12s %12s\n", "hidden", "column", "row", "wt", "backprop", "backprop_t");
+
+    for (w = 0; w < 3; ++w) {
+        genann *ann = genann_init(INPUTS, LAYERS, widths[w], OUTPUTS);
+        const int n_delta = ann->total_neurons - ann->inputs;
+        const int samples = widths[w] >= 2048 ? batch : 8 * batch;
+        double *d = malloc(sizeof(double) * n_delta);
+        double *output = malloc(sizeof(double) * ann->total_neurons);
+        double *grad = calloc(ann->total_weights, sizeof(double));
+        double *wt = malloc(sizeof(double) * genann_transpose_size(ann));
+        double *in = malloc(sizeof(double) * INPUTS);
+        double t[5], t0;
+
+        for (i = 0; i < n_delta; ++i) d[i] = GENANN_RANDOM() - 0.5;
+        for (i = 0; i < INPUTS; ++i) in[i] = GENANN_RANDOM();
+
+        t0 = now();
+        for (s = 0; s < samples; ++s) deltas_column(ann, d);
+        t[0] = now() - t0;
+
+        t0 = now();
+        for (s = 0; s < samples; ++s) deltas_row(ann, d);
+        t[1] = now() - t0;
+
+        t0 = now();
+        for (s = 0; s < samples; ++s) {
+            if (s % batch == 0) genann_transpose(ann, wt);
+            deltas_wt(ann, wt, d);
+        }
+        t[2] = now() - t0;
+
+        t0 = now();
+        for (s = 0; s < samples; ++s) genann_backprop(ann, output, d, in, in, grad);
+        t[3] = now() - t0;
+
+        t0 = now();
+        for (s = 0; s < samples; ++s) {
+            if (s % batch == 0) genann_transpose(ann, wt);
+            genann_backprop_t(ann, wt, output, d, in, in, grad);
+        }
+        t[4] = now() - t0;
+
+        printf("%8d", widths[w]);
+        for (i = 0; i < 5; ++i) printf(" %*.1f", i < 3 ? 10 : 12, t[i] / samples * 1e6);
+        printf("\n");
+
+        free(d); free(output); free(grad); free(wt); free(in);
+        genann_free(ann);
+    }
+
+    return 0;
+}
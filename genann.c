@@ -24,15 +24,46 @@
  */
 
 #include "genann.h"
+#include "genann_simd.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define LOOKUP_SIZE 4096
+#define LOOKUP_MIN -15.0
+#define LOOKUP_MAX 15.0
+
+/* Table for genann_act_sigmoid_cached. It is filled once before main runs (or
+ * by genann_init), never lazily, so concurrent readers are safe. */
+static double lookup[LOOKUP_SIZE];
+static int lookup_ready = 0;
+
+static void genann_act_init(void) {
+    const double interval = (LOOKUP_MAX - LOOKUP_MIN) / LOOKUP_SIZE;
+    int i;
+    if (lookup_ready) return;
+    for (i = 0; i < LOOKUP_SIZE; ++i) {
+        lookup[i] = genann_act_sigmoid(LOOKUP_MIN + interval * i);
+    }
+    lookup_ready = 1;
+}
+
+#ifdef __GNUC__
+__attribute__((constructor))
+static void genann_act_startup(void) {
+    genann_act_init();
+}
+#endif
+
 
 double genann_act_sigmoid(double a) {
     if (a < -45.0) return 0;
@@ -42,32 +73,17 @@ double genann_act_sigmoid(double a) {
 
 
 double genann_act_sigmoid_cached(double a) {
-    /* If you're optimizing for memory usage, just
-     * delete this entire function and replace references
-     * of genann_act_sigmoid_cached to genann_act_sigmoid
-     */
-    const double min = -15.0;
-    const double max = 15.0;
-    static double interval;
-    static int initialized = 0;
-    static double lookup[LOOKUP_SIZE];
-
-    /* Calculate entire lookup table on first run. */
-    if (!initialized) {
-        interval = (max - min) / LOOKUP_SIZE;
-        int i;
-        for (i = 0; i < LOOKUP_SIZE; ++i) {
-            lookup[i] = genann_act_sigmoid(min + interval * i);
-        }
-        /* This is down here to make this thread safe. */
-        initialized = 1;
-    }
+    /* Clamp the index with min/max rather than branches. NaN fails
+     * x >= 0 and maps to lookup[0]. */
+    double x = (a - LOOKUP_MIN) * (LOOKUP_SIZE / (LOOKUP_MAX - LOOKUP_MIN)) + 0.5;
+    x = !(x >= 0) ? 0 : x;
+    x = x > LOOKUP_SIZE - 1 ? LOOKUP_SIZE - 1 : x;
+    return lookup[(int)x];
+}
 
-    int i;
-    i = (int)((a-min)/interval+0.5);
-    if (i <= 0) return lookup[0];
-    if (i >= LOOKUP_SIZE) return lookup[LOOKUP_SIZE-1];
-    return lookup[i];
+
+double genann_act_sigmoid_fast(double a) {
+    return genann_sigmoid_fast(a);
 }
 
 
@@ -81,49 +97,320 @@ double genann_act_linear(double a) {
 }
 
 
-genann *genann_init(int inputs, int hidden_layers, int hidden, int outputs) {
-    if (hidden_layers < 0) return 0;
-    if (inputs < 1) return 0;
-    if (outputs < 1) return 0;
-    if (hidden_layers > 0 && hidden < 1) return 0;
+/* Whole-layer versions. The fast sigmoid goes through the SIMD kernels. */
+void genann_act_sigmoid_n(double const *in, double *out, int n) {
+    int i;
+    for (i = 0; i < n; ++i) out[i] = genann_act_sigmoid(in[i]);
+}
+
+
+void genann_act_sigmoid_cached_n(double const *in, double *out, int n) {
+    int i;
+    for (i = 0; i < n; ++i) out[i] = genann_act_sigmoid_cached(in[i]);
+}
+
+
+void genann_act_sigmoid_fast_n(double const *in, double *out, int n) {
+    genann_simd.sigmoid(in, out, n);
+}
 
 
-    const int hidden_weights = hidden_layers ? (inputs+1) * hidden + (hidden_layers-1) * (hidden+1) * hidden : 0;
-    const int output_weights = (hidden_layers ? (hidden+1) : (inputs+1)) * outputs;
-    const int total_weights = (hidden_weights + output_weights);
+void genann_act_threshold_n(double const *in, double *out, int n) {
+    int i;
+    for (i = 0; i < n; ++i) out[i] = in[i] > 0;
+}
+
+
+void genann_act_linear_n(double const *in, double *out, int n) {
+    if (in != out) memmove(out, in, sizeof(double) * n);
+}
 
-    const int total_neurons = (inputs + hidden * hidden_layers + outputs);
 
-    /* Allocate extra size for weights, outputs, and deltas. */
-    const int size = sizeof(genann) + sizeof(double) * (total_weights + total_neurons + (total_neurons - inputs));
-    genann *ret = malloc(size);
+/* Applies act to a whole layer: one call for the built-in activations, and
+ * a per-neuron loop only for user-supplied ones. in may equal out. */
+static void genann_act_layer(genann_actfun act, double const *in, double *out, int n) {
+    int i;
+    if (act == genann_act_sigmoid_fast) genann_act_sigmoid_fast_n(in, out, n);
+    else if (act == genann_act_sigmoid_cached) genann_act_sigmoid_cached_n(in, out, n);
+    else if (act == genann_act_sigmoid) genann_act_sigmoid_n(in, out, n);
+    else if (act == genann_act_linear) genann_act_linear_n(in, out, n);
+    else if (act == genann_act_threshold) genann_act_threshold_n(in, out, n);
+    else for (i = 0; i < n; ++i) out[i] = act(in[i]);
+}
+
+
+static int genann_round(int n, int align) {
+    return align > 1 ? (n + align - 1) / align * align : n;
+}
+
+
+/* Activation of layer l > 0: its own, else the network's default. */
+static genann_actfun genann_layer_act(genann const *ann, int l) {
+    if (ann->layer[l].activation) return ann->layer[l].activation;
+    return l == ann->layers - 1 ? ann->activation_output : ann->activation_hidden;
+}
+
+
+/* Lays out layer l > 0 starting at weight w and output o, and returns where
+ * the next layer may start in *w and *o. Fills ann's tables for l if ann is
+ * not 0. */
+static void genann_layout(genann *ann, genann_layer const *layer, int l, int *w, int *o) {
+    const int n_in = layer[l-1].size, n_out = layer[l].size;
+    const int align = layer[l].padded && layer[l].align < GENANN_ROW_DOUBLES ? GENANN_ROW_DOUBLES : layer[l].align;
+    const int start = genann_round(*w, align);
+    const int stride = layer[l].padded ? genann_round(n_in, GENANN_ROW_DOUBLES) : n_in + 1;
+
+    *o = genann_round(*o, align);
+    if (ann) {
+        ann->weight_offset[l] = start;
+        ann->output_offset[l] = *o;
+        ann->delta_offset[l] = *o - ann->output_offset[1];
+        ann->row_stride[l] = stride;
+        ann->row_offset[l] = layer[l].padded ? start : start + 1;
+        ann->bias_offset[l] = layer[l].padded ? start + stride * n_out : start;
+        ann->bias_stride[l] = layer[l].padded ? 1 : stride;
+    }
+    *w = start + stride * n_out + (layer[l].padded ? n_out : 0);
+    *o += n_out;
+}
+
+
+/* Allocation hook, see genann_set_alloc_hook. */
+static genann_alloc_hook genann_hook = 0;
+static void *genann_hook_user = 0;
+
+void genann_set_alloc_hook(genann_alloc_hook hook, void *user) {
+    genann_hook = hook;
+    genann_hook_user = user;
+}
+
+
+void *genann_heap_alloc(size_t align, size_t size) {
+    const genann_alloc_hook hook = genann_hook;
+    if (hook) hook(size, genann_hook_user);
+    if (size == 0) size = 1;
+    if (align <= 1) return malloc(size);
+    return aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+
+int genann_arena_init(genann_arena *arena, void *memory, size_t size) {
+    arena->owned = memory == 0;
+    arena->base = memory ? memory : genann_heap_alloc(64, size);
+    arena->size = arena->base ? size : 0;
+    arena->used = arena->peak = 0;
+    return arena->base ? 0 : -1;
+}
+
+
+void genann_arena_free(genann_arena *arena) {
+    if (arena->owned) free(arena->base);
+    arena->base = 0;
+    arena->size = arena->used = 0;
+}
+
+
+void *genann_arena_alloc(genann_arena *arena, size_t size) {
+    /* Aligned by address, so caller memory need not be. */
+    const uintptr_t at = ((uintptr_t)(arena->base + arena->used) + 63) & ~(uintptr_t)63;
+    const size_t start = at - (uintptr_t)arena->base;
+    if (start > arena->size || size > arena->size - start) return 0;
+    arena->used = start + size;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return arena->base + start;
+}
+
+
+size_t genann_arena_mark(genann_arena const *arena) {
+    return arena->used;
+}
+
+
+void genann_arena_reset(genann_arena *arena, size_t mark) {
+    if (mark < arena->used) arena->used = mark;
+}
+
+
+/* Where neuron j of layer l keeps its bias weight and its first input weight,
+ * in weight or in a gradient. */
+static size_t genann_bias_index(genann const *ann, int l, int j) {
+    return ann->bias_offset[l] + (size_t)j * ann->bias_stride[l];
+}
+
+static size_t genann_row_index(genann const *ann, int l, int j) {
+    return ann->row_offset[l] + (size_t)j * ann->row_stride[l];
+}
+
+
+/* Allocates an ann with its output and delta scratch and its layer tables
+ * in one 64-byte aligned block, from arena if it is not 0. The weights go in
+ * the same block if own_weights is set; otherwise ann->weight is left for the
+ * caller to point somewhere (see genann_mmap). The descriptors are copied as
+ * they are, and activation_hidden and activation_output get the default.
+ * With size set, only stores the block's size there and returns 0. */
+static genann *genann_alloc(int layers, genann_layer const *layer, int own_weights, genann_arena *arena, size_t *size_only) {
+    int l;
+
+    if (layers < 2) return 0;
+    for (l = 0; l < layers; ++l) {
+        if (layer[l].size < 1 || layer[l].align < 0) return 0;
+    }
+
+    /* Each layer's rows and outputs start on its alignment, and padded rows
+     * are rounded up; the gaps are zeroed and never read. */
+    int total_weights = 0, total_neurons = layer[0].size, packed = 1;
+    for (l = 1; l < layers; ++l) {
+        const int w = total_weights, o = total_neurons;
+        genann_layout(0, layer, l, &total_weights, &total_neurons);
+        packed &= total_weights - w == (layer[l-1].size + 1) * layer[l].size && total_neurons - o == layer[l].size;
+    }
+    const int inputs = layer[0].size;
+
+    /* The struct, then weights, outputs and deltas, each from a cache line,
+     * then the layer tables. */
+    const size_t head = genann_round(sizeof(genann), 64);
+    const size_t n_weight = own_weights ? genann_round(total_weights, GENANN_ROW_DOUBLES) : 0;
+    const size_t n_output = genann_round(total_neurons, GENANN_ROW_DOUBLES);
+    const size_t n_delta = genann_round(total_neurons - inputs, GENANN_ROW_DOUBLES);
+    const size_t tables = sizeof(genann_layer) * layers + sizeof(int) * 7 * layers;
+    const size_t size = (head + sizeof(double) * (n_weight + n_output + n_delta) + tables + 63) / 64 * 64;
+    if (size_only) {
+        *size_only = size;
+        return 0;
+    }
+    genann *ret = arena ? genann_arena_alloc(arena, size) : genann_heap_alloc(64, size);
     if (!ret) return 0;
 
     ret->inputs = inputs;
-    ret->hidden_layers = hidden_layers;
-    ret->hidden = hidden;
-    ret->outputs = outputs;
+    ret->hidden_layers = layers - 2;
+    ret->outputs = layer[layers-1].size;
+    ret->hidden = 0;
+    if (layers > 2) {
+        ret->hidden = layer[1].size;
+        for (l = 2; l < layers - 1; ++l) {
+            if (layer[l].size != ret->hidden) ret->hidden = 0;
+        }
+    }
 
     ret->total_weights = total_weights;
     ret->total_neurons = total_neurons;
 
     /* Set pointers. */
-    ret->weight = (double*)((char*)ret + sizeof(genann));
-    ret->output = ret->weight + ret->total_weights;
-    ret->delta = ret->output + ret->total_neurons;
-
-    genann_randomize(ret);
+    ret->weight = own_weights ? (double*)((char*)ret + head) : 0;
+    ret->output = (double*)((char*)ret + head) + n_weight;
+    ret->delta = ret->output + n_output;
+    ret->mapping = 0;
+    ret->mapping_size = 0;
+    if (!packed) memset((char*)ret + head, 0, sizeof(double) * (n_weight + n_output + n_delta));
+
+    ret->layers = layers;
+    ret->layer = (genann_layer*)(ret->delta + n_delta);
+    ret->weight_offset = (int*)(ret->layer + layers);
+    ret->output_offset = ret->weight_offset + layers;
+    ret->delta_offset = ret->output_offset + layers;
+    ret->row_offset = ret->delta_offset + layers;
+    ret->row_stride = ret->row_offset + layers;
+    ret->bias_offset = ret->row_stride + layers;
+    ret->bias_stride = ret->bias_offset + layers;
+    memcpy(ret->layer, layer, sizeof(genann_layer) * layers);
+
+    /* Deltas mirror the outputs, less the inputs and any gap after them. */
+    ret->weight_offset[0] = ret->output_offset[0] = ret->delta_offset[0] = 0;
+    ret->row_offset[0] = ret->row_stride[0] = ret->bias_offset[0] = ret->bias_stride[0] = 0;
+    int w = 0, o = inputs;
+    for (l = 1; l < layers; ++l) {
+        genann_layout(ret, layer, l, &w, &o);
+    }
 
     ret->activation_hidden = genann_act_sigmoid_cached;
     ret->activation_output = genann_act_sigmoid_cached;
 
+    genann_act_init();
+
+    return ret;
+}
+
+
+/* Descriptors for genann_init's shape, in a malloc'd array of hidden_layers + 2. */
+static genann_layer *genann_uniform_layers(int inputs, int hidden_layers, int hidden, int outputs) {
+    genann_layer *layer;
+    int l;
+
+    if (hidden_layers < 0) return 0;
+    layer = genann_heap_alloc(0, sizeof(genann_layer) * ((size_t)hidden_layers + 2));
+    if (!layer) return 0;
+    memset(layer, 0, sizeof(genann_layer) * ((size_t)hidden_layers + 2));
+    layer[0].size = inputs;
+    for (l = 1; l <= hidden_layers; ++l) layer[l].size = hidden;
+    layer[hidden_layers+1].size = outputs;
+    return layer;
+}
+
+
+genann *genann_init_layers(int layers, genann_layer const *layer) {
+    genann *ret = genann_alloc(layers, layer, 1, 0, 0);
+    if (!ret) return 0;
+
+    /* The first hidden layer's and the output layer's activations become the
+     * network's; per-layer entries are kept only where they differ. */
+    if (layers > 2 && layer[1].activation) ret->activation_hidden = layer[1].activation;
+    if (layer[layers-1].activation) ret->activation_output = layer[layers-1].activation;
+    ret->layer[0].activation = ret->layer[layers-1].activation = 0;
+    int l;
+    for (l = 1; l < layers - 1; ++l) {
+        if (ret->layer[l].activation == ret->activation_hidden) ret->layer[l].activation = 0;
+    }
+
+    genann_randomize(ret);
+
     return ret;
 }
 
 
+genann *genann_init(int inputs, int hidden_layers, int hidden, int outputs) {
+    genann_layer *layer = genann_uniform_layers(inputs, hidden_layers, hidden, outputs);
+    if (!layer) return 0;
+
+    genann *ret = genann_init_layers(hidden_layers + 2, layer);
+    free(layer);
+    if (!ret) return 0;
+
+    /* Kept as given, even with no hidden layers to use it. */
+    ret->hidden = hidden;
+
+    return ret;
+}
+
+
+genann *genann_init_padded(int inputs, int hidden_layers, int hidden, int outputs) {
+    genann_layer *layer = genann_uniform_layers(inputs, hidden_layers, hidden, outputs);
+    int l;
+    if (!layer) return 0;
+    for (l = 1; l < hidden_layers + 2; ++l) layer[l].padded = 1;
+
+    genann *ret = genann_init_layers(hidden_layers + 2, layer);
+    free(layer);
+    if (!ret) return 0;
+
+    ret->hidden = hidden;
+
+    return ret;
+}
+
+
+int genann_is_uniform(genann const *ann) {
+    int l;
+    for (l = 1; l < ann->layers; ++l) {
+        if (ann->layer[l].align > 1 || ann->layer[l].padded) return 0;
+        if (l < ann->layers - 1 && (ann->layer[l].size != ann->hidden || ann->layer[l].activation)) return 0;
+    }
+    return 1;
+}
+
+
 genann *genann_read(FILE *in) {
     int inputs, hidden_layers, hidden, outputs;
-    int rc;
+    int rc, l, j, i;
 
     errno = 0;
     rc = fscanf(in, "%d %d %d %d", &inputs, &hidden_layers, &hidden, &outputs);
@@ -132,234 +419,759 @@ genann *genann_read(FILE *in) {
         return NULL;
     }
 
-    genann *ann = genann_init(inputs, hidden_layers, hidden, outputs);
-
-    int i;
-    for (i = 0; i < ann->total_weights; ++i) {
+    /* A hidden of 0 is followed by the width of each hidden layer. */
+    genann_layer *layer = genann_uniform_layers(inputs, hidden_layers, hidden, outputs);
+    if (!layer) {
+        fprintf(stderr, "genann_read: bad topology\n");
+        return NULL;
+    }
+    for (l = 1; l <= hidden_layers && hidden == 0; ++l) {
         errno = 0;
-        rc = fscanf(in, " %le", ann->weight + i);
+        rc = fscanf(in, " %d", &layer[l].size);
         if (rc < 1 || errno != 0) {
             perror("fscanf");
-            genann_free(ann);
-
+            free(layer);
             return NULL;
         }
     }
 
+    genann *ann = genann_init_layers(hidden_layers + 2, layer);
+    free(layer);
+    if (!ann) {
+        fprintf(stderr, "genann_read: bad topology\n");
+        return NULL;
+    }
+    if (hidden_layers == 0) ann->hidden = hidden;
+
+    /* Each neuron's bias, then its input weights. */
+    for (l = 1; l < ann->layers; ++l) {
+        for (j = 0; j < ann->layer[l].size; ++j) {
+            for (i = -1; i < ann->layer[l-1].size; ++i) {
+                double *w = ann->weight + (i < 0 ? genann_bias_index(ann, l, j) : genann_row_index(ann, l, j) + i);
+                errno = 0;
+                rc = fscanf(in, " %le", w);
+                if (rc < 1 || errno != 0) {
+                    perror("fscanf");
+                    genann_free(ann);
+
+                    return NULL;
+                }
+            }
+        }
+    }
+
     return ann;
 }
 
 
 genann *genann_copy(genann const *ann) {
-    const int size = sizeof(genann) + sizeof(double) * (ann->total_weights + ann->total_neurons + (ann->total_neurons - ann->inputs));
-    genann *ret = malloc(size);
+    return genann_copy_arena(ann, 0);
+}
+
+
+size_t genann_arena_size(genann const *ann) {
+    size_t size = 0;
+    genann_alloc(ann->layers, ann->layer, 1, 0, &size);
+    return size + 63;
+}
+
+
+genann *genann_copy_arena(genann const *ann, genann_arena *arena) {
+    genann *ret = genann_alloc(ann->layers, ann->layer, 1, arena, 0);
     if (!ret) return 0;
 
-    memcpy(ret, ann, size);
+    ret->hidden = ann->hidden;
+    ret->activation_hidden = ann->activation_hidden;
+    ret->activation_output = ann->activation_output;
 
-    /* Set pointers. */
-    ret->weight = (double*)((char*)ret + sizeof(genann));
-    ret->output = ret->weight + ret->total_weights;
-    ret->delta = ret->output + ret->total_neurons;
+    /* The weights may live outside ann's block (mapped from a file), so copy
+     * each buffer on its own. The copy always owns its weights. */
+    memcpy(ret->weight, ann->weight, sizeof(double) * ann->total_weights);
+    memcpy(ret->output, ann->output, sizeof(double) * ann->total_neurons);
+    memcpy(ret->delta, ann->delta, sizeof(double) * (ann->total_neurons - ann->inputs));
 
     return ret;
 }
 
 
 void genann_randomize(genann *ann) {
-    int i;
-    for (i = 0; i < ann->total_weights; ++i) {
-        double r = GENANN_RANDOM();
-        /* Sets weights from -0.5 to 0.5. */
-        ann->weight[i] = r - 0.5;
+    int l, j, i;
+    /* Bias first, then inputs, neuron by neuron: the order genann_init's
+     * packed rows are in, whatever the layout. */
+    for (l = 1; l < ann->layers; ++l) {
+        for (j = 0; j < ann->layer[l].size; ++j) {
+            double *w = ann->weight + genann_row_index(ann, l, j);
+            for (i = -1; i < ann->layer[l-1].size; ++i) {
+                double r = GENANN_RANDOM();
+                /* Sets weights from -0.5 to 0.5. */
+                if (i < 0) ann->weight[genann_bias_index(ann, l, j)] = r - 0.5;
+                else w[i] = r - 0.5;
+            }
+        }
     }
 }
 
 
 void genann_free(genann *ann) {
-    /* The weight, output, and delta pointers go to the same buffer. */
+    /* The weight, output, and delta pointers go to the same buffer,
+     * except for mapped weights. */
+    if (ann->mapping) munmap(ann->mapping, ann->mapping_size);
     free(ann);
 }
 
 
-double const *genann_run(genann const *ann, double const *inputs) {
-    double const *w = ann->weight;
-    double *o = ann->output + ann->inputs;
-    double const *i = ann->output;
+/* Neurons whose sums genann_forward keeps on the stack before activating. */
+#define GENANN_FORWARD_CHUNK 64
 
+/* Runs the network forward, storing the inputs and every neuron's output in
+ * the given scratch buffer (total_neurons long). Returns the first output.
+ * Only activated values are stored there: genann_train_omp shares
+ * ann->output between threads, which may read it at any time. */
+static double const *genann_forward(genann const *ann, double *output, double const *inputs) {
     /* Copy the inputs to the scratch area, where we also store each neuron's
      * output, for consistency. This way the first layer isn't a special case. */
-    memcpy(ann->output, inputs, sizeof(double) * ann->inputs);
-
-    int h, j, k;
-
-    const genann_actfun act = ann->activation_hidden;
-    const genann_actfun acto = ann->activation_output;
-    //printf("ann->hidden_layers : %f; ann->hidden : %f \n",ann->hidden_layers, ann->hidden);
-    /* Figure hidden layers, if any. */
-    for (h = 0; h < ann->hidden_layers; ++h) {
-        for (j = 0; j < ann->hidden; ++j) {
-            double sum = *w++ * -1.0;
-            //printf("sum : %f",sum);
-            for (k = 0; k < (h == 0 ? ann->inputs : ann->hidden); ++k) {
-                sum += *w++ * i[k];
+    memcpy(output, inputs, sizeof(double) * ann->inputs);
+
+    double sum[GENANN_FORWARD_CHUNK];
+    int l, j, j0;
+
+    for (l = 1; l < ann->layers; ++l) {
+        const int n_in = ann->layer[l-1].size;
+        const int n_out = ann->layer[l].size;
+        const genann_actfun act = genann_layer_act(ann, l);
+        double const *w = ann->weight + ann->row_offset[l];
+        double const *b = ann->weight + ann->bias_offset[l];
+        double const *i = output + ann->output_offset[l-1];
+        double *o = output + ann->output_offset[l];
+
+        /* Each neuron's n_in input weights, less its bias weight, a chunk
+         * of neurons at a time. */
+        for (j0 = 0; j0 < n_out; j0 += GENANN_FORWARD_CHUNK) {
+            const int m = n_out - j0 < GENANN_FORWARD_CHUNK ? n_out - j0 : GENANN_FORWARD_CHUNK;
+            for (j = 0; j < m; ++j) {
+                sum[j] = genann_simd.dot(w + (size_t)(j0 + j) * ann->row_stride[l], i, n_in) - b[(size_t)(j0 + j) * ann->bias_stride[l]];
             }
-            *o++ = act(sum);
+            genann_act_layer(act, sum, o + j0, m);
         }
+    }
+
+    return output + ann->output_offset[ann->layers-1];
+}
+
+
+double const *genann_run(genann const *ann, double const *inputs) {
+    return genann_forward(ann, ann->output, inputs);
+}
 
 
-        i += (h == 0 ? ann->inputs : ann->hidden);
+genann_ctx *genann_ctx_init(genann const *ann) {
+    /* The head is rounded to a cache line so the outputs start on one. */
+    const size_t head = (sizeof(genann_ctx) + 63) & ~(size_t)63;
+    genann_ctx *ctx = genann_heap_alloc(64, head + sizeof(double) * ann->total_neurons);
+    if (!ctx) return 0;
+    ctx->output = (double *)((char *)ctx + head);
+    ctx->total_neurons = ann->total_neurons;
+    return ctx;
+}
+
+
+void genann_ctx_free(genann_ctx *ctx) {
+    free(ctx);
+}
+
+
+double const *genann_run_ctx(genann const *ann, genann_ctx *ctx, double const *inputs) {
+    if (ann->total_neurons > ctx->total_neurons) return 0;
+    return genann_forward(ann, ctx->output, inputs);
+}
+
+
+/* Blocking for genann_run_batch. A block of GENANN_BATCH_ROWS samples is pushed
+ * through all layers before the next one starts, so a layer's weights are reused
+ * across the whole block. GENANN_BATCH_K splits the dot products so the four
+ * input rows and the weight row of a dot4 (20KB) stay in L1 even for the
+ * 784-wide first layer. */
+#define GENANN_BATCH_ROWS 64
+#define GENANN_BATCH_K 512
+
+/* y[s][j] += sum over k in [k0, k1) of x[s][k] * w[j][k], for a block of
+ * n samples and n_out neurons. Rows of w are ldw apart, bias excluded. */
+static void genann_gemm_block(double const *w, int ldw, int n_in, int n_out, double const *x, int n, double *y, int k0, int k1) {
+    int s, j;
+
+    /* Four samples at a time against each weight row, so the row is read
+     * once for four samples. */
+    for (s = 0; s + 4 <= n; s += 4) {
+        for (j = 0; j < n_out; ++j) {
+            double sum[4];
+            genann_simd.dot4(w + (size_t)j * ldw + k0, x + (size_t)s * n_in + k0, n_in, k1 - k0, sum);
+            y[(s+0) * n_out + j] += sum[0];
+            y[(s+1) * n_out + j] += sum[1];
+            y[(s+2) * n_out + j] += sum[2];
+            y[(s+3) * n_out + j] += sum[3];
+        }
     }
 
-    double const *ret = o;
+    /* Leftover samples. */
+    for (; s < n; ++s) {
+        for (j = 0; j < n_out; ++j) {
+            y[s * n_out + j] += genann_simd.dot(w + (size_t)j * ldw + k0, x + (size_t)s * n_in + k0, k1 - k0);
+        }
+    }
+}
+
+
+/* Runs layer l for n samples: y = act(x * W^T - bias). */
+static void genann_layer_batch(genann const *ann, int l, double const *x, int n, double *y) {
+    const int n_in = ann->layer[l-1].size, n_out = ann->layer[l].size;
+    double const *b = ann->weight + ann->bias_offset[l];
+    int s, j, k0;
 
-    /* Figure output layer. */
-    for (j = 0; j < ann->outputs; ++j) {
-        double sum = *w++ * -1.0;
-        for (k = 0; k < (ann->hidden_layers ? ann->hidden : ann->inputs); ++k) {
-            sum += *w++ * i[k];
+    for (s = 0; s < n; ++s) {
+        for (j = 0; j < n_out; ++j) {
+            y[s * n_out + j] = b[j * ann->bias_stride[l]] * -1.0;
         }
-        *o++ = acto(sum);
     }
 
-    /* Sanity check that we used all weights and wrote all outputs. */
-    assert(w - ann->weight == ann->total_weights);
-    assert(o - ann->output == ann->total_neurons);
+    for (k0 = 0; k0 < n_in; k0 += GENANN_BATCH_K) {
+        const int k1 = k0 + GENANN_BATCH_K < n_in ? k0 + GENANN_BATCH_K : n_in;
+        genann_gemm_block(ann->weight + ann->row_offset[l], ann->row_stride[l], n_in, n_out, x, n, y, k0, k1);
+    }
 
-    return ret;
+    genann_act_layer(genann_layer_act(ann, l), y, y, n * n_out);
 }
 
 
-void genann_train(genann const *ann, double const *inputs, double const *desired_outputs, double learning_rate) {
-    /* To begin with, we must run the network forward. */
-    genann_run(ann, inputs);
+int genann_run_batch(genann const *ann, double const *inputs, int n, double *outputs) {
+    return genann_run_batch_arena(ann, inputs, n, outputs, 0);
+}
+
+
+/* Widest hidden layer, at least 1: the ping-pong halves of genann_run_batch's
+ * scratch each hold a block of that many activations per sample. */
+static int genann_batch_widest(genann const *ann) {
+    int widest = 1, l;
+    for (l = 1; l < ann->layers - 1; ++l) {
+        if (ann->layer[l].size > widest) widest = ann->layer[l].size;
+    }
+    return widest;
+}
+
+
+size_t genann_run_batch_size(genann const *ann) {
+    return sizeof(double) * 2 * GENANN_BATCH_ROWS * genann_batch_widest(ann) + 63;
+}
+
+
+int genann_run_batch_arena(genann const *ann, double const *inputs, int n, double *outputs, genann_arena *arena) {
+    const int last = ann->layers - 1;
+    const int widest = genann_batch_widest(ann);
+    int l;
+    const size_t bytes = sizeof(double) * 2 * GENANN_BATCH_ROWS * widest;
+    const size_t mark = arena ? genann_arena_mark(arena) : 0;
+    double *scratch = arena ? genann_arena_alloc(arena, bytes) : genann_heap_alloc(0, bytes);
+    if (!scratch) return -1;
 
-    int h, j, k;
+    int s0;
+    for (s0 = 0; s0 < n; s0 += GENANN_BATCH_ROWS) {
+        const int rows = n - s0 < GENANN_BATCH_ROWS ? n - s0 : GENANN_BATCH_ROWS;
+        double const *x = inputs + (size_t)s0 * ann->inputs;
+        double *y = scratch;
 
-    /* First set the output layer deltas. */
+        for (l = 1; l < last; ++l) {
+            genann_layer_batch(ann, l, x, rows, y);
+
+            /* Ping-pong between the two halves of scratch. */
+            x = y;
+            y = (y == scratch) ? scratch + GENANN_BATCH_ROWS * widest : scratch;
+        }
+
+        genann_layer_batch(ann, last, x, rows, outputs + (size_t)s0 * ann->outputs);
+    }
+
+    if (arena) genann_arena_reset(arena, mark);
+    else free(scratch);
+    return 0;
+}
+
+
+int genann_transpose_size(genann const *ann) {
+    int l, n = 0;
+    for (l = 2; l < ann->layers; ++l) {
+        n += ann->layer[l-1].size * ann->layer[l].size;
+    }
+    return n;
+}
+
+
+void genann_transpose(genann const *ann, double *wt) {
+    int l, j, k;
+
+    /* Skip the first layer: its deltas are never propagated back to the inputs. */
+    for (l = 2; l < ann->layers; ++l) {
+        const int n_in = ann->layer[l-1].size;
+        const int n_out = ann->layer[l].size;
+        double const *w = ann->weight + ann->row_offset[l];
+        const int ldw = ann->row_stride[l];
+
+        /* wt[j][k] = w[k][j]: row j lists every weight leaving input j.
+         * Copied in 8x8 tiles so both sides touch whole cache lines. */
+        int j0, k0;
+        for (k0 = 0; k0 < n_out; k0 += 8) {
+            const int k1 = k0 + 8 < n_out ? k0 + 8 : n_out;
+            for (j0 = 0; j0 < n_in; j0 += 8) {
+                const int j1 = j0 + 8 < n_in ? j0 + 8 : n_in;
+                for (k = k0; k < k1; ++k) {
+                    for (j = j0; j < j1; ++j) {
+                        wt[j * n_out + k] = w[k * ldw + j];
+                    }
+                }
+            }
+        }
+
+        wt += n_in * n_out;
+    }
+}
+
+
+/* Fills delta (total_neurons - inputs long) from a forward pass in output.
+ * wt is an optional transposed copy of the weights from genann_transpose. */
+static void genann_deltas(genann const *ann, double const *wt, double const *output, double *delta, double const *desired_outputs) {
+    const int last = ann->layers - 1;
+    int l, j, k;
+
+    /* Set output layer deltas. */
     {
-        double const *o = ann->output + ann->inputs + ann->hidden * ann->hidden_layers; /* First output. */
-        double *d = ann->delta + ann->hidden * ann->hidden_layers; /* First delta. */
+        double const *o = output + ann->output_offset[last]; /* First output. */
+        double *d = delta + ann->delta_offset[last]; /* First delta. */
         double const *t = desired_outputs; /* First desired output. */
 
-
-        /* Set output layer deltas. */
-        if (ann->activation_output == genann_act_linear) {
+        if (genann_layer_act(ann, last) == genann_act_linear) {
             for (j = 0; j < ann->outputs; ++j) {
-                *d++ = *t++ - *o++;
+                d[j] = t[j] - o[j];
             }
         } else {
             for (j = 0; j < ann->outputs; ++j) {
-                *d++ = (*t - *o) * *o * (1.0 - *o);
-                ++o; ++t;
+                d[j] = (t[j] - o[j]) * o[j] * (1.0 - o[j]);
             }
         }
     }
 
-
     /* Set hidden layer deltas, start on last layer and work backwards. */
     /* Note that loop is skipped in the case of hidden_layers == 0. */
-    for (h = ann->hidden_layers - 1; h >= 0; --h) {
+    int wt_offset = wt ? genann_transpose_size(ann) : 0;
+    for (l = last - 1; l >= 1; --l) {
+        const int n = ann->layer[l].size;
+        double const *o = output + ann->output_offset[l];
+        double *d = delta + ann->delta_offset[l];
+
+        /* Deltas and weights of the following layer (which may be hidden or output). */
+        double const * const dd = delta + ann->delta_offset[l+1];
+        double const * const ww = ann->weight + ann->row_offset[l+1];
+        const int next = ann->layer[l+1].size;
+
+        if (wt) {
+            /* Transposed copy: delta j is one contiguous dot product. */
+            wt_offset -= n * next;
+            double const * const wwt = wt + wt_offset;
+            for (j = 0; j < n; ++j) {
+                d[j] = genann_simd.dot(wwt + j * next, dd, next);
+            }
+        } else {
+            /* Walk the following layer's weights row by row: each row k adds
+             * dd[k] times its (non-bias) weights to all of this layer's deltas. */
+            memset(d, 0, sizeof(double) * n);
+            for (k = 0; k < next; ++k) {
+                genann_simd.axpy(d, dd[k], ww + (size_t)k * ann->row_stride[l+1], n);
+            }
+        }
 
-        /* Find first output and delta in this layer. */
-        double const *o = ann->output + ann->inputs + (h * ann->hidden);
-        double *d = ann->delta + (h * ann->hidden);
+        for (j = 0; j < n; ++j) {
+            d[j] *= o[j] * (1.0-o[j]);
+        }
+    }
+}
 
-        /* Find first delta in following layer (which may be hidden or output). */
-        double const * const dd = ann->delta + ((h+1) * ann->hidden);
 
-        /* Find first weight in following layer (which may be hidden or output). */
-        double const * const ww = ann->weight + ((ann->inputs+1) * ann->hidden) + ((ann->hidden+1) * ann->hidden * (h));
+void genann_train(genann const *ann, double const *inputs, double const *desired_outputs, double learning_rate) {
+    genann_train_step(ann, ann->output, ann->delta, inputs, desired_outputs, learning_rate);
+}
 
-        for (j = 0; j < ann->hidden; ++j) {
 
-            double delta = 0;
+void genann_train_step(genann const *ann, double *output, double *delta, double const *inputs, double const *desired_outputs, double learning_rate) {
+    /* To begin with, we must run the network forward. */
+    genann_forward(ann, output, inputs);
+    genann_deltas(ann, 0, output, delta, desired_outputs);
+
+    /* Update every layer's weights, in weight order. */
+    int l, j;
+
+    for (l = 1; l < ann->layers; ++l) {
+        const int n_in = ann->layer[l-1].size;
+        const int n_out = ann->layer[l].size;
+        double const *d = delta + ann->delta_offset[l];
+        double const *i = output + ann->output_offset[l-1];
+
+        for (j = 0; j < n_out; ++j) {
+            const double step = d[j] * learning_rate;
+            ann->weight[genann_bias_index(ann, l, j)] += step * -1.0;
+            genann_simd.axpy(ann->weight + genann_row_index(ann, l, j), step, i, n_in);
+        }
+    }
+}
 
-            for (k = 0; k < (h == ann->hidden_layers-1 ? ann->outputs : ann->hidden); ++k) {
-                const double forward_delta = dd[k];
-                const int windex = k * (ann->hidden + 1) + (j + 1);
-                const double forward_weight = ww[windex];
-                delta += forward_delta * forward_weight;
-            }
 
-            *d = *o * (1.0-*o) * delta;
-            ++d; ++o;
+void genann_backprop(genann const *ann, double *output, double *delta, double const *inputs, double const *desired_outputs, double *grad) {
+    genann_backprop_t(ann, 0, output, delta, inputs, desired_outputs, grad);
+}
+
+
+void genann_backprop_t(genann const *ann, double const *wt, double *output, double *delta, double const *inputs, double const *desired_outputs, double *grad) {
+    /* Run forward into the caller's scratch, so ann itself is only read. */
+    genann_forward(ann, output, inputs);
+    genann_deltas(ann, wt, output, delta, desired_outputs);
+
+    /* Accumulate the gradient for every layer, in weight order. Each row is
+     * the neuron's delta times its inputs, with -1.0 standing in for the bias input. */
+    int l, j;
+
+    for (l = 1; l < ann->layers; ++l) {
+        const int n_in = ann->layer[l-1].size;
+        const int n_out = ann->layer[l].size;
+        double const *d = delta + ann->delta_offset[l];
+        double const *i = output + ann->output_offset[l-1];
+
+        for (j = 0; j < n_out; ++j) {
+            grad[genann_bias_index(ann, l, j)] -= d[j];
+            genann_simd.axpy(grad + genann_row_index(ann, l, j), d[j], i, n_in);
         }
     }
+}
 
 
-    /* Train the outputs. */
-    {
-        /* Find first output delta. */
-        double const *d = ann->delta + ann->hidden * ann->hidden_layers; /* First output delta. */
-
-        /* Find first weight to first output delta. */
-        double *w = ann->weight + (ann->hidden_layers
-                ? ((ann->inputs+1) * ann->hidden + (ann->hidden+1) * ann->hidden * (ann->hidden_layers-1))
-                : (0));
-
-        /* Find first output in previous layer. */
-        double const * const i = ann->output + (ann->hidden_layers
-                ? (ann->inputs + (ann->hidden) * (ann->hidden_layers-1))
-                : 0);
-
-        /* Set output layer weights. */
-        for (j = 0; j < ann->outputs; ++j) {
-            for (k = 0; k < (ann->hidden_layers ? ann->hidden : ann->inputs) + 1; ++k) {
-                if (k == 0) {
-                    *w++ += *d * learning_rate * -1.0;
-                } else {
-                    *w++ += *d * learning_rate * i[k-1];
-                }
-            }
+int genann_backprop_layers(genann const *ann, double const *inputs, double const *desired_outputs, int count, double *grad, genann_layer_done done, void *user) {
+    const int n_delta = ann->total_neurons - ann->inputs;
+    double *output = genann_heap_alloc(0, sizeof(double) * ((size_t)ann->total_neurons + n_delta) * (count > 0 ? count : 1));
+    if (!output) return -1;
+    double *delta = output + (size_t)ann->total_neurons * count;
+    int h, j, s;
+
+    /* Forward and deltas for every sample first; they are cheap next to the
+     * gradient rows, which are what the caller's exchange waits on. */
+    for (s = 0; s < count; ++s) {
+        double *o = output + (size_t)ann->total_neurons * s;
+        genann_forward(ann, o, inputs + (size_t)ann->inputs * s);
+        genann_deltas(ann, 0, o, delta + (size_t)n_delta * s, desired_outputs + (size_t)ann->outputs * s);
+    }
 
-            ++d;
+    /* Then the gradient one layer at a time, output layer first. */
+    for (h = ann->hidden_layers; h >= 0; --h) {
+        const int n_in = ann->layer[h].size;
+        const int n_out = ann->layer[h+1].size;
+        const int w0 = ann->weight_offset[h+1];
+        const int i0 = ann->output_offset[h];
+        const int d0 = ann->delta_offset[h+1];
+
+        for (j = 0; j < n_out; ++j) {
+            double *b = grad + genann_bias_index(ann, h+1, j);
+            double *g = grad + genann_row_index(ann, h+1, j);
+            for (s = 0; s < count; ++s) {
+                const double d = delta[(size_t)n_delta * s + d0 + j];
+                *b -= d;
+                genann_simd.axpy(g, d, output + (size_t)ann->total_neurons * s + i0, n_in);
+            }
         }
 
-        assert(w - ann->weight == ann->total_weights);
+        /* The layer's slice runs to its last bias or its last row, whichever is later. */
+        const size_t bias_end = genann_bias_index(ann, h+1, n_out-1) + 1;
+        const size_t row_end = genann_row_index(ann, h+1, n_out-1) + n_in;
+        if (done) done(h, grad + w0, (int)((bias_end > row_end ? bias_end : row_end) - w0), user);
     }
 
+    free(output);
+    return 0;
+}
 
-    /* Train the hidden layers. */
-    for (h = ann->hidden_layers - 1; h >= 0; --h) {
 
-        /* Find first delta in this layer. */
-        double const *d = ann->delta + (h * ann->hidden);
+void genann_apply(genann *ann, double const *grad, double learning_rate) {
+    genann_simd.axpy(ann->weight, learning_rate, grad, ann->total_weights);
+}
 
-        /* Find first input to this layer. */
-        double const *i = ann->output + (h
-                ? (ann->inputs + ann->hidden * (h-1))
-                : 0);
 
-        /* Find first weight to this layer. */
-        double *w = ann->weight + (h
-                ? ((ann->inputs+1) * ann->hidden + (ann->hidden+1) * (ann->hidden) * (h-1))
-                : 0);
+void genann_write(genann const *ann, FILE *out) {
+    fprintf(out, "%d %d %d %d", ann->inputs, ann->hidden_layers, ann->hidden, ann->outputs);
 
+    /* Hidden layers of different widths: hidden is 0, and the widths follow. */
+    int l, j, i;
+    for (l = 1; l <= ann->hidden_layers && ann->hidden == 0; ++l) {
+        fprintf(out, " %d", ann->layer[l].size);
+    }
 
-        for (j = 0; j < ann->hidden; ++j) {
-            for (k = 0; k < (h == 0 ? ann->inputs : ann->hidden) + 1; ++k) {
-                if (k == 0) {
-                    *w++ += *d * learning_rate * -1.0;
-                } else {
-                    *w++ += *d * learning_rate * i[k-1];
-                }
+    /* Each neuron's bias, then its input weights, whatever the layout:
+     * no alignment gaps or row padding. */
+    for (l = 1; l < ann->layers; ++l) {
+        for (j = 0; j < ann->layer[l].size; ++j) {
+            double const *w = ann->weight + genann_row_index(ann, l, j);
+            fprintf(out, " %.20e", ann->weight[genann_bias_index(ann, l, j)]);
+            for (i = 0; i < ann->layer[l-1].size; ++i) {
+                fprintf(out, " %.20e", w[i]);
             }
-            ++d;
         }
+    }
+}
+
+
+
 
+/* Binary model file. A 64-byte header, then the weights as raw doubles
+ * starting at header_size, which is a multiple of 64 so a mapping of the
+ * file has them cache-line aligned. Native byte order, checked on load.
+ * Networks genann_init can describe are written as version 1; others as
+ * version 2, with a genann_file_layer per layer after the header and the
+ * weights in the network's own layout, alignment gaps included. */
+#define GENANN_MAGIC "GENANNB"
+#define GENANN_BINARY_VERSION 2
+#define GENANN_BYTE_ORDER 0x01020304u
+#define GENANN_DTYPE_F64 1
+
+typedef struct genann_file_header {
+    char magic[8];              /* GENANN_MAGIC, NUL terminated */
+    uint32_t version;           /* 1, or GENANN_BINARY_VERSION with a layer table */
+    uint32_t header_size;       /* offset of the weights, multiple of 64 */
+    int32_t inputs, hidden_layers, hidden, outputs;
+    uint8_t act_hidden, act_output; /* genann_act_id values */
+    uint8_t dtype;              /* GENANN_DTYPE_F64 */
+    uint8_t reserved0;
+    uint32_t byte_order;        /* GENANN_BYTE_ORDER as written */
+    uint32_t total_weights;
+    uint32_t reserved1;
+    uint64_t checksum;          /* genann_checksum of the weights */
+    uint64_t reserved2;
+} genann_file_header;
+
+typedef char genann_file_header_is_64_bytes[sizeof(genann_file_header) == 64 ? 1 : -1];
+
+typedef struct genann_file_layer {
+    int32_t size, align;
+    uint8_t act;                /* genann_act_id value, 0 for the network's default */
+    uint8_t padded;             /* genann_layer.padded */
+    uint8_t reserved[6];
+} genann_file_layer;
+
+
+/* Activation ids stored in the header. 0 is a user function, which loads as the default. */
+static const genann_actfun genann_act_by_id[] = {
+    0, genann_act_sigmoid, genann_act_sigmoid_cached, genann_act_sigmoid_fast,
+    genann_act_threshold, genann_act_linear
+};
+#define GENANN_ACT_IDS ((int)(sizeof(genann_act_by_id) / sizeof(genann_act_by_id[0])))
+
+static uint8_t genann_act_id(genann_actfun act) {
+    int i;
+    for (i = 1; i < GENANN_ACT_IDS; ++i) {
+        if (genann_act_by_id[i] == act) return (uint8_t)i;
     }
+    return 0;
+}
 
+
+/* FNV-1a over 64-bit words rather than bytes, so checking a large model
+ * costs about as much as reading it. n is a multiple of 8 (it covers doubles). */
+static uint64_t genann_checksum(void const *data, size_t n) {
+    unsigned char const *p = data;
+    uint64_t h = 14695981039346656037ULL, word;
+    size_t i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        memcpy(&word, p + i, 8);
+        h ^= word;
+        h *= 1099511628211ULL;
+    }
+    return h;
 }
 
 
-void genann_write(genann const *ann, FILE *out) {
-    fprintf(out, "%d %d %d %d", ann->inputs, ann->hidden_layers, ann->hidden, ann->outputs);
+/* Checks a header read from a file of file_size bytes (0 if unknown) and
+ * returns 0, or -1 with errno set. */
+static int genann_check_header(genann_file_header const *hdr, size_t file_size) {
+    if (memcmp(hdr->magic, GENANN_MAGIC, sizeof(GENANN_MAGIC)) != 0
+            || (hdr->version != 1 && hdr->version != GENANN_BINARY_VERSION)
+            || hdr->byte_order != GENANN_BYTE_ORDER
+            || hdr->dtype != GENANN_DTYPE_F64
+            || hdr->header_size < sizeof(genann_file_header)
+            || hdr->header_size % 64 != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (file_size && file_size < hdr->header_size + sizeof(double) * (size_t)hdr->total_weights) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* Every layer has at least two weights, which bounds the layer count. */
+    if (hdr->hidden_layers < 0 || (size_t)hdr->hidden_layers + 1 > hdr->total_weights / 2
+            || (hdr->version > 1 && hdr->header_size < sizeof(genann_file_header) + sizeof(genann_file_layer) * ((size_t)hdr->hidden_layers + 2))) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
 
-    int i;
-    for (i = 0; i < ann->total_weights; ++i) {
-        fprintf(out, " %.20e", ann->weight[i]);
+
+/* Allocates an ann for a checked header and its layer table (0 for version
+ * 1), without weights, and sets its activations. */
+static genann *genann_alloc_header(genann_file_header const *hdr, genann_file_layer const *table, int own_weights) {
+    const int layers = hdr->hidden_layers + 2;
+    genann_layer *layer = genann_uniform_layers(hdr->inputs, hdr->hidden_layers, hdr->hidden, hdr->outputs);
+    int l;
+    if (!layer) return 0;
+    for (l = 0; table && l < layers; ++l) {
+        layer[l].size = table[l].size;
+        layer[l].align = table[l].align;
+        layer[l].padded = table[l].padded;
+        layer[l].activation = table[l].act < GENANN_ACT_IDS ? genann_act_by_id[table[l].act] : 0;
+    }
+
+    genann *ann = genann_alloc(layers, layer, own_weights, 0, 0);
+    free(layer);
+    if (!ann) return 0;
+    if (ann->total_weights != (int)hdr->total_weights) {
+        genann_free(ann);
+        errno = EINVAL;
+        return 0;
+    }
+    if (layers == 2) ann->hidden = hdr->hidden;
+    if (hdr->act_hidden && hdr->act_hidden < GENANN_ACT_IDS) ann->activation_hidden = genann_act_by_id[hdr->act_hidden];
+    if (hdr->act_output && hdr->act_output < GENANN_ACT_IDS) ann->activation_output = genann_act_by_id[hdr->act_output];
+    return ann;
+}
+
+
+int genann_write_binary(genann const *ann, FILE *out) {
+    const int uniform = genann_is_uniform(ann);
+    const size_t table = uniform ? 0 : sizeof(genann_file_layer) * ann->layers;
+    genann_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, GENANN_MAGIC, sizeof(GENANN_MAGIC));
+    hdr.version = uniform ? 1 : GENANN_BINARY_VERSION;
+    hdr.header_size = (sizeof(hdr) + table + 63) / 64 * 64;
+    hdr.inputs = ann->inputs;
+    hdr.hidden_layers = ann->hidden_layers;
+    hdr.hidden = ann->hidden;
+    hdr.outputs = ann->outputs;
+    hdr.act_hidden = genann_act_id(ann->activation_hidden);
+    hdr.act_output = genann_act_id(ann->activation_output);
+    hdr.dtype = GENANN_DTYPE_F64;
+    hdr.byte_order = GENANN_BYTE_ORDER;
+    hdr.total_weights = ann->total_weights;
+    hdr.checksum = genann_checksum(ann->weight, sizeof(double) * ann->total_weights);
+
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) return -1;
+
+    /* The layer table, zero padded to header_size. */
+    if (!uniform) {
+        char pad[64] = {0};
+        int l;
+        for (l = 0; l < ann->layers; ++l) {
+            genann_file_layer fl;
+            memset(&fl, 0, sizeof(fl));
+            fl.size = ann->layer[l].size;
+            fl.align = ann->layer[l].align;
+            fl.padded = ann->layer[l].padded != 0;
+            fl.act = ann->layer[l].activation ? genann_act_id(ann->layer[l].activation) : 0;
+            if (fwrite(&fl, sizeof(fl), 1, out) != 1) return -1;
+        }
+        const size_t rest = hdr.header_size - sizeof(hdr) - table;
+        if (rest && fwrite(pad, rest, 1, out) != 1) return -1;
+    }
+
+    if (fwrite(ann->weight, sizeof(double), ann->total_weights, out) != (size_t)ann->total_weights) return -1;
+    return 0;
+}
+
+
+genann *genann_read_binary(FILE *in) {
+    genann_file_header hdr;
+
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || genann_check_header(&hdr, 0) != 0) {
+        perror("genann_read_binary");
+        return NULL;
+    }
+
+    /* The layer table of version 2, then whatever else is before header_size. */
+    const size_t table = hdr.version > 1 ? sizeof(genann_file_layer) * ((size_t)hdr.hidden_layers + 2) : 0;
+    genann_file_layer *layers = table ? genann_heap_alloc(0, table) : 0;
+    if (table && (!layers || fread(layers, table, 1, in) != 1)) {
+        fprintf(stderr, "genann_read_binary: short layer table\n");
+        free(layers);
+        return NULL;
+    }
+    if (hdr.header_size > sizeof(hdr) + table && fseek(in, hdr.header_size - sizeof(hdr) - table, SEEK_CUR) != 0) {
+        perror("fseek");
+        free(layers);
+        return NULL;
     }
+
+    genann *ann = genann_alloc_header(&hdr, layers, 1);
+    free(layers);
+    if (!ann) {
+        perror("genann_read_binary");
+        return NULL;
+    }
+
+    if (fread(ann->weight, sizeof(double), ann->total_weights, in) != (size_t)ann->total_weights
+            || genann_checksum(ann->weight, sizeof(double) * ann->total_weights) != hdr.checksum) {
+        fprintf(stderr, "genann_read_binary: short or corrupt weights\n");
+        genann_free(ann);
+        return NULL;
+    }
+
+    return ann;
 }
 
 
+genann *genann_mmap(const char *path) {
+    struct stat st;
+    void *map;
+    genann_file_header const *hdr;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(genann_file_header)) {
+        fprintf(stderr, "%s: not a genann binary model\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    /* Read-only and shared: every process mapping the file uses the same page-cache pages. */
+    map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    hdr = map;
+    genann *ann = 0;
+    if (genann_check_header(hdr, st.st_size) == 0) {
+        ann = genann_alloc_header(hdr, hdr->version > 1 ? (genann_file_layer const *)(hdr + 1) : 0, 0);
+    }
+    if (!ann) {
+        fprintf(stderr, "%s: not a genann binary model\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    ann->weight = (double*)((char*)map + hdr->header_size);
+    ann->mapping = map;
+    ann->mapping_size = st.st_size;
+
+    if (genann_checksum(ann->weight, sizeof(double) * ann->total_weights) != hdr->checksum) {
+        fprintf(stderr, "%s: weight checksum mismatch\n", path);
+        genann_free(ann);
+        return NULL;
+    }
+
+    return ann;
+}
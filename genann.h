@@ -32,6 +32,7 @@
 #define __GENANN_H__
 
 #include <stdio.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -47,14 +48,41 @@ extern "C" {
 typedef double (*genann_actfun)(double a);
 
 
+/* Padded rows are rounded up to this many doubles: one 64-byte cache line,
+ * and a whole number of vectors for every SIMD width genann_simd uses. */
+#define GENANN_ROW_DOUBLES 8
+
+/* One layer of a network for genann_init_layers: the input layer first, then
+ * each hidden layer, then the output layer. */
+typedef struct genann_layer {
+    /* Neurons in the layer (inputs for the input layer). */
+    int size;
+
+    /* Activation of the layer's neurons, 0 for the network's default
+     * (activation_hidden or activation_output). Unused for the input layer. */
+    genann_actfun activation;
+
+    /* Start the layer's weights and outputs on a multiple of this many
+     * doubles from the start of their buffers; 0 or 1 packs them. */
+    int align;
+
+    /* Nonzero to pad each neuron's input weights to a multiple of
+     * GENANN_ROW_DOUBLES, so every row starts on a cache line, and keep the
+     * layer's bias weights together after its rows. Implies an align of at
+     * least GENANN_ROW_DOUBLES. */
+    int padded;
+} genann_layer;
+
+
 typedef struct genann {
-    /* How many inputs, outputs, and hidden neurons. */
+    /* How many inputs, outputs, and hidden neurons. hidden is 0 when the
+     * hidden layers differ in width; layer has every layer's size. */
     int inputs, hidden_layers, hidden, outputs;
 
-    /* Which activation function to use for hidden neurons. Default: gennann_act_sigmoid_cached*/
+    /* Which activation function to use for hidden neurons. Default: genann_act_sigmoid_cached (genann_act_sigmoid_fast is opt-in)*/
     genann_actfun activation_hidden;
 
-    /* Which activation function to use for output. Default: gennann_act_sigmoid_cached*/
+    /* Which activation function to use for output. Default: genann_act_sigmoid_cached (genann_act_sigmoid_fast is opt-in)*/
     genann_actfun activation_output;
 
     /* Total number of weights, and size of weights buffer. */
@@ -72,6 +100,25 @@ typedef struct genann {
     /* Stores delta of each hidden and output neuron (total_neurons - inputs long). */
     double *delta;
 
+    /* Mapping that weight points into when loaded with genann_mmap, else 0. */
+    void *mapping;
+    size_t mapping_size;
+
+    /* Per-layer shape, layers = hidden_layers + 2 entries with the input
+     * layer first. Layer l > 0 has its weight rows at weight + weight_offset[l],
+     * its outputs at output + output_offset[l] and its deltas at
+     * delta + delta_offset[l]; the input layer's outputs are the inputs. */
+    int layers;
+    genann_layer *layer;
+    int *weight_offset, *output_offset, *delta_offset;
+
+    /* Neuron j of layer l has its input weights at weight + row_offset[l] +
+     * j * row_stride[l] and its bias weight at weight + bias_offset[l] +
+     * j * bias_stride[l]. Packed rows are the bias then the inputs; padded
+     * rows are only the inputs, with the biases one after another after the
+     * last row. Gradients (grad arguments) have the same layout. */
+    int *row_offset, *row_stride, *bias_offset, *bias_stride;
+
 } genann;
 
 
@@ -79,6 +126,21 @@ typedef struct genann {
 /* Creates and returns a new ann. */
 genann *genann_init(int inputs, int hidden_layers, int hidden, int outputs);
 
+/* Creates and returns a new ann with layers layers, described input layer
+ * first, e.g. {{784}, {256}, {64}, {10}} for a tapered 784-256-64-10 net.
+ * genann_init is this with every hidden layer hidden wide. The weight,
+ * output and delta buffers start on 64-byte boundaries. */
+genann *genann_init_layers(int layers, genann_layer const *layer);
+
+/* genann_init with every layer padded (see genann_layer). From the same
+ * random state it starts with the same weights as genann_init. */
+genann *genann_init_padded(int inputs, int hidden_layers, int hidden, int outputs);
+
+/* 1 if every hidden layer has the same width and activation and no layer is
+ * aligned or padded, so the weights are laid out as genann_init lays them out. Code
+ * that computes offsets from hidden, e.g. genann_tp and genann_pp, needs it. */
+int genann_is_uniform(genann const *ann);
+
 /* Creates ANN from file saved with genann_write. */
 genann *genann_read(FILE *in);
 
@@ -91,21 +153,180 @@ genann *genann_copy(genann const *ann);
 /* Frees the memory used by an ann. */
 void genann_free(genann *ann);
 
-/* Runs the feedforward algorithm to calculate the ann's output. */
+
+/* Arena: one region that networks, scratch activations, gradients and
+ * batches are carved from, each piece 64-byte aligned, and given back all at
+ * once by resetting to an earlier mark, e.g. at the end of every epoch.
+ * Nothing carved from an arena is freed on its own; in particular, do not
+ * genann_free a network from genann_copy_arena. Not thread safe: give each
+ * thread its own arena, or carve before the threads start. */
+typedef struct genann_arena {
+    char *base;
+    size_t size;                /* bytes at base */
+    size_t used;                /* bytes carved so far, alignment included */
+    size_t peak;                /* most ever used */
+    int owned;                  /* base was allocated by genann_arena_init */
+} genann_arena;
+
+/* Sets arena up over size bytes at memory, or over one heap allocation of
+ * size bytes if memory is 0. Returns 0, or -1 if that allocation fails. */
+int genann_arena_init(genann_arena *arena, void *memory, size_t size);
+
+/* Frees the region if genann_arena_init allocated it. */
+void genann_arena_free(genann_arena *arena);
+
+/* size bytes from arena, 64-byte aligned, or 0 if it does not have them. */
+void *genann_arena_alloc(genann_arena *arena, size_t size);
+
+/* genann_arena_reset(arena, mark) gives back everything carved since
+ * genann_arena_mark returned mark. A mark of 0 empties the arena. */
+size_t genann_arena_mark(genann_arena const *arena);
+void genann_arena_reset(genann_arena *arena, size_t mark);
+
+/* genann_copy into arena, and the most bytes that takes. */
+genann *genann_copy_arena(genann const *ann, genann_arena *arena);
+size_t genann_arena_size(genann const *ann);
+
+
+/* Heap allocation hook: called with the size of every heap allocation
+ * genann.c and omp_genann.c make, before making it, so a test can check
+ * that a loop allocates nothing. 0 removes it. May be called from several
+ * OpenMP threads at once. genann_heap_alloc is the allocator they use:
+ * malloc when align is 0 or 1, else aligned_alloc (size rounded up). */
+typedef void (*genann_alloc_hook)(size_t size, void *user);
+void genann_set_alloc_hook(genann_alloc_hook hook, void *user);
+void *genann_heap_alloc(size_t align, size_t size);
+
+/* Runs the feedforward algorithm to calculate the ann's output. Every
+ * neuron's output goes to ann->output, so two threads must not run the same
+ * ann at once; use genann_run_ctx for that. */
 double const *genann_run(genann const *ann, double const *inputs);
 
+/* Per-thread scratch for genann_run_ctx: the inputs and every neuron's output
+ * of one sample, total_neurons doubles on a 64-byte boundary. With one
+ * context per thread, any number of threads can run the same ann at once
+ * and ann is only read, so a single copy of the weights (or one genann_mmap)
+ * serves them all. A context fits any net with up to total_neurons neurons. */
+typedef struct genann_ctx {
+    double *output;
+    int total_neurons;
+} genann_ctx;
+
+/* A context for ann, in one heap allocation, or 0 if that fails. */
+genann_ctx *genann_ctx_init(genann const *ann);
+void genann_ctx_free(genann_ctx *ctx);
+
+/* genann_run with ctx as the scratch. Returns the outputs, which stay in ctx
+ * until its next run, or 0 if ctx is too small for ann. */
+double const *genann_run_ctx(genann const *ann, genann_ctx *ctx, double const *inputs);
+
+/* Runs n samples (inputs is n * ann->inputs long) and writes n * ann->outputs
+ * values to outputs. Each layer is computed as one blocked matrix product.
+ * Only reads ann. Returns 0, or -1 if scratch could not be allocated. */
+int genann_run_batch(genann const *ann, double const *inputs, int n, double *outputs);
+
+/* genann_run_batch with its scratch carved from arena and given back before
+ * returning. Returns -1 if arena is too small. genann_run_batch_size is the
+ * most bytes of arena that takes, whatever n is. */
+int genann_run_batch_arena(genann const *ann, double const *inputs, int n, double *outputs, genann_arena *arena);
+size_t genann_run_batch_size(genann const *ann);
+
 /* Does a single backprop update. */
 void genann_train_omp(genann const *ann, double const *inputs, double const *desired_outputs, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count);
 void genann_train(genann const *ann, double const *inputs, double const *desired_outputs, double learning_rate);
+
+/* genann_train with the activations and deltas in caller scratch (as for
+ * genann_backprop) instead of ann->output and ann->delta. The weights are
+ * still updated in place, so threads with their own scratch can train the
+ * same ann at once, Hogwild style. */
+void genann_train_step(genann const *ann, double *output, double *delta, double const *inputs, double const *desired_outputs, double learning_rate);
+
+/* Mini-batch training over count samples. Every OpenMP thread works in its own
+ * scratch, the per-thread gradients are summed in a fixed tree order, and the
+ * weights are updated once per batch. The learning rate is per sample, as in genann_train. */
+void genann_train_batch_omp(genann *ann, double const *inputs, double const *desired_outputs, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count, unsigned int batch);
+
+/* genann_train_batch_omp with the threads' scratch carved from arena and given
+ * back before returning, so a call makes no heap allocation. Does nothing if
+ * arena is too small. */
+void genann_train_batch_arena_omp(genann *ann, double const *inputs, double const *desired_outputs, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count, unsigned int batch, genann_arena *arena);
+
+/* Hogwild training over count samples: every OpenMP thread runs
+ * genann_train_step on its share of the samples in its own scratch, and
+ * updates ann's weights in place without locks. A collision can lose an
+ * update but not mix two samples' activations. On a genann_init_padded net
+ * every row has its own cache lines, so threads updating different neurons
+ * only share the lines of the bias weights; with packed rows, neighbouring
+ * rows also share a line. Nothing is copied, so short calls (one streamed
+ * window each) cost no more than long ones. */
+void genann_train_hogwild_omp(genann *ann, double const *inputs, double const *desired_outputs, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count);
+
+/* The gradient of count samples, added into grad, computed by all OpenMP
+ * threads the same way as one genann_train_batch_omp batch. Only reads ann.
+ * Returns 0, or -1 if scratch could not be allocated. */
+int genann_gradient_omp(genann const *ann, double const *inputs, double const *desired_outputs, unsigned int size_i, unsigned int size_c, unsigned int count, double *grad);
+
+/* Runs one sample forward and backward without changing ann. output and delta
+ * are caller scratch (total_neurons and total_neurons - inputs long), and the
+ * weight update direction is added into grad (total_weights long). */
+void genann_backprop(genann const *ann, double *output, double *delta, double const *inputs, double const *desired_outputs, double *grad);
+
+/* Transposed copy of the weights of every layer after the first, so the
+ * backward pass reads them contiguously. The copy is only valid until the
+ * weights change, so build it once per batch. genann_transpose_size gives its
+ * length in doubles. genann_backprop_t is genann_backprop using such a copy. */
+int genann_transpose_size(genann const *ann);
+void genann_transpose(genann const *ann, double *wt);
+void genann_backprop_t(genann const *ann, double const *wt, double *output, double *delta, double const *inputs, double const *desired_outputs, double *grad);
+
+/* genann_backprop over count samples, summed into grad, computed layer by
+ * layer from the output layer back. As soon as a layer's slice of grad is
+ * final, done(layer, slice, length, user) is called, so the caller can start
+ * sending it while the earlier layers are still being computed. done may be
+ * 0. Returns 0, or -1 if scratch could not be allocated. */
+typedef void (*genann_layer_done)(int layer, double *grad, int n, void *user);
+int genann_backprop_layers(genann const *ann, double const *inputs, double const *desired_outputs, int count, double *grad, genann_layer_done done, void *user);
+
+/* Adds learning_rate * grad to the weights. */
+void genann_apply(genann *ann, double const *grad, double learning_rate);
+
 /* Saves the ann. */
 void genann_write(genann const *ann, FILE *out);
 
+/* Saves the ann in the binary format: a 64-byte header (magic, version,
+ * topology, activation ids, dtype, byte order, checksum) followed by the raw
+ * weights, 64-byte aligned. Returns 0 on success. */
+int genann_write_binary(genann const *ann, FILE *out);
+
+/* Creates ANN from a file saved with genann_write_binary. */
+genann *genann_read_binary(FILE *in);
+
+/* Maps a genann_write_binary file read-only and runs from it with no copy:
+ * ann->weight points into the mapping, which processes share through the page
+ * cache. Only for inference: genann_train would write to read-only memory;
+ * use genann_copy to get a trainable copy. genann_free unmaps it. */
+genann *genann_mmap(const char *path);
+
+
+/* Name of the vector kernels picked at startup (scalar, sse2, avx2 or avx512). */
+const char *genann_simd_name(void);
+
 
 double genann_act_sigmoid(double a);
 double genann_act_sigmoid_cached(double a);
+double genann_act_sigmoid_fast(double a);
 double genann_act_threshold(double a);
 double genann_act_linear(double a);
 
+/* The same activations over a whole layer: out[i] = act(in[i]) for i < n.
+ * in and out may be the same buffer. The forward pass uses these for the
+ * built-in activations instead of calling through genann_actfun per neuron. */
+void genann_act_sigmoid_n(double const *in, double *out, int n);
+void genann_act_sigmoid_cached_n(double const *in, double *out, int n);
+void genann_act_sigmoid_fast_n(double const *in, double *out, int n);
+void genann_act_threshold_n(double const *in, double *out, int n);
+void genann_act_linear_n(double const *in, double *out, int n);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,367 @@
+/*
+ * GENANN_COMPRESS - lossy codecs for exchanging gradients between nodes
+ * See genann_compress.h.
+ */
+
+#include "genann_compress.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GENANN_X86
+#include <immintrin.h>
+#endif
+
+#define GENANN_INT8_BLOCK 256
+#define GENANN_TOPK_DEFAULT 0.01
+
+typedef struct genann_topk_entry {
+    uint32_t index;
+    float value;
+} genann_topk_entry;
+
+
+static const char *const mode_names[] = {"none", "fp16", "bf16", "topk", "int8"};
+
+
+int genann_compress_parse(const char *name, double *ratio) {
+    int mode;
+    *ratio = GENANN_TOPK_DEFAULT;
+    if (!strncmp(name, "topk", 4) && (name[4] == 0 || name[4] == ':')) {
+        if (name[4] == ':') *ratio = atof(name + 5);
+        return *ratio > 0 && *ratio <= 1 ? GENANN_COMPRESS_TOPK : -1;
+    }
+    for (mode = 0; mode < (int)(sizeof(mode_names) / sizeof(mode_names[0])); ++mode) {
+        if (!strcmp(name, mode_names[mode])) return mode;
+    }
+    return -1;
+}
+
+
+const char *genann_compress_name(int mode) {
+    return mode >= 0 && mode < (int)(sizeof(mode_names) / sizeof(mode_names[0])) ? mode_names[mode] : "?";
+}
+
+
+/* Round to nearest even; saturates at the largest finite half, since an
+ * infinite gradient would poison every rank's sum. */
+static uint16_t genann_to_fp16(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    const uint32_t sign = (u >> 16) & 0x8000;
+    const int exp = (int)((u >> 23) & 0xFF) - 127 + 15;
+    uint32_t mant = u & 0x7FFFFF;
+    uint32_t h, rem, half;
+
+    if (((u >> 23) & 0xFF) == 0xFF) return sign | 0x7C00 | (mant ? 0x200 : 0);
+    if (exp >= 31) return sign | 0x7BFF;
+
+    if (exp <= 0) {
+        /* Subnormal half: m * 2^-24. */
+        if (exp < -10) return sign;
+        const int shift = 14 - exp;
+        mant |= 0x800000;
+        h = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        half = 1u << (shift - 1);
+    } else {
+        h = ((uint32_t)exp << 10) | (mant >> 13);
+        rem = mant & 0x1FFF;
+        half = 0x1000;
+    }
+    if (rem > half || (rem == half && (h & 1))) ++h;
+    if (h > 0x7BFF) h = 0x7BFF;
+    return sign | h;
+}
+
+
+static float genann_fp16_value(uint16_t h) {
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exp = (h >> 10) & 0x1F, mant = h & 0x3FF;
+    uint32_t u;
+    float f;
+
+    if (exp == 0) {
+        f = mant * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+    u = sign | (exp == 31 ? 0x7F800000 : (exp - 15 + 127) << 23) | (mant << 13);
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+
+/* Every half as a float, for decoding a message per rank per step. Filled
+ * before main with GCC, or by genann_compress_init. */
+static float fp16_table[65536];
+static int fp16_table_ready = 0;
+#ifdef GENANN_X86
+static int have_f16c = 0;
+#endif
+
+static void genann_fp16_init(void) {
+    int i;
+    if (fp16_table_ready) return;
+    for (i = 0; i < 65536; ++i) fp16_table[i] = genann_fp16_value((uint16_t)i);
+#ifdef GENANN_X86
+    have_f16c = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+#endif
+    fp16_table_ready = 1;
+}
+
+#ifdef __GNUC__
+__attribute__((constructor))
+static void genann_fp16_startup(void) {
+    genann_fp16_init();
+}
+#endif
+
+
+static float genann_from_fp16(uint16_t h) {
+    return fp16_table[h];
+}
+
+
+#ifdef GENANN_X86
+/* Packs r[0..n) to halves eight at a time and leaves the rounding error in
+ * r. Same results as genann_to_fp16: F16C also rounds to nearest even, and
+ * the clamp gives the same saturation. Returns how many were done. */
+__attribute__((target("avx,f16c")))
+static int genann_fp16_pack_f16c(double *r, uint16_t *h, int n) {
+    const __m256 limit = _mm256_set1_ps(65504.0f);
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        const __m256d lo = _mm256_loadu_pd(r + i), hi = _mm256_loadu_pd(r + i + 4);
+        __m256 f = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1);
+        f = _mm256_min_ps(_mm256_max_ps(f, _mm256_sub_ps(_mm256_setzero_ps(), limit)), limit);
+        const __m128i q = _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128((__m128i *)(h + i), q);
+        const __m256 back = _mm256_cvtph_ps(q);
+        _mm256_storeu_pd(r + i, _mm256_sub_pd(lo, _mm256_cvtps_pd(_mm256_castps256_ps128(back))));
+        _mm256_storeu_pd(r + i + 4, _mm256_sub_pd(hi, _mm256_cvtps_pd(_mm256_extractf128_ps(back, 1))));
+    }
+    return i;
+}
+#endif
+
+
+/* bf16 is the top half of an IEEE float. Round to nearest even when packing. */
+static uint16_t genann_to_bf16(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += 0x7FFF + ((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+
+static float genann_from_bf16(uint16_t b) {
+    uint32_t u = (uint32_t)b << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+
+/* Returns the k-th largest of a[0..n), reordering a. */
+static double genann_kth_largest(double *a, int n, int k) {
+    int lo = 0, hi = n - 1;
+    const int target = k - 1;
+    while (lo < hi) {
+        const double pivot = a[lo + (hi - lo) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (a[i] > pivot) ++i;
+            while (a[j] < pivot) --j;
+            if (i <= j) {
+                const double t = a[i];
+                a[i++] = a[j];
+                a[j--] = t;
+            }
+        }
+        if (target <= j) hi = j;
+        else if (target >= i) lo = i;
+        else break;
+    }
+    return a[target];
+}
+
+
+int genann_compress_init(genann_compressor *c, int mode, int n, double ratio) {
+    memset(c, 0, sizeof(*c));
+    if (mode < GENANN_COMPRESS_NONE || mode > GENANN_COMPRESS_INT8 || n < 1) return -1;
+
+    genann_fp16_init();
+    c->mode = mode;
+    c->n = n;
+    c->k = (int)(ratio * n);
+    if (c->k < 1) c->k = 1;
+    if (c->k > n) c->k = n;
+
+    if (mode != GENANN_COMPRESS_NONE) {
+        c->residual = calloc(n, sizeof(double));
+        if (!c->residual) return -1;
+    }
+    if (mode == GENANN_COMPRESS_TOPK) {
+        c->scratch = malloc(sizeof(double) * n);
+        if (!c->scratch) {
+            genann_compress_free(c);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+void genann_compress_free(genann_compressor *c) {
+    free(c->residual);
+    free(c->scratch);
+    c->residual = c->scratch = 0;
+}
+
+
+size_t genann_compress_size(genann_compressor const *c) {
+    const size_t n = c->n;
+    switch (c->mode) {
+        case GENANN_COMPRESS_FP16:
+        case GENANN_COMPRESS_BF16: return sizeof(uint16_t) * n;
+        case GENANN_COMPRESS_TOPK: return sizeof(genann_topk_entry) * c->k;
+        case GENANN_COMPRESS_INT8: return sizeof(float) * ((n + GENANN_INT8_BLOCK - 1) / GENANN_INT8_BLOCK) + n;
+    }
+    return sizeof(double) * n;
+}
+
+
+void genann_compress(genann_compressor *c, double const *grad, void *out) {
+    const int n = c->n;
+    double *r = c->residual;
+    int i;
+
+    if (c->mode == GENANN_COMPRESS_NONE) {
+        memcpy(out, grad, sizeof(double) * n);
+        return;
+    }
+
+    /* Error feedback: compress gradient plus what earlier messages missed,
+     * and keep what this one misses. */
+    for (i = 0; i < n; ++i) r[i] += grad[i];
+
+    switch (c->mode) {
+        case GENANN_COMPRESS_FP16: {
+            uint16_t *h = out;
+            i = 0;
+#ifdef GENANN_X86
+            if (have_f16c) i = genann_fp16_pack_f16c(r, h, n);
+#endif
+            for (; i < n; ++i) {
+                h[i] = genann_to_fp16((float)r[i]);
+                r[i] -= genann_from_fp16(h[i]);
+            }
+            break;
+        }
+
+        case GENANN_COMPRESS_BF16: {
+            uint16_t *h = out;
+            for (i = 0; i < n; ++i) {
+                h[i] = genann_to_bf16((float)r[i]);
+                r[i] -= genann_from_bf16(h[i]);
+            }
+            break;
+        }
+
+        case GENANN_COMPRESS_TOPK: {
+            genann_topk_entry *e = out;
+            int kept = 0;
+            /* A NaN or infinite residual would upset the selection; drop it. */
+            for (i = 0; i < n; ++i) {
+                if (!isfinite(r[i])) r[i] = 0;
+                c->scratch[i] = fabs(r[i]);
+            }
+            const double threshold = genann_kth_largest(c->scratch, n, c->k);
+
+            /* Everything above the threshold, then ties up to k. */
+            for (i = 0; i < n && kept < c->k; ++i) {
+                if (fabs(r[i]) > threshold) {
+                    e[kept].index = i;
+                    e[kept++].value = (float)r[i];
+                }
+            }
+            for (i = 0; i < n && kept < c->k; ++i) {
+                if (fabs(r[i]) == threshold) {
+                    e[kept].index = i;
+                    e[kept++].value = (float)r[i];
+                }
+            }
+            for (i = 0; i < kept; ++i) r[e[i].index] -= e[i].value;
+
+            /* The message always holds k entries; pad with zeros. */
+            for (; kept < c->k; ++kept) {
+                e[kept].index = 0;
+                e[kept].value = 0;
+            }
+            break;
+        }
+
+        case GENANN_COMPRESS_INT8: {
+            const int blocks = (n + GENANN_INT8_BLOCK - 1) / GENANN_INT8_BLOCK;
+            float *scale = out;
+            int8_t *q = (int8_t *)(scale + blocks);
+            int b;
+            for (b = 0; b < blocks; ++b) {
+                const int end = (b + 1) * GENANN_INT8_BLOCK < n ? (b + 1) * GENANN_INT8_BLOCK : n;
+                double m = 0;
+                for (i = b * GENANN_INT8_BLOCK; i < end; ++i) m = fabs(r[i]) > m ? fabs(r[i]) : m;
+                scale[b] = (float)(m / 127);
+                for (i = b * GENANN_INT8_BLOCK; i < end; ++i) {
+                    q[i] = scale[b] > 0 ? (int8_t)lrint(r[i] / scale[b]) : 0;
+                    r[i] -= (double)q[i] * scale[b];
+                }
+            }
+            break;
+        }
+    }
+}
+
+
+void genann_decompress_add(genann_compressor const *c, void const *in, double *sum) {
+    const int n = c->n;
+    int i;
+
+    switch (c->mode) {
+        case GENANN_COMPRESS_NONE: {
+            double const *d = in;
+            for (i = 0; i < n; ++i) sum[i] += d[i];
+            break;
+        }
+
+        case GENANN_COMPRESS_FP16: {
+            uint16_t const *h = in;
+            for (i = 0; i < n; ++i) sum[i] += genann_from_fp16(h[i]);
+            break;
+        }
+
+        case GENANN_COMPRESS_BF16: {
+            uint16_t const *h = in;
+            for (i = 0; i < n; ++i) sum[i] += genann_from_bf16(h[i]);
+            break;
+        }
+
+        case GENANN_COMPRESS_TOPK: {
+            genann_topk_entry const *e = in;
+            for (i = 0; i < c->k; ++i) {
+                if (e[i].index < (uint32_t)n) sum[e[i].index] += e[i].value;
+            }
+            break;
+        }
+
+        case GENANN_COMPRESS_INT8: {
+            const int blocks = (n + GENANN_INT8_BLOCK - 1) / GENANN_INT8_BLOCK;
+            float const *scale = in;
+            int8_t const *q = (int8_t const *)(scale + blocks);
+            for (i = 0; i < n; ++i) sum[i] += (double)q[i] * scale[i / GENANN_INT8_BLOCK];
+            break;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * GENANN_COMPRESS - lossy codecs for exchanging gradients between nodes
+ *
+ * A genann_compressor turns a gradient of n doubles into a packed message
+ * of fixed size, and messages are decoded by adding them into a sum:
+ *
+ *   none  - the doubles as they are, 8 bytes per value
+ *   fp16  - IEEE half precision, 2 bytes per value
+ *   bf16  - the upper half of a float, 2 bytes per value
+ *   topk  - the k largest values by magnitude as (index, float) pairs
+ *   int8  - blocks of 256 values as one float scale and 256 signed bytes
+ *
+ * The lossy modes keep error feedback: what a message failed to carry is
+ * remembered in a residual and added to the next gradient before it is
+ * compressed, so small components are delayed rather than lost. This is
+ * what keeps top-k from stalling; for the others it removes the rounding
+ * bias.
+ */
+
+#ifndef __GENANN_COMPRESS_H__
+#define __GENANN_COMPRESS_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    GENANN_COMPRESS_NONE,
+    GENANN_COMPRESS_FP16,
+    GENANN_COMPRESS_BF16,
+    GENANN_COMPRESS_TOPK,
+    GENANN_COMPRESS_INT8
+};
+
+typedef struct genann_compressor {
+    int mode;
+    int n;                          /* values per message */
+    int k;                          /* values kept by topk */
+    double *residual;               /* error feedback, n long; 0 for none */
+    double *scratch;                /* topk selection, n long */
+} genann_compressor;
+
+/* Parses "none", "fp16", "bf16", "int8", or "topk" with an optional kept
+ * fraction ("topk:0.01", default 0.01). Returns the mode, or -1, and stores
+ * the fraction in *ratio. */
+int genann_compress_parse(const char *name, double *ratio);
+
+/* Name of a mode, as parsed. */
+const char *genann_compress_name(int mode);
+
+/* Sets up c for messages of n values. ratio is the topk fraction. Returns 0,
+ * or -1 on a bad mode or allocation failure. */
+int genann_compress_init(genann_compressor *c, int mode, int n, double ratio);
+void genann_compress_free(genann_compressor *c);
+
+/* Size in bytes of every message c produces. */
+size_t genann_compress_size(genann_compressor const *c);
+
+/* Packs grad (n values) into out, genann_compress_size bytes, updating the
+ * residual. */
+void genann_compress(genann_compressor *c, double const *grad, void *out);
+
+/* Adds a message made by a compressor like c into sum (n values). */
+void genann_decompress_add(genann_compressor const *c, void const *in, double *sum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GENANN_COMPRESS_H__*/
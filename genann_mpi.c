@@ -0,0 +1,165 @@
+/*
+ * GENANN_MPI - gradient exchange between MPI ranks
+ * See genann_mpi.h.
+ */
+
+#include "genann_mpi.h"
+#include "genann_simd.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A gradient with no values means the worker is done. */
+#define GENANN_PS_GRAD 1
+#define GENANN_PS_WEIGHTS 2
+#define GENANN_PS_GATHER 3
+#define GENANN_PS_DONE 4
+
+
+int genann_allreduce_compressed(genann_compressor *c, double *grad, void *buf, MPI_Comm comm) {
+    int ranks, r, rc;
+
+    if (c->mode == GENANN_COMPRESS_NONE) {
+        return MPI_Allreduce(MPI_IN_PLACE, grad, c->n, MPI_DOUBLE, MPI_SUM, comm);
+    }
+
+    MPI_Comm_size(comm, &ranks);
+    MPI_Comm_rank(comm, &r);
+    const size_t size = genann_compress_size(c);
+    char *msgs = buf;
+
+    genann_compress(c, grad, msgs + size * r);
+    rc = MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, msgs, (int)size, MPI_BYTE, comm);
+    if (rc != MPI_SUCCESS) return rc;
+
+    memset(grad, 0, sizeof(double) * c->n);
+    for (r = 0; r < ranks; ++r) {
+        genann_decompress_add(c, msgs + size * r, grad);
+    }
+    return MPI_SUCCESS;
+}
+
+
+double genann_allreduce_bytes(genann_compressor const *c, int ranks) {
+    if (c->mode == GENANN_COMPRESS_NONE) {
+        return 2.0 * (ranks - 1) / ranks * sizeof(double) * c->n;
+    }
+    return (double)(ranks - 1) * genann_compress_size(c);
+}
+
+
+/* Shard s of the weights: [*first, *first + *n). */
+static void genann_ps_shard(genann const *ann, int servers, int s, int *first, int *n) {
+    *first = (int)((long)ann->total_weights * s / servers);
+    *n = (int)((long)ann->total_weights * (s + 1) / servers) - *first;
+}
+
+
+void genann_ps_serve(genann *ann, int servers, int staleness, double learning_rate, MPI_Comm comm, genann_ps_stats *stats) {
+    int size, rank, first, n, w;
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_rank(comm, &rank);
+    genann_ps_shard(ann, servers, rank, &first, &n);
+
+    const int workers = size - servers;
+    double *grad = malloc(sizeof(double) * (n > 0 ? n : 1));
+    int *clock = calloc(workers, sizeof(int));
+    char *waiting = calloc(workers, 1);
+    genann_ps_stats st = {0, 0, 0};
+    int active = workers;
+
+    if (!grad || !clock || !waiting) {
+        perror("malloc");
+        MPI_Abort(comm, 1);
+    }
+
+    while (active > 0) {
+        MPI_Status status;
+        /* Any tag, so a worker's done arrives after its last gradient. */
+        MPI_Recv(grad, n, MPI_DOUBLE, MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
+        const int from = status.MPI_SOURCE - servers;
+
+        if (status.MPI_TAG == GENANN_PS_DONE) {
+            /* Finished workers no longer hold anyone back. */
+            clock[from] = INT_MAX;
+            --active;
+        } else {
+            genann_simd.axpy(ann->weight + first, learning_rate, grad, n);
+            ++clock[from];
+            ++st.updates;
+            waiting[from] = 1;
+        }
+
+        int slowest = INT_MAX, fastest = 0;
+        for (w = 0; w < workers; ++w) {
+            if (clock[w] == INT_MAX) continue;
+            if (clock[w] < slowest) slowest = clock[w];
+            if (clock[w] > fastest) fastest = clock[w];
+        }
+        if (slowest != INT_MAX && fastest - slowest > st.max_spread) st.max_spread = fastest - slowest;
+
+        /* Reply to everyone within the bound, including workers held earlier. */
+        for (w = 0; w < workers; ++w) {
+            if (!waiting[w]) continue;
+            if (slowest != INT_MAX && clock[w] > slowest + staleness) {
+                if (w == from) ++st.held;
+                continue;
+            }
+            MPI_Send(ann->weight + first, n, MPI_DOUBLE, w + servers, GENANN_PS_WEIGHTS, comm);
+            waiting[w] = 0;
+        }
+    }
+
+    free(grad);
+    free(clock);
+    free(waiting);
+    if (stats) *stats = st;
+}
+
+
+int genann_ps_push_pull(genann *ann, double const *grad, int servers, MPI_Comm comm) {
+    MPI_Request req[2 * 64];
+    MPI_Request *r = servers <= 64 ? req : malloc(sizeof(MPI_Request) * 2 * servers);
+    int s, first, n;
+    if (!r) return MPI_ERR_NO_MEM;
+
+    /* Receives first, so a server's reply never waits on this rank. */
+    for (s = 0; s < servers; ++s) {
+        genann_ps_shard(ann, servers, s, &first, &n);
+        MPI_Irecv(ann->weight + first, n, MPI_DOUBLE, s, GENANN_PS_WEIGHTS, comm, &r[s]);
+    }
+    for (s = 0; s < servers; ++s) {
+        genann_ps_shard(ann, servers, s, &first, &n);
+        MPI_Isend(grad + first, n, MPI_DOUBLE, s, GENANN_PS_GRAD, comm, &r[servers + s]);
+    }
+    const int rc = MPI_Waitall(2 * servers, r, MPI_STATUSES_IGNORE);
+
+    if (r != req) free(r);
+    return rc;
+}
+
+
+void genann_ps_done(int servers, MPI_Comm comm) {
+    int s;
+    for (s = 0; s < servers; ++s) {
+        MPI_Send(0, 0, MPI_DOUBLE, s, GENANN_PS_DONE, comm);
+    }
+}
+
+
+void genann_ps_gather(genann *ann, int servers, MPI_Comm comm) {
+    int rank, s, first, n;
+    MPI_Comm_rank(comm, &rank);
+
+    if (rank == 0) {
+        for (s = 1; s < servers; ++s) {
+            genann_ps_shard(ann, servers, s, &first, &n);
+            MPI_Recv(ann->weight + first, n, MPI_DOUBLE, s, GENANN_PS_GATHER, comm, MPI_STATUS_IGNORE);
+        }
+    } else if (rank < servers) {
+        genann_ps_shard(ann, servers, rank, &first, &n);
+        MPI_Send(ann->weight + first, n, MPI_DOUBLE, 0, GENANN_PS_GATHER, comm);
+    }
+}
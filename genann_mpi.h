@@ -0,0 +1,71 @@
+/*
+ * GENANN_MPI - gradient exchange between MPI ranks
+ *
+ * Helpers shared by the MPI drivers: compressed all-reduce and a parameter
+ * server. Link with genann.c and genann_compress.c.
+ */
+
+#ifndef __GENANN_MPI_H__
+#define __GENANN_MPI_H__
+
+#include <mpi.h>
+
+#include "genann.h"
+#include "genann_compress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sums grad (c->n values) over the ranks of comm, in place. Without
+ * compression this is one MPI_Allreduce. Otherwise every rank compresses
+ * its gradient with c, the messages are all-gathered into buf (ranks *
+ * genann_compress_size(c) bytes) and every rank adds them up in rank order,
+ * so all ranks end with the same sum. Returns the MPI error code. */
+int genann_allreduce_compressed(genann_compressor *c, double *grad, void *buf, MPI_Comm comm);
+
+/* Estimated bytes one rank sends per genann_allreduce_compressed, for a ring
+ * all-reduce of doubles or a ring all-gather of compressed messages. */
+double genann_allreduce_bytes(genann_compressor const *c, int ranks);
+
+
+/*
+ * Parameter server. Ranks 0 .. servers-1 of comm each hold one contiguous
+ * shard of ann->weight; the other ranks are workers. A worker pushes its
+ * gradient to every server and pulls the current weights back, without
+ * waiting for the other workers, so fast workers are not paced by slow
+ * ones. Each server applies a gradient to its shard as soon as it arrives.
+ *
+ * Staleness is bounded: a server holds back its reply to a worker that has
+ * pushed more than staleness steps beyond the slowest worker still running.
+ * 0 keeps all workers on the same step; larger values let fast workers run
+ * ahead on older weights.
+ */
+
+typedef struct genann_ps_stats {
+    long updates;               /* gradients applied by this server */
+    long held;                  /* replies held back by the staleness bound */
+    int max_spread;             /* largest step gap seen between workers */
+} genann_ps_stats;
+
+/* Server side: applies learning_rate * gradient for this rank's shard until
+ * every worker has called genann_ps_done. stats may be 0. */
+void genann_ps_serve(genann *ann, int servers, int staleness, double learning_rate, MPI_Comm comm, genann_ps_stats *stats);
+
+/* Worker side: sends grad to the servers and replaces ann->weight with the
+ * servers' current weights. Returns the MPI error code (MPI_ERR_NO_MEM if
+ * there are too many servers for its request array to be allocated). */
+int genann_ps_push_pull(genann *ann, double const *grad, int servers, MPI_Comm comm);
+
+/* Worker side: tells the servers this worker has finished. */
+void genann_ps_done(int servers, MPI_Comm comm);
+
+/* Collects the servers' shards into ann->weight on rank 0. Called by the
+ * servers only, after genann_ps_serve. */
+void genann_ps_gather(genann *ann, int servers, MPI_Comm comm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GENANN_MPI_H__*/
@@ -0,0 +1,168 @@
+/*
+ * GENANN_NUMA - placing training data and weights on the NUMA node of the
+ * threads that use them
+ * See genann_numa.h. genann_train_numa_omp is in omp_genann.c.
+ */
+
+#define _GNU_SOURCE
+#include "genann_numa.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#ifdef GENANN_LIBNUMA
+#include <numa.h>
+#endif
+
+
+int genann_numa_node(void) {
+    const int cpu = sched_getcpu();
+    if (cpu < 0) return 0;
+#ifdef GENANN_LIBNUMA
+    if (numa_available() >= 0) {
+        const int node = numa_node_of_cpu(cpu);
+        return node < 0 ? 0 : node;
+    }
+    return 0;
+#else
+    /* /sys/devices/system/cpu/cpuN has a nodeM link for its node. */
+    char path[64];
+    struct dirent *e;
+    int node = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir) return 0;
+    while ((e = readdir(dir)) != NULL) {
+        if (!strncmp(e->d_name, "node", 4) && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+            node = atoi(e->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+#endif
+}
+
+
+static void *genann_numa_alloc(size_t bytes, int node) {
+#ifdef GENANN_LIBNUMA
+    if (numa_available() >= 0) return numa_alloc_onnode(bytes, node);
+#endif
+    (void)node;
+    /* Large blocks come straight from mmap, untouched, so the pages go
+     * where the threads that fill them run. */
+    return malloc(bytes);
+}
+
+static void genann_numa_release(void *p, size_t bytes) {
+#ifdef GENANN_LIBNUMA
+    if (numa_available() >= 0) {
+        if (p) numa_free(p, bytes);
+        return;
+    }
+#endif
+    (void)bytes;
+    free(p);
+}
+
+
+int genann_numa_set_load(genann_numa_set *set, double const *inputs, double const *desired_outputs, unsigned int size_i, unsigned int size_c, unsigned int count) {
+    const int threads = omp_get_max_threads();
+    const char *env = getenv("GENANN_NUMA_NODES");
+    const int emulate = env ? atoi(env) : 0;
+    int t, k;
+
+    memset(set, 0, sizeof(*set));
+    set->threads = threads;
+    set->size_i = size_i;
+    set->size_c = size_c;
+    set->thread_node = malloc(sizeof(int) * 4 * threads);
+    if (!set->thread_node) return -1;
+    set->thread_index = set->thread_node + threads;
+    set->node_threads = set->thread_index + threads;
+    set->node_id = set->node_threads + threads;
+
+    /* Where each thread runs, as a system node number for now. */
+#pragma omp parallel num_threads(threads)
+    {
+        const int me = omp_get_thread_num();
+        set->thread_node[me] = emulate > 0 ? (int)((long)me * emulate / threads) : genann_numa_node();
+    }
+
+    /* Number the nodes that have threads 0, 1, ... in order of first
+     * appearance, and each node's threads likewise. */
+    for (t = 0; t < threads; ++t) {
+        for (k = 0; k < set->nodes && set->node_id[k] != set->thread_node[t]; ++k);
+        if (k == set->nodes) {
+            set->node_id[k] = set->thread_node[t];
+            set->node_threads[k] = 0;
+            ++set->nodes;
+        }
+        set->thread_node[t] = k;
+        set->thread_index[t] = set->node_threads[k]++;
+    }
+
+    set->count = malloc(sizeof(unsigned int) * set->nodes);
+    set->input = calloc(set->nodes, sizeof(double *));
+    set->output = calloc(set->nodes, sizeof(double *));
+    set->bytes = calloc(set->nodes, sizeof(size_t));
+    if (!set->count || !set->input || !set->output || !set->bytes) {
+        genann_numa_set_free(set);
+        return -1;
+    }
+
+    /* Contiguous shards, sized by each node's share of the threads. */
+    unsigned int *first = malloc(sizeof(unsigned int) * (set->nodes + 1));
+    if (!first) {
+        genann_numa_set_free(set);
+        return -1;
+    }
+    first[0] = 0;
+    for (k = 0, t = 0; k < set->nodes; ++k) {
+        t += set->node_threads[k];
+        first[k+1] = (unsigned int)((unsigned long long)count * t / threads);
+        set->count[k] = first[k+1] - first[k];
+        set->bytes[k] = sizeof(double) * ((size_t)set->count[k] * (size_i + size_c) + 1);
+        set->input[k] = genann_numa_alloc(set->bytes[k], set->node_id[k]);
+        set->output[k] = set->input[k] + (size_t)set->count[k] * size_i;
+        if (!set->input[k]) {
+            free(first);
+            genann_numa_set_free(set);
+            return -1;
+        }
+    }
+
+    /* Each thread copies its part of its node's shard, so that is where the
+     * pages are first written. */
+#pragma omp parallel num_threads(threads)
+    {
+        const int me = omp_get_thread_num();
+        const int node = set->thread_node[me];
+        const unsigned int n = set->count[node];
+        const unsigned int lo = (unsigned int)((unsigned long long)n * set->thread_index[me] / set->node_threads[node]);
+        const unsigned int hi = (unsigned int)((unsigned long long)n * (set->thread_index[me] + 1) / set->node_threads[node]);
+        memcpy(set->input[node] + (size_t)lo * size_i, inputs + ((size_t)first[node] + lo) * size_i, sizeof(double) * (hi - lo) * size_i);
+        memcpy(set->output[node] + (size_t)lo * size_c, desired_outputs + ((size_t)first[node] + lo) * size_c, sizeof(double) * (hi - lo) * size_c);
+    }
+
+    free(first);
+    return 0;
+}
+
+
+void genann_numa_set_free(genann_numa_set *set) {
+    int k;
+    if (set->input && set->bytes) {
+        for (k = 0; k < set->nodes; ++k) genann_numa_release(set->input[k], set->bytes[k]);
+    }
+    free(set->thread_node);
+    free(set->count);
+    free(set->input);
+    free(set->output);
+    free(set->bytes);
+    memset(set, 0, sizeof(*set));
+}
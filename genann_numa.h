@@ -0,0 +1,72 @@
+/*
+ * GENANN_NUMA - placing training data and weights on the NUMA node of the
+ * threads that use them
+ *
+ * Linux puts a page on the node of the thread that first writes it, so
+ * anything allocated and filled by the main thread ends up on one socket
+ * and every other socket reads it remotely. Here each OpenMP thread is
+ * assigned the node it runs on, and memory is written first by threads of
+ * the node that will use it:
+ *
+ *   - genann_numa_set_load splits the training set into one shard per
+ *     node, in proportion to the node's threads, and the node's threads
+ *     copy it in;
+ *   - genann_train_numa_omp trains Hogwild style (see
+ *     genann_train_hogwild_omp), each thread on its own node's shard, with
+ *     its scratch first touched by itself, in place on ann's weights.
+ *     With replicas set every node instead gets a whole copy of the
+ *     weights, copied in by its own threads, and every sync samples per
+ *     thread each copy's changes since the last sync are added to all of
+ *     them.
+ *
+ * Pin the threads, or they may run on another node than the one their data
+ * was placed for, e.g. OMP_PROC_BIND=spread OMP_PLACES=cores.
+ *
+ * Nodes come from /sys unless GENANN_NUMA_NODES=n is set in the
+ * environment, which splits the threads into n equal groups instead (to try
+ * a layout on a machine that does not have it). Built with
+ * -DGENANN_LIBNUMA and -lnuma, shards are allocated with numa_alloc_onnode
+ * and nodes looked up with libnuma rather than relying on first touch.
+ */
+
+#ifndef __GENANN_NUMA_H__
+#define __GENANN_NUMA_H__
+
+#include "genann.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct genann_numa_set {
+    int nodes;                  /* nodes with threads on them */
+    int *node_id;               /* system number of each of those nodes */
+    int threads;                /* OpenMP threads the set was laid out for */
+    int *thread_node;           /* node of each thread */
+    int *thread_index;          /* position of each thread within its node */
+    int *node_threads;          /* threads on each node */
+
+    unsigned int size_i, size_c;
+    unsigned int *count;        /* samples in each node's shard */
+    double **input, **output;   /* each node's shard */
+    size_t *bytes;              /* size of each shard's allocation */
+} genann_numa_set;
+
+/* Node the calling thread is running on, 0 if unknown. */
+int genann_numa_node(void);
+
+/* Lays count samples out as one shard per node for the current number of
+ * OpenMP threads. Returns 0, or -1 on allocation failure. */
+int genann_numa_set_load(genann_numa_set *set, double const *inputs, double const *desired_outputs, unsigned int size_i, unsigned int size_c, unsigned int count);
+void genann_numa_set_free(genann_numa_set *set);
+
+/* One epoch over set, Hogwild style, with the set's number of threads. With
+ * replicas, each node trains its own copy of the weights and the copies are
+ * merged every sync samples per thread (0: only at the end). */
+void genann_train_numa_omp(genann *ann, genann_numa_set const *set, double learning_rate, int replicas, unsigned int sync);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GENANN_NUMA_H__*/
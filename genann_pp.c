@@ -0,0 +1,307 @@
+/*
+ * GENANN_PP - one network split across MPI ranks by layer
+ * See genann_pp.h.
+ */
+
+#include "genann_pp.h"
+#include "genann_simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define GENANN_PP_FORWARD 1
+#define GENANN_PP_BACKWARD 2
+
+
+static int genann_pp_n_in(genann_pp const *pp, int h) {
+    return h == 0 ? pp->inputs : pp->hidden;
+}
+
+static int genann_pp_n_out(genann_pp const *pp, int h) {
+    return h == pp->hidden_layers ? pp->outputs : pp->hidden;
+}
+
+/* Offset of layer h in the whole network's weights, as genann lays them out. */
+static int genann_pp_w0(genann_pp const *pp, int h) {
+    if (h > pp->hidden_layers) return genann_pp_w0(pp, pp->hidden_layers) + (genann_pp_n_in(pp, h-1) + 1) * pp->outputs;
+    return h == 0 ? 0 : (pp->inputs+1) * pp->hidden + (pp->hidden+1) * pp->hidden * (h-1);
+}
+
+/* Offset in a slot's activations of the input of this rank's k-th layer;
+ * k = number of layers gives the last layer's output. */
+static int genann_pp_act_at(genann_pp const *pp, int k) {
+    const int l0 = pp->layer_first[pp->rank];
+    int off = genann_pp_n_in(pp, l0), i;
+    if (k == 0) return 0;
+    for (i = 0; i < k - 1; ++i) off += genann_pp_n_out(pp, l0 + i);
+    return off * pp->micro;
+}
+
+/* Offset in a slot's deltas of this rank's k-th layer. */
+static int genann_pp_delta_at(genann_pp const *pp, int k) {
+    const int l0 = pp->layer_first[pp->rank];
+    int off = 0, i;
+    for (i = 0; i < k; ++i) off += genann_pp_n_out(pp, l0 + i);
+    return off * pp->micro;
+}
+
+
+genann_pp *genann_pp_init(genann const *ann, int micro, MPI_Comm comm) {
+    const int layers = ann->hidden_layers + 1;
+    int r, h;
+
+    if (micro < 1 || !genann_is_uniform(ann)) return 0;
+    genann_pp *pp = calloc(1, sizeof(genann_pp));
+    if (!pp) return 0;
+
+    pp->inputs = ann->inputs;
+    pp->hidden_layers = ann->hidden_layers;
+    pp->hidden = ann->hidden;
+    pp->outputs = ann->outputs;
+    pp->activation_hidden = ann->activation_hidden;
+    pp->activation_output = ann->activation_output;
+    pp->comm = comm;
+    pp->micro = micro;
+    MPI_Comm_rank(comm, &pp->rank);
+    MPI_Comm_size(comm, &pp->ranks);
+
+    if (pp->ranks > layers) {
+        free(pp);
+        return 0;
+    }
+
+    /* Cut where the running weight count passes each rank's share, leaving
+     * at least one layer for every rank still to come. */
+    pp->layer_first = malloc(sizeof(int) * (pp->ranks + 1));
+    if (!pp->layer_first) {
+        free(pp);
+        return 0;
+    }
+    pp->layer_first[0] = 0;
+    for (r = 1, h = 1; r < pp->ranks; ++r) {
+        const double share = (double)ann->total_weights * r / pp->ranks;
+        if (h <= pp->layer_first[r-1]) h = pp->layer_first[r-1] + 1;
+        while (h < layers - (pp->ranks - r) && genann_pp_w0(pp, h) < share) ++h;
+        pp->layer_first[r] = h;
+    }
+    pp->layer_first[pp->ranks] = layers;
+
+    const int l0 = pp->layer_first[pp->rank], l1 = pp->layer_first[pp->rank + 1];
+    pp->first_weight = genann_pp_w0(pp, l0);
+    pp->total_weights = genann_pp_w0(pp, l1) - pp->first_weight;
+    pp->act_size = genann_pp_act_at(pp, l1 - l0 + 1);
+    pp->delta_size = genann_pp_delta_at(pp, l1 - l0);
+
+    const size_t slots = pp->ranks;
+    pp->weight = malloc(sizeof(double) * pp->total_weights * 2);
+    pp->act = malloc(sizeof(double) * (pp->act_size + pp->delta_size + genann_pp_n_in(pp, l0) * micro) * slots
+                     + sizeof(double) * genann_pp_n_out(pp, l1 - 1) * micro);
+    pp->sent = malloc(sizeof(MPI_Request) * 2 * slots);
+    if (!pp->weight || !pp->act || !pp->sent) {
+        genann_pp_free(pp);
+        return 0;
+    }
+    pp->grad = pp->weight + pp->total_weights;
+    pp->delta = pp->act + pp->act_size * slots;
+    pp->back = pp->delta + pp->delta_size * slots;
+    pp->recv = pp->back + genann_pp_n_in(pp, l0) * micro * slots;
+    for (r = 0; r < 2 * (int)slots; ++r) pp->sent[r] = MPI_REQUEST_NULL;
+
+    memcpy(pp->weight, ann->weight + pp->first_weight, sizeof(double) * pp->total_weights);
+    return pp;
+}
+
+
+genann *genann_pp_gather(genann_pp const *pp) {
+    genann *ann = 0;
+    int r, ok = 1;
+    int *count = 0, *first = 0;
+
+    if (pp->rank == 0) {
+        ann = genann_init(pp->inputs, pp->hidden_layers, pp->hidden, pp->outputs);
+        count = malloc(sizeof(int) * 2 * pp->ranks);
+        ok = ann && count;
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, pp->comm);
+    if (!ok) {
+        if (ann) genann_free(ann);
+        free(count);
+        return 0;
+    }
+
+    if (ann) {
+        ann->activation_hidden = pp->activation_hidden;
+        ann->activation_output = pp->activation_output;
+        first = count + pp->ranks;
+        for (r = 0; r < pp->ranks; ++r) {
+            first[r] = genann_pp_w0(pp, pp->layer_first[r]);
+            count[r] = genann_pp_w0(pp, pp->layer_first[r + 1]) - first[r];
+        }
+    }
+    MPI_Gatherv(pp->weight, pp->total_weights, MPI_DOUBLE,
+                ann ? ann->weight : 0, count, first, MPI_DOUBLE, 0, pp->comm);
+
+    free(count);
+    return ann;
+}
+
+
+void genann_pp_free(genann_pp *pp) {
+    if (!pp) return;
+    free(pp->layer_first);
+    free(pp->weight);
+    free(pp->act);
+    free(pp->sent);
+    free(pp);
+}
+
+
+/* Forward pass of one micro-batch through this rank's layers, into slot. */
+static void genann_pp_forward(genann_pp *pp, int slot) {
+    const int l0 = pp->layer_first[pp->rank], l1 = pp->layer_first[pp->rank + 1];
+    double *act = pp->act + (size_t)pp->act_size * slot;
+    double const *w = pp->weight;
+    int h, j, s;
+
+    for (h = l0; h < l1; ++h) {
+        const int n_in = genann_pp_n_in(pp, h);
+        const int n_out = genann_pp_n_out(pp, h);
+        const genann_actfun act_fn = (h == pp->hidden_layers ? pp->activation_output : pp->activation_hidden);
+        double const *in = act + genann_pp_act_at(pp, h - l0);
+        double *out = act + genann_pp_act_at(pp, h - l0 + 1);
+
+        for (s = 0; s < pp->micro; ++s) {
+            double const *row = w;
+            for (j = 0; j < n_out; ++j) {
+                out[s * n_out + j] = act_fn(genann_simd.dot(row + 1, in + s * n_in, n_in) - row[0]);
+                row += n_in + 1;
+            }
+        }
+        w += (n_in + 1) * n_out;
+    }
+}
+
+
+/* Backward pass of one micro-batch in slot whose last-layer deltas are
+ * already set: adds to the gradient and, on every rank but the first,
+ * leaves the error for the previous rank's outputs in back. */
+static void genann_pp_backward(genann_pp *pp, int slot, double *back) {
+    const int l0 = pp->layer_first[pp->rank], l1 = pp->layer_first[pp->rank + 1];
+    double const *act = pp->act + (size_t)pp->act_size * slot;
+    double *delta = pp->delta + (size_t)pp->delta_size * slot;
+    int h, j, s;
+
+    for (h = l1 - 1; h >= l0; --h) {
+        const int n_in = genann_pp_n_in(pp, h);
+        const int n_out = genann_pp_n_out(pp, h);
+        double const *in = act + genann_pp_act_at(pp, h - l0);
+        double const *d = delta + genann_pp_delta_at(pp, h - l0);
+        double const *w = pp->weight + genann_pp_w0(pp, h) - pp->first_weight;
+        double *g = pp->grad + genann_pp_w0(pp, h) - pp->first_weight;
+
+        /* Error for this layer's inputs, from the weights before the update. */
+        if (h > l0 || back) {
+            double *prev = h > l0 ? delta + genann_pp_delta_at(pp, h - l0 - 1) : back;
+            memset(prev, 0, sizeof(double) * n_in * pp->micro);
+            for (s = 0; s < pp->micro; ++s) {
+                for (j = 0; j < n_out; ++j) {
+                    genann_simd.axpy(prev + s * n_in, d[s * n_out + j], w + j * (n_in + 1) + 1, n_in);
+                }
+            }
+            if (h > l0) {
+                for (j = 0; j < n_in * pp->micro; ++j) prev[j] *= in[j] * (1.0 - in[j]);
+            }
+        }
+
+        for (s = 0; s < pp->micro; ++s) {
+            double *row = g;
+            for (j = 0; j < n_out; ++j) {
+                row[0] -= d[s * n_out + j];
+                genann_simd.axpy(row + 1, d[s * n_out + j], in + s * n_in, n_in);
+                row += n_in + 1;
+            }
+        }
+    }
+}
+
+
+int genann_pp_train(genann_pp *pp, double const *inputs, double const *desired_outputs, int micro_batches, double learning_rate, genann_pp_stats *stats) {
+    const int l0 = pp->layer_first[pp->rank], l1 = pp->layer_first[pp->rank + 1];
+    const int first = pp->rank == 0, last = pp->rank == pp->ranks - 1;
+    const int n_in = genann_pp_n_in(pp, l0), n_out = genann_pp_n_out(pp, l1 - 1);
+    const int slots = pp->ranks;
+    /* Forwards before the first backward: enough to fill the pipe below. */
+    const int warmup = pp->ranks - pp->rank - 1 < micro_batches ? pp->ranks - pp->rank - 1 : micro_batches;
+    double t_start = MPI_Wtime(), busy = 0, t;
+    int fwd = 0, bwd = 0, rc = MPI_SUCCESS, j;
+
+    memset(pp->grad, 0, sizeof(double) * pp->total_weights);
+
+    while (bwd < micro_batches) {
+        /* One forward while there are some left and the warmup is done or
+         * still going; otherwise one backward. */
+        if (fwd < micro_batches && (fwd < warmup || fwd == bwd + warmup)) {
+            const int slot = fwd % slots;
+            double *act = pp->act + (size_t)pp->act_size * slot;
+
+            /* The slot's last sends must be out before it is reused. */
+            MPI_Waitall(2, pp->sent + 2 * slot, MPI_STATUSES_IGNORE);
+            if (first) {
+                memcpy(act, inputs + (size_t)fwd * pp->micro * n_in, sizeof(double) * pp->micro * n_in);
+            } else {
+                rc = MPI_Recv(act, n_in * pp->micro, MPI_DOUBLE, pp->rank - 1, GENANN_PP_FORWARD, pp->comm, MPI_STATUS_IGNORE);
+                if (rc != MPI_SUCCESS) break;
+            }
+
+            t = MPI_Wtime();
+            genann_pp_forward(pp, slot);
+            busy += MPI_Wtime() - t;
+
+            if (!last) {
+                MPI_Isend(act + genann_pp_act_at(pp, l1 - l0), n_out * pp->micro, MPI_DOUBLE, pp->rank + 1,
+                          GENANN_PP_FORWARD, pp->comm, &pp->sent[2 * slot]);
+            }
+            ++fwd;
+        } else {
+            const int slot = bwd % slots;
+            double const *out = pp->act + (size_t)pp->act_size * slot + genann_pp_act_at(pp, l1 - l0);
+            double *d = pp->delta + (size_t)pp->delta_size * slot + genann_pp_delta_at(pp, l1 - l0 - 1);
+            double *back = first ? 0 : pp->back + (size_t)n_in * pp->micro * slot;
+
+            if (!last) {
+                rc = MPI_Recv(pp->recv, n_out * pp->micro, MPI_DOUBLE, pp->rank + 1, GENANN_PP_BACKWARD, pp->comm, MPI_STATUS_IGNORE);
+                if (rc != MPI_SUCCESS) break;
+            }
+
+            t = MPI_Wtime();
+            if (last) {
+                double const *target = desired_outputs + (size_t)bwd * pp->micro * n_out;
+                for (j = 0; j < n_out * pp->micro; ++j) {
+                    d[j] = pp->activation_output == genann_act_linear ? target[j] - out[j]
+                         : (target[j] - out[j]) * out[j] * (1.0 - out[j]);
+                }
+            } else {
+                for (j = 0; j < n_out * pp->micro; ++j) d[j] = pp->recv[j] * out[j] * (1.0 - out[j]);
+            }
+            genann_pp_backward(pp, slot, back);
+            busy += MPI_Wtime() - t;
+
+            if (back) {
+                MPI_Isend(back, n_in * pp->micro, MPI_DOUBLE, pp->rank - 1, GENANN_PP_BACKWARD, pp->comm, &pp->sent[2 * slot + 1]);
+            }
+            ++bwd;
+        }
+    }
+
+    MPI_Waitall(2 * slots, pp->sent, MPI_STATUSES_IGNORE);
+
+    t = MPI_Wtime();
+    genann_simd.axpy(pp->weight, learning_rate, pp->grad, pp->total_weights);
+    busy += MPI_Wtime() - t;
+
+    if (stats) {
+        stats->busy += busy;
+        stats->total += MPI_Wtime() - t_start;
+    }
+    return rc;
+}
@@ -0,0 +1,87 @@
+/*
+ * GENANN_PP - one network split across MPI ranks by layer
+ *
+ * Each rank owns a contiguous range of layers, and so a contiguous slice
+ * of the genann weight layout. A training step's batch is cut into
+ * micro-batches that flow down the ranks going forward and back up going
+ * backward. Ranks run a one-forward-one-backward schedule: after enough
+ * forwards to fill the pipe, each rank alternates between the next
+ * micro-batch's forward and the oldest one's backward, which keeps at most
+ * as many micro-batches in flight as there are ranks.
+ *
+ * Gradients are summed over all micro-batches and applied once at the end
+ * of the step, so a step makes the same update as genann_backprop over the
+ * whole batch followed by genann_apply.
+ *
+ * The pipe still has to fill and drain each step. With P ranks and M
+ * micro-batches the idle fraction is about (P-1)/(M+P-1);
+ * genann_pp_stats measures it.
+ */
+
+#ifndef __GENANN_PP_H__
+#define __GENANN_PP_H__
+
+#include <mpi.h>
+
+#include "genann.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct genann_pp_stats {
+    double busy;                /* seconds computing */
+    double total;               /* seconds in genann_pp_train */
+} genann_pp_stats;
+
+typedef struct genann_pp {
+    /* Shape of the whole network, as in genann. */
+    int inputs, hidden_layers, hidden, outputs;
+    genann_actfun activation_hidden, activation_output;
+
+    MPI_Comm comm;
+    int rank, ranks;
+
+    /* First layer of every rank, ranks + 1 entries; this rank's layers are
+     * [layer_first[rank], layer_first[rank + 1]). */
+    int *layer_first;
+
+    /* This rank's slice of the weights, starting at weight first_weight of
+     * the whole network, and its summed gradient. */
+    int first_weight, total_weights;
+    double *weight, *grad;
+
+    /* Samples per micro-batch, and per-micro-batch scratch for as many
+     * micro-batches as there are ranks. */
+    int micro;
+    int act_size, delta_size;
+    double *act;                /* input and every layer's output */
+    double *delta;              /* every layer's deltas */
+    double *back;               /* sent up to the previous rank */
+    double *recv;               /* received from the next rank */
+    MPI_Request *sent;          /* forward and backward sends per slot */
+} genann_pp;
+
+/* Takes this rank's layers from ann, which every rank must hold, for
+ * micro-batches of micro samples. Layers are divided so the ranks get about
+ * the same number of weights, at least one layer each. Collective; returns
+ * 0 if there are more ranks than layers, ann is not genann_is_uniform, or
+ * allocation fails. */
+genann_pp *genann_pp_init(genann const *ann, int micro, MPI_Comm comm);
+
+/* Collects the whole network into a new genann on rank 0; other ranks get 0.
+ * Collective. */
+genann *genann_pp_gather(genann_pp const *pp);
+
+void genann_pp_free(genann_pp *pp);
+
+/* One training step on micro_batches * micro samples. Only the first rank
+ * reads inputs and only the last reads desired_outputs; the others may
+ * pass 0. stats may be 0. Collective; returns 0 or an MPI error code. */
+int genann_pp_train(genann_pp *pp, double const *inputs, double const *desired_outputs, int micro_batches, double learning_rate, genann_pp_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GENANN_PP_H__*/
@@ -0,0 +1,433 @@
+/*
+ * GENANN_SERVE - in-process inference server with dynamic batching
+ * See genann_serve.h.
+ */
+
+#define _GNU_SOURCE
+#include "genann_serve.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Latency histogram: 1 ns buckets below 64 ns, then 32 buckets per octave up
+ * to 2^64 ns. */
+#define GENANN_SERVE_OCTAVE 32
+#define GENANN_SERVE_BUCKETS (64 + 58 * GENANN_SERVE_OCTAVE)
+
+/* Polls before a waiting thread starts yielding, and how long a worker
+ * yields on an empty queue before it starts napping. */
+#define GENANN_SERVE_SPINS 64
+#define GENANN_SERVE_IDLE_NS 1000000LL
+#define GENANN_SERVE_NAP_NS 50000L
+
+/* A queue slot. It holds a request written at position pos when seq is
+ * pos + 1, and is free for position pos when seq is pos. */
+typedef struct genann_serve_cell {
+    size_t seq;
+    genann_request *req;
+} genann_serve_cell;
+
+typedef struct genann_serve_worker {
+    genann_serve *srv;
+    pthread_t thread;
+    int cpu;                            /* -1 when not pinned */
+    int ready;                          /* 1 once set up, -1 if that failed */
+
+    /* Batch scratch, set up by the worker itself so a pinned worker's
+     * pages are on its own node. */
+    genann_arena arena;
+    genann_ctx *ctx;
+    genann_request **batch;
+    double *input, *output;
+
+    /* Written only by the worker, read by genann_serve_get_stats. */
+    unsigned long long requests, batches, max_ns;
+    unsigned long long hist[GENANN_SERVE_BUCKETS];
+} genann_serve_worker;
+
+struct genann_serve {
+    genann const *ann;
+    genann_serve_config config;
+    long long start;
+
+    genann_serve_cell *cell;
+    size_t mask;
+
+    /* Next position to write and to read, each on its own cache line. */
+    size_t head __attribute__((aligned(64)));
+    size_t tail __attribute__((aligned(64)));
+
+    /* stop refuses new requests; closed is set once no submit is still in
+     * progress, after which an empty queue stays empty and workers exit. */
+    int stop __attribute__((aligned(64)));
+    int submitting, closed;
+
+    int workers;
+    genann_serve_worker **worker;
+};
+
+
+static long long genann_serve_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int genann_serve_bucket(unsigned long long ns) {
+    if (ns < 64) return (int)ns;
+    const int e = 63 - __builtin_clzll(ns);
+    return 64 + (e - 6) * GENANN_SERVE_OCTAVE + (int)((ns >> (e - 5)) & (GENANN_SERVE_OCTAVE - 1));
+}
+
+
+/* Middle of bucket b, in nanoseconds. */
+static double genann_serve_bucket_ns(int b) {
+    if (b < 64) return b;
+    const int e = (b - 64) / GENANN_SERVE_OCTAVE + 6, sub = (b - 64) % GENANN_SERVE_OCTAVE;
+    const double width = (double)(1ULL << (e - 5));
+    return (GENANN_SERVE_OCTAVE + sub) * width + width / 2;
+}
+
+
+/* Vyukov's bounded MPMC queue: a producer or consumer claims a position
+ * with a compare-and-swap on head or tail, then waits for nobody; the
+ * slot's sequence number says whether it is full or empty for that
+ * position. */
+static int genann_serve_push(genann_serve *srv, genann_request *req) {
+    size_t pos = __atomic_load_n(&srv->head, __ATOMIC_RELAXED);
+    genann_serve_cell *c;
+
+    for (;;) {
+        c = srv->cell + (pos & srv->mask);
+        const size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        const long diff = (long)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&srv->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if (diff < 0) {
+            return -1;                  /* full */
+        } else {
+            pos = __atomic_load_n(&srv->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    c->req = req;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+static genann_request *genann_serve_pop(genann_serve *srv) {
+    size_t pos = __atomic_load_n(&srv->tail, __ATOMIC_RELAXED);
+    genann_serve_cell *c;
+
+    for (;;) {
+        c = srv->cell + (pos & srv->mask);
+        const size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        const long diff = (long)(seq - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&srv->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if (diff < 0) {
+            return 0;                   /* empty */
+        } else {
+            pos = __atomic_load_n(&srv->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    genann_request *req = c->req;
+    __atomic_store_n(&c->seq, pos + srv->mask + 1, __ATOMIC_RELEASE);
+    return req;
+}
+
+
+/* The next request, waiting for one if need be; 0 once the server is closed
+ * and the queue empty. */
+static genann_request *genann_serve_pop_wait(genann_serve *srv) {
+    long long idle = 0;
+    int spins = 0;
+
+    for (;;) {
+        genann_request *req = genann_serve_pop(srv);
+        if (req) return req;
+        if (__atomic_load_n(&srv->closed, __ATOMIC_ACQUIRE)) return genann_serve_pop(srv);
+
+        if (++spins < GENANN_SERVE_SPINS) continue;
+        const long long t = genann_serve_now();
+        if (!idle) idle = t;
+        if (t - idle < GENANN_SERVE_IDLE_NS) {
+            sched_yield();
+        } else {
+            struct timespec nap = {0, GENANN_SERVE_NAP_NS};
+            nanosleep(&nap, 0);
+        }
+    }
+}
+
+
+static int genann_serve_setup(genann_serve_worker *w) {
+    genann const *ann = w->srv->ann;
+    const size_t n = w->srv->config.max_batch;
+    const size_t size = sizeof(genann_request *) * n + 63
+                      + sizeof(double) * n * (ann->inputs + ann->outputs) + 2 * 63
+                      + genann_run_batch_size(ann);
+
+    w->ctx = genann_ctx_init(ann);
+    if (!w->ctx || genann_arena_init(&w->arena, 0, size)) return -1;
+    w->batch = genann_arena_alloc(&w->arena, sizeof(genann_request *) * n);
+    w->input = genann_arena_alloc(&w->arena, sizeof(double) * n * ann->inputs);
+    w->output = genann_arena_alloc(&w->arena, sizeof(double) * n * ann->outputs);
+    return w->batch && w->input && w->output ? 0 : -1;
+}
+
+
+/* Runs a batch and hands the outputs back. */
+static void genann_serve_batch(genann_serve_worker *w, int n) {
+    genann const *ann = w->srv->ann;
+    int s;
+
+    if (n == 1) {
+        memcpy(w->batch[0]->output, genann_run_ctx(ann, w->ctx, w->batch[0]->input), sizeof(double) * ann->outputs);
+    } else {
+        for (s = 0; s < n; ++s) {
+            memcpy(w->input + (size_t)s * ann->inputs, w->batch[s]->input, sizeof(double) * ann->inputs);
+        }
+        genann_run_batch_arena(ann, w->input, n, w->output, &w->arena);
+        for (s = 0; s < n; ++s) {
+            memcpy(w->batch[s]->output, w->output + (size_t)s * ann->outputs, sizeof(double) * ann->outputs);
+        }
+    }
+
+    const long long t = genann_serve_now();
+    for (s = 0; s < n; ++s) {
+        genann_request *req = w->batch[s];
+        const unsigned long long ns = t > req->submitted ? (unsigned long long)(t - req->submitted) : 0;
+        const int b = genann_serve_bucket(ns);
+        __atomic_store_n(&w->hist[b], w->hist[b] + 1, __ATOMIC_RELAXED);
+        if (ns > w->max_ns) __atomic_store_n(&w->max_ns, ns, __ATOMIC_RELAXED);
+
+        /* The caller may reuse req as soon as finished is set. */
+        req->completed = t;
+        if (req->done) req->done(req);
+        __atomic_store_n(&req->finished, 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&w->requests, w->requests + n, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->batches, w->batches + 1, __ATOMIC_RELAXED);
+}
+
+
+static void *genann_serve_worker_main(void *arg) {
+    genann_serve_worker *w = arg;
+    genann_serve *srv = w->srv;
+    const int max_batch = srv->config.max_batch;
+    const long long max_wait = srv->config.max_wait_us * 1000LL;
+    genann_request *req;
+
+    const int ok = genann_serve_setup(w) == 0;
+    __atomic_store_n(&w->ready, ok ? 1 : -1, __ATOMIC_RELEASE);
+    if (!ok) return 0;
+
+    while ((req = genann_serve_pop_wait(srv)) != 0) {
+        /* Fill the batch until it is full or its oldest request has waited
+         * long enough. */
+        const long long deadline = req->submitted + max_wait;
+        int n = 1;
+        w->batch[0] = req;
+        while (n < max_batch) {
+            req = genann_serve_pop(srv);
+            if (req) {
+                w->batch[n++] = req;
+                continue;
+            }
+            if (genann_serve_now() >= deadline || __atomic_load_n(&srv->closed, __ATOMIC_ACQUIRE)) break;
+            sched_yield();
+        }
+        genann_serve_batch(w, n);
+    }
+    return 0;
+}
+
+
+/* Refuses new requests and lets the workers exit once the queue is empty. */
+static void genann_serve_close(genann_serve *srv) {
+    __atomic_store_n(&srv->stop, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&srv->submitting, __ATOMIC_SEQ_CST)) sched_yield();
+    __atomic_store_n(&srv->closed, 1, __ATOMIC_RELEASE);
+}
+
+
+static void genann_serve_free(genann_serve *srv) {
+    int i;
+    for (i = 0; i < srv->workers; ++i) {
+        genann_serve_worker *w = srv->worker[i];
+        if (!w) continue;
+        if (w->ctx) genann_ctx_free(w->ctx);
+        if (w->arena.base) genann_arena_free(&w->arena);
+        free(w);
+    }
+    free(srv->worker);
+    free(srv->cell);
+    free(srv);
+}
+
+
+genann_serve *genann_serve_start(genann const *ann, genann_serve_config const *config) {
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE], n_cpus = 0, c, i;
+    size_t slots = 1, s;
+
+    if (config->max_batch < 1 || config->max_wait_us < 0 || config->workers < 0 || config->queue_size < 0) return 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (c = 0; c < CPU_SETSIZE; ++c) {
+            if (CPU_ISSET(c, &allowed)) cpus[n_cpus++] = c;
+        }
+    }
+
+    genann_serve *srv = genann_heap_alloc(64, sizeof(genann_serve));
+    if (!srv) return 0;
+    memset(srv, 0, sizeof(*srv));
+    srv->ann = ann;
+    srv->config = *config;
+    srv->workers = config->workers ? config->workers : (n_cpus ? n_cpus : 1);
+
+    while (slots < (size_t)(config->queue_size ? config->queue_size : 4096)) slots *= 2;
+    srv->mask = slots - 1;
+    srv->cell = genann_heap_alloc(64, sizeof(genann_serve_cell) * slots);
+    srv->worker = genann_heap_alloc(0, sizeof(genann_serve_worker *) * srv->workers);
+    if (!srv->cell || !srv->worker) {
+        free(srv->cell);
+        free(srv->worker);
+        free(srv);
+        return 0;
+    }
+    for (s = 0; s < slots; ++s) srv->cell[s].seq = s;
+    memset(srv->worker, 0, sizeof(genann_serve_worker *) * srv->workers);
+    srv->start = genann_serve_now();
+
+    /* Workers set themselves up on their own CPU; wait for them all. */
+    int started = 0, failed = 0;
+    for (i = 0; i < srv->workers; ++i) {
+        genann_serve_worker *w = genann_heap_alloc(64, sizeof(genann_serve_worker));
+        pthread_attr_t attr;
+        if (!w) {
+            failed = 1;
+            break;
+        }
+        memset(w, 0, sizeof(*w));
+        w->srv = srv;
+        w->cpu = config->pin && n_cpus ? cpus[i % n_cpus] : -1;
+        srv->worker[i] = w;
+
+        pthread_attr_init(&attr);
+        if (w->cpu >= 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(w->cpu, &one);
+            pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+        }
+        const int rc = pthread_create(&w->thread, &attr, genann_serve_worker_main, w);
+        pthread_attr_destroy(&attr);
+        if (rc != 0) {
+            failed = 1;
+            break;
+        }
+        ++started;
+    }
+    for (i = 0; i < started; ++i) {
+        int ready;
+        while ((ready = __atomic_load_n(&srv->worker[i]->ready, __ATOMIC_ACQUIRE)) == 0) sched_yield();
+        if (ready < 0) failed = 1;
+    }
+
+    if (failed) {
+        genann_serve_close(srv);
+        for (i = 0; i < started; ++i) pthread_join(srv->worker[i]->thread, 0);
+        genann_serve_free(srv);
+        return 0;
+    }
+    return srv;
+}
+
+
+int genann_serve_submit(genann_serve *srv, genann_request *req) {
+    int rc = -1;
+    __atomic_fetch_add(&srv->submitting, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&srv->stop, __ATOMIC_SEQ_CST)) {
+        req->finished = 0;
+        req->submitted = genann_serve_now();
+        rc = genann_serve_push(srv, req);
+    }
+    __atomic_fetch_sub(&srv->submitting, 1, __ATOMIC_SEQ_CST);
+    return rc;
+}
+
+
+int genann_serve_done(genann_request const *req) {
+    return __atomic_load_n(&req->finished, __ATOMIC_ACQUIRE);
+}
+
+
+void genann_serve_wait(genann_request const *req) {
+    int spins = 0;
+    while (!genann_serve_done(req)) {
+        if (++spins >= GENANN_SERVE_SPINS) sched_yield();
+    }
+}
+
+
+int genann_serve_run(genann_serve *srv, double const *input, double *output) {
+    genann_request req;
+    memset(&req, 0, sizeof(req));
+    req.input = input;
+    req.output = output;
+
+    while (genann_serve_submit(srv, &req)) {
+        if (__atomic_load_n(&srv->stop, __ATOMIC_ACQUIRE)) return -1;
+        sched_yield();
+    }
+    genann_serve_wait(&req);
+    return 0;
+}
+
+
+void genann_serve_get_stats(genann_serve const *srv, genann_serve_stats *stats) {
+    unsigned long long total = 0, below = 0, max_ns = 0;
+    int i, b;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->seconds = (genann_serve_now() - srv->start) * 1e-9;
+
+    /* Percentiles from the workers' histograms summed bucket by bucket. */
+    double p50 = 0, p99 = 0;
+    for (i = 0; i < srv->workers; ++i) {
+        genann_serve_worker const *w = srv->worker[i];
+        stats->requests += __atomic_load_n(&w->requests, __ATOMIC_RELAXED);
+        stats->batches += __atomic_load_n(&w->batches, __ATOMIC_RELAXED);
+        const unsigned long long m = __atomic_load_n(&w->max_ns, __ATOMIC_RELAXED);
+        if (m > max_ns) max_ns = m;
+        for (b = 0; b < GENANN_SERVE_BUCKETS; ++b) total += __atomic_load_n(&w->hist[b], __ATOMIC_RELAXED);
+    }
+    for (b = 0; b < GENANN_SERVE_BUCKETS && total; ++b) {
+        const unsigned long long before = below;
+        for (i = 0; i < srv->workers; ++i) below += __atomic_load_n(&srv->worker[i]->hist[b], __ATOMIC_RELAXED);
+        if (before < (total + 1) / 2 && below >= (total + 1) / 2) p50 = genann_serve_bucket_ns(b);
+        if (before < total - total / 100 && below >= total - total / 100) p99 = genann_serve_bucket_ns(b);
+    }
+
+    stats->requests_per_second = stats->seconds > 0 ? stats->requests / stats->seconds : 0;
+    stats->mean_batch = stats->batches ? (double)stats->requests / stats->batches : 0;
+    stats->p50_us = p50 * 1e-3;
+    stats->p99_us = p99 * 1e-3;
+    stats->max_us = max_ns * 1e-3;
+}
+
+
+void genann_serve_stop(genann_serve *srv) {
+    int i;
+    genann_serve_close(srv);
+    for (i = 0; i < srv->workers; ++i) pthread_join(srv->worker[i]->thread, 0);
+    genann_serve_free(srv);
+}
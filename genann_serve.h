@@ -0,0 +1,106 @@
+/*
+ * GENANN_SERVE - in-process inference server with dynamic batching
+ *
+ * Requests from any number of threads go into one bounded lock-free queue
+ * (many producers, many consumers). A pool of worker threads, optionally
+ * pinned one per CPU, takes them out. A worker that has taken a request
+ * keeps taking more until it has max_batch of them or the oldest has
+ * waited max_wait_us since it was submitted, then runs the whole batch as
+ * one genann_run_batch (a lone request goes through genann_run_ctx) and
+ * writes each request's outputs back. Under load the queue is never empty
+ * and batches fill up at once; when it is quiet, a request waits at most
+ * max_wait_us for company.
+ *
+ *     genann_serve_config config = {0, 32, 200, 0, 1};
+ *     genann_serve *srv = genann_serve_start(ann, &config);
+ *     genann_serve_run(srv, input, output);          (from any thread)
+ *     genann_serve_stop(srv);
+ *
+ * Workers only read ann, so it must not be trained while the server runs.
+ * Nothing is allocated per request: every worker has its batch buffers and
+ * scratch in an arena set up at start.
+ *
+ * Waiting is by polling: a worker with nothing to do spins, then yields,
+ * and after a millisecond with an empty queue sleeps in 50 us naps, so an
+ * idle server costs little CPU and the first request after a pause can
+ * wait up to one nap longer.
+ */
+
+#ifndef __GENANN_SERVE_H__
+#define __GENANN_SERVE_H__
+
+#include "genann.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct genann_serve_config {
+    int workers;                /* worker threads; 0 for one per CPU the caller may run on */
+    int max_batch;              /* most requests a worker runs at once */
+    int max_wait_us;            /* longest the oldest request of a partial batch waits for more */
+    int queue_size;             /* request slots, rounded up to a power of two; 0 for 4096 */
+    int pin;                    /* nonzero to pin worker i to the i-th of the caller's CPUs */
+} genann_serve_config;
+
+/* One inference. The caller owns it and keeps it, with its input and output,
+ * alive until it has finished. */
+typedef struct genann_request {
+    double const *input;        /* ann->inputs doubles */
+    double *output;             /* ann->outputs doubles, written by the worker */
+
+    /* Called by the worker once output is written, just before finished
+     * is set, or 0. */
+    void (*done)(struct genann_request *req);
+    void *user;
+
+    /* Set by the server: submit and finish times in nanoseconds
+     * (CLOCK_MONOTONIC), and finished, which goes to 1 after output and
+     * completed are written. */
+    long long submitted, completed;
+    int finished;
+} genann_request;
+
+typedef struct genann_serve_stats {
+    unsigned long long requests;        /* finished since start */
+    unsigned long long batches;         /* batches run since start */
+    double seconds;                     /* since start */
+    double requests_per_second;
+    double mean_batch;
+    /* Submit to finish, from a histogram with buckets 1/32 of an octave
+     * wide above 64 ns, so within about 3%. */
+    double p50_us, p99_us, max_us;
+} genann_serve_stats;
+
+typedef struct genann_serve genann_serve;
+
+/* Starts the workers. Returns 0 if config is invalid or on allocation or
+ * thread creation failure. */
+genann_serve *genann_serve_start(genann const *ann, genann_serve_config const *config);
+
+/* Queues req. Returns 0, or -1 if the queue is full or the server is
+ * stopping. Safe from any number of threads. */
+int genann_serve_submit(genann_serve *srv, genann_request *req);
+
+/* 1 once req has finished. genann_serve_wait polls until it has. */
+int genann_serve_done(genann_request const *req);
+void genann_serve_wait(genann_request const *req);
+
+/* Submits one inference, retrying while the queue is full, and waits for
+ * it. Returns 0, or -1 if the server is stopping. */
+int genann_serve_run(genann_serve *srv, double const *input, double *output);
+
+/* Counters and latency percentiles since start. May be called while
+ * requests are running; the figures are then only as recent as the last
+ * finished batch of each worker. */
+void genann_serve_get_stats(genann_serve const *srv, genann_serve_stats *stats);
+
+/* Runs what is queued, stops the workers and frees the server. Requests
+ * submitted after the call starts are refused. */
+void genann_serve_stop(genann_serve *srv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GENANN_SERVE_H__*/
@@ -0,0 +1,492 @@
+/*
+ * SSE2/AVX2/AVX-512 dot product, axpy and sigmoid kernels for genann, and
+ * float dot and axpy for genannf, with a scalar fallback and runtime
+ * selection. See genann_simd.h.
+ *
+ * Each kernel is compiled for its own instruction set with a target
+ * attribute, so the file builds without -m flags and one binary runs on
+ * any x86-64 machine (or anywhere else, with the scalar kernels).
+ */
+
+#include "genann.h"
+#include "genann_simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GENANN_X86 1
+#include <immintrin.h>
+#endif
+
+
+static double dot_scalar(double const *a, double const *b, int n) {
+    double sum = 0;
+    int k;
+    for (k = 0; k < n; ++k) sum += a[k] * b[k];
+    return sum;
+}
+
+
+static void dot4_scalar(double const *w, double const *x, int ldx, int n, double *sum) {
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int k;
+    for (k = 0; k < n; ++k) {
+        s0 += w[k] * x[k];
+        s1 += w[k] * x[ldx + k];
+        s2 += w[k] * x[2*ldx + k];
+        s3 += w[k] * x[3*ldx + k];
+    }
+    sum[0] = s0; sum[1] = s1; sum[2] = s2; sum[3] = s3;
+}
+
+
+static void axpy_scalar(double *y, double a, double const *x, int n) {
+    int k;
+    for (k = 0; k < n; ++k) y[k] += a * x[k];
+}
+
+
+static void sigmoid_scalar(double const *in, double *out, int n) {
+    int k;
+    for (k = 0; k < n; ++k) out[k] = genann_sigmoid_fast(in[k]);
+}
+
+
+static float sdot_scalar(float const *a, float const *b, int n) {
+    float sum = 0;
+    int k;
+    for (k = 0; k < n; ++k) sum += a[k] * b[k];
+    return sum;
+}
+
+
+static void saxpy_scalar(float *y, float a, float const *x, int n) {
+    int k;
+    for (k = 0; k < n; ++k) y[k] += a * x[k];
+}
+
+
+#ifdef GENANN_X86
+
+__attribute__((target("sse2")))
+static double dot_sse2(double const *a, double const *b, int n) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + k), _mm_loadu_pd(b + k)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + k + 2), _mm_loadu_pd(b + k + 2)));
+    }
+    s0 = _mm_add_pd(s0, s1);
+    double sum = _mm_cvtsd_f64(_mm_add_sd(s0, _mm_unpackhi_pd(s0, s0)));
+    for (; k < n; ++k) sum += a[k] * b[k];
+    return sum;
+}
+
+
+__attribute__((target("sse2")))
+static void dot4_sse2(double const *w, double const *x, int ldx, int n, double *sum) {
+    double const *x0 = x, *x1 = x + ldx, *x2 = x + 2*ldx, *x3 = x + 3*ldx;
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    __m128d s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+    int k = 0;
+    for (; k + 2 <= n; k += 2) {
+        const __m128d wk = _mm_loadu_pd(w + k);
+        s0 = _mm_add_pd(s0, _mm_mul_pd(wk, _mm_loadu_pd(x0 + k)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(wk, _mm_loadu_pd(x1 + k)));
+        s2 = _mm_add_pd(s2, _mm_mul_pd(wk, _mm_loadu_pd(x2 + k)));
+        s3 = _mm_add_pd(s3, _mm_mul_pd(wk, _mm_loadu_pd(x3 + k)));
+    }
+    sum[0] = _mm_cvtsd_f64(_mm_add_sd(s0, _mm_unpackhi_pd(s0, s0)));
+    sum[1] = _mm_cvtsd_f64(_mm_add_sd(s1, _mm_unpackhi_pd(s1, s1)));
+    sum[2] = _mm_cvtsd_f64(_mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)));
+    sum[3] = _mm_cvtsd_f64(_mm_add_sd(s3, _mm_unpackhi_pd(s3, s3)));
+    for (; k < n; ++k) {
+        sum[0] += w[k] * x0[k];
+        sum[1] += w[k] * x1[k];
+        sum[2] += w[k] * x2[k];
+        sum[3] += w[k] * x3[k];
+    }
+}
+
+
+__attribute__((target("sse2")))
+static void axpy_sse2(double *y, double a, double const *x, int n) {
+    const __m128d va = _mm_set1_pd(a);
+    int k = 0;
+    for (; k + 2 <= n; k += 2) {
+        _mm_storeu_pd(y + k, _mm_add_pd(_mm_loadu_pd(y + k), _mm_mul_pd(va, _mm_loadu_pd(x + k))));
+    }
+    for (; k < n; ++k) y[k] += a * x[k];
+}
+
+
+__attribute__((target("sse2")))
+static void sigmoid_sse2(double const *in, double *out, int n) {
+    const __m128d half = _mm_set1_pd(0.5), lo = _mm_set1_pd(-GENANN_SIGMOID_CLAMP), hi = _mm_set1_pd(GENANN_SIGMOID_CLAMP);
+    const __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1.0);
+    int k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128d t = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(in + k), half), lo), hi);
+        __m128d t2 = _mm_mul_pd(t, t);
+        __m128d p = _mm_add_pd(_mm_set1_pd(GENANN_SIGMOID_P2), t2);
+        p = _mm_add_pd(_mm_set1_pd(GENANN_SIGMOID_P1), _mm_mul_pd(t2, p));
+        p = _mm_mul_pd(t, _mm_add_pd(_mm_set1_pd(GENANN_SIGMOID_P0), _mm_mul_pd(t2, p)));
+        __m128d q = _mm_add_pd(_mm_set1_pd(GENANN_SIGMOID_Q2), _mm_mul_pd(t2, _mm_set1_pd(GENANN_SIGMOID_Q3)));
+        q = _mm_add_pd(_mm_set1_pd(GENANN_SIGMOID_Q1), _mm_mul_pd(t2, q));
+        q = _mm_add_pd(_mm_set1_pd(GENANN_SIGMOID_P0), _mm_mul_pd(t2, q));
+        __m128d s = _mm_add_pd(half, _mm_mul_pd(half, _mm_div_pd(p, q)));
+        _mm_storeu_pd(out + k, _mm_min_pd(_mm_max_pd(s, zero), one));
+    }
+    for (; k < n; ++k) out[k] = genann_sigmoid_fast(in[k]);
+}
+
+
+__attribute__((target("sse2")))
+static float sdot_sse2(float const *a, float const *b, int n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + k + 4), _mm_loadu_ps(b + k + 4)));
+    }
+    s0 = _mm_add_ps(s0, s1);
+    s0 = _mm_add_ps(s0, _mm_movehl_ps(s0, s0));
+    float sum = _mm_cvtss_f32(_mm_add_ss(s0, _mm_shuffle_ps(s0, s0, 1)));
+    for (; k < n; ++k) sum += a[k] * b[k];
+    return sum;
+}
+
+
+__attribute__((target("sse2")))
+static void saxpy_sse2(float *y, float a, float const *x, int n) {
+    const __m128 va = _mm_set1_ps(a);
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        _mm_storeu_ps(y + k, _mm_add_ps(_mm_loadu_ps(y + k), _mm_mul_ps(va, _mm_loadu_ps(x + k))));
+    }
+    for (; k < n; ++k) y[k] += a * x[k];
+}
+
+
+__attribute__((target("avx2,fma")))
+static double dot_avx2(double const *a, double const *b, int n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+    int k = 0;
+    /* Four independent accumulators hide the FMA latency. */
+    for (; k + 16 <= n; k += 16) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k), _mm256_loadu_pd(b + k), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k + 4), _mm256_loadu_pd(b + k + 4), s1);
+        s2 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k + 8), _mm256_loadu_pd(b + k + 8), s2);
+        s3 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k + 12), _mm256_loadu_pd(b + k + 12), s3);
+    }
+    for (; k + 4 <= n; k += 4) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + k), _mm256_loadu_pd(b + k), s0);
+    }
+    s0 = _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3));
+    __m128d h = _mm_add_pd(_mm256_castpd256_pd128(s0), _mm256_extractf128_pd(s0, 1));
+    double sum = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+    for (; k < n; ++k) sum += a[k] * b[k];
+    return sum;
+}
+
+
+__attribute__((target("avx2,fma")))
+static double hsum_avx2(__m256d v) {
+    __m128d h = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+
+__attribute__((target("avx2,fma")))
+static void dot4_avx2(double const *w, double const *x, int ldx, int n, double *sum) {
+    double const *x0 = x, *x1 = x + ldx, *x2 = x + 2*ldx, *x3 = x + 3*ldx;
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+    __m256d t0 = _mm256_setzero_pd(), t1 = _mm256_setzero_pd();
+    __m256d t2 = _mm256_setzero_pd(), t3 = _mm256_setzero_pd();
+    int k = 0;
+    /* Eight accumulators, two per sample, hide the FMA latency. */
+    for (; k + 8 <= n; k += 8) {
+        const __m256d wa = _mm256_loadu_pd(w + k), wb = _mm256_loadu_pd(w + k + 4);
+        s0 = _mm256_fmadd_pd(wa, _mm256_loadu_pd(x0 + k), s0);
+        s1 = _mm256_fmadd_pd(wa, _mm256_loadu_pd(x1 + k), s1);
+        s2 = _mm256_fmadd_pd(wa, _mm256_loadu_pd(x2 + k), s2);
+        s3 = _mm256_fmadd_pd(wa, _mm256_loadu_pd(x3 + k), s3);
+        t0 = _mm256_fmadd_pd(wb, _mm256_loadu_pd(x0 + k + 4), t0);
+        t1 = _mm256_fmadd_pd(wb, _mm256_loadu_pd(x1 + k + 4), t1);
+        t2 = _mm256_fmadd_pd(wb, _mm256_loadu_pd(x2 + k + 4), t2);
+        t3 = _mm256_fmadd_pd(wb, _mm256_loadu_pd(x3 + k + 4), t3);
+    }
+    for (; k + 4 <= n; k += 4) {
+        const __m256d wa = _mm256_loadu_pd(w + k);
+        s0 = _mm256_fmadd_pd(wa, _mm256_loadu_pd(x0 + k), s0);
+        s1 = _mm256_fmadd_pd(wa, _mm256_loadu_pd(x1 + k), s1);
+        s2 = _mm256_fmadd_pd(wa, _mm256_loadu_pd(x2 + k), s2);
+        s3 = _mm256_fmadd_pd(wa, _mm256_loadu_pd(x3 + k), s3);
+    }
+    sum[0] = hsum_avx2(_mm256_add_pd(s0, t0));
+    sum[1] = hsum_avx2(_mm256_add_pd(s1, t1));
+    sum[2] = hsum_avx2(_mm256_add_pd(s2, t2));
+    sum[3] = hsum_avx2(_mm256_add_pd(s3, t3));
+    for (; k < n; ++k) {
+        sum[0] += w[k] * x0[k];
+        sum[1] += w[k] * x1[k];
+        sum[2] += w[k] * x2[k];
+        sum[3] += w[k] * x3[k];
+    }
+}
+
+
+__attribute__((target("avx2,fma")))
+static void axpy_avx2(double *y, double a, double const *x, int n) {
+    const __m256d va = _mm256_set1_pd(a);
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        _mm256_storeu_pd(y + k, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + k), _mm256_loadu_pd(y + k)));
+        _mm256_storeu_pd(y + k + 4, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + k + 4), _mm256_loadu_pd(y + k + 4)));
+    }
+    for (; k + 4 <= n; k += 4) {
+        _mm256_storeu_pd(y + k, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + k), _mm256_loadu_pd(y + k)));
+    }
+    for (; k < n; ++k) y[k] += a * x[k];
+}
+
+
+__attribute__((target("avx2,fma")))
+static void sigmoid_avx2(double const *in, double *out, int n) {
+    const __m256d half = _mm256_set1_pd(0.5), lo = _mm256_set1_pd(-GENANN_SIGMOID_CLAMP), hi = _mm256_set1_pd(GENANN_SIGMOID_CLAMP);
+    const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d t = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(_mm256_loadu_pd(in + k), half), lo), hi);
+        __m256d t2 = _mm256_mul_pd(t, t);
+        __m256d p = _mm256_add_pd(_mm256_set1_pd(GENANN_SIGMOID_P2), t2);
+        p = _mm256_fmadd_pd(t2, p, _mm256_set1_pd(GENANN_SIGMOID_P1));
+        p = _mm256_mul_pd(t, _mm256_fmadd_pd(t2, p, _mm256_set1_pd(GENANN_SIGMOID_P0)));
+        __m256d q = _mm256_fmadd_pd(t2, _mm256_set1_pd(GENANN_SIGMOID_Q3), _mm256_set1_pd(GENANN_SIGMOID_Q2));
+        q = _mm256_fmadd_pd(t2, q, _mm256_set1_pd(GENANN_SIGMOID_Q1));
+        q = _mm256_fmadd_pd(t2, q, _mm256_set1_pd(GENANN_SIGMOID_P0));
+        __m256d s = _mm256_fmadd_pd(half, _mm256_div_pd(p, q), half);
+        _mm256_storeu_pd(out + k, _mm256_min_pd(_mm256_max_pd(s, zero), one));
+    }
+    for (; k < n; ++k) out[k] = genann_sigmoid_fast(in[k]);
+}
+
+
+__attribute__((target("avx2,fma")))
+static float sdot_avx2(float const *a, float const *b, int n) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    int k = 0;
+    for (; k + 32 <= n; k += 32) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + k), _mm256_loadu_ps(b + k), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + k + 8), _mm256_loadu_ps(b + k + 8), s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + k + 16), _mm256_loadu_ps(b + k + 16), s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + k + 24), _mm256_loadu_ps(b + k + 24), s3);
+    }
+    for (; k + 8 <= n; k += 8) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + k), _mm256_loadu_ps(b + k), s0);
+    }
+    s0 = _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    float sum = _mm_cvtss_f32(_mm_add_ss(h, _mm_shuffle_ps(h, h, 1)));
+    for (; k < n; ++k) sum += a[k] * b[k];
+    return sum;
+}
+
+
+__attribute__((target("avx2,fma")))
+static void saxpy_avx2(float *y, float a, float const *x, int n) {
+    const __m256 va = _mm256_set1_ps(a);
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        _mm256_storeu_ps(y + k, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + k), _mm256_loadu_ps(y + k)));
+    }
+    for (; k < n; ++k) y[k] += a * x[k];
+}
+
+
+__attribute__((target("avx512f")))
+static double dot_avx512(double const *a, double const *b, int n) {
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+    __m512d s2 = _mm512_setzero_pd(), s3 = _mm512_setzero_pd();
+    int k = 0;
+    for (; k + 32 <= n; k += 32) {
+        s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + k), _mm512_loadu_pd(b + k), s0);
+        s1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + k + 8), _mm512_loadu_pd(b + k + 8), s1);
+        s2 = _mm512_fmadd_pd(_mm512_loadu_pd(a + k + 16), _mm512_loadu_pd(b + k + 16), s2);
+        s3 = _mm512_fmadd_pd(_mm512_loadu_pd(a + k + 24), _mm512_loadu_pd(b + k + 24), s3);
+    }
+    for (; k + 8 <= n; k += 8) {
+        s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + k), _mm512_loadu_pd(b + k), s0);
+    }
+    /* Masked tail instead of a scalar loop. */
+    if (k < n) {
+        const __mmask8 m = (__mmask8)((1u << (n - k)) - 1);
+        s1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, a + k), _mm512_maskz_loadu_pd(m, b + k), s1);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(s0, s1), _mm512_add_pd(s2, s3)));
+}
+
+
+__attribute__((target("avx512f")))
+static void dot4_avx512(double const *w, double const *x, int ldx, int n, double *sum) {
+    double const *x0 = x, *x1 = x + ldx, *x2 = x + 2*ldx, *x3 = x + 3*ldx;
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+    __m512d s2 = _mm512_setzero_pd(), s3 = _mm512_setzero_pd();
+    __m512d t0 = _mm512_setzero_pd(), t1 = _mm512_setzero_pd();
+    __m512d t2 = _mm512_setzero_pd(), t3 = _mm512_setzero_pd();
+    int k = 0;
+    for (; k + 16 <= n; k += 16) {
+        const __m512d wa = _mm512_loadu_pd(w + k), wb = _mm512_loadu_pd(w + k + 8);
+        s0 = _mm512_fmadd_pd(wa, _mm512_loadu_pd(x0 + k), s0);
+        s1 = _mm512_fmadd_pd(wa, _mm512_loadu_pd(x1 + k), s1);
+        s2 = _mm512_fmadd_pd(wa, _mm512_loadu_pd(x2 + k), s2);
+        s3 = _mm512_fmadd_pd(wa, _mm512_loadu_pd(x3 + k), s3);
+        t0 = _mm512_fmadd_pd(wb, _mm512_loadu_pd(x0 + k + 8), t0);
+        t1 = _mm512_fmadd_pd(wb, _mm512_loadu_pd(x1 + k + 8), t1);
+        t2 = _mm512_fmadd_pd(wb, _mm512_loadu_pd(x2 + k + 8), t2);
+        t3 = _mm512_fmadd_pd(wb, _mm512_loadu_pd(x3 + k + 8), t3);
+    }
+    /* Masked tail, up to two partial vectors. */
+    for (; k < n; k += 8) {
+        const __mmask8 m = n - k >= 8 ? 0xff : (__mmask8)((1u << (n - k)) - 1);
+        const __m512d wa = _mm512_maskz_loadu_pd(m, w + k);
+        s0 = _mm512_fmadd_pd(wa, _mm512_maskz_loadu_pd(m, x0 + k), s0);
+        s1 = _mm512_fmadd_pd(wa, _mm512_maskz_loadu_pd(m, x1 + k), s1);
+        s2 = _mm512_fmadd_pd(wa, _mm512_maskz_loadu_pd(m, x2 + k), s2);
+        s3 = _mm512_fmadd_pd(wa, _mm512_maskz_loadu_pd(m, x3 + k), s3);
+    }
+    sum[0] = _mm512_reduce_add_pd(_mm512_add_pd(s0, t0));
+    sum[1] = _mm512_reduce_add_pd(_mm512_add_pd(s1, t1));
+    sum[2] = _mm512_reduce_add_pd(_mm512_add_pd(s2, t2));
+    sum[3] = _mm512_reduce_add_pd(_mm512_add_pd(s3, t3));
+}
+
+
+__attribute__((target("avx512f")))
+static void axpy_avx512(double *y, double a, double const *x, int n) {
+    const __m512d va = _mm512_set1_pd(a);
+    int k = 0;
+    for (; k + 16 <= n; k += 16) {
+        _mm512_storeu_pd(y + k, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + k), _mm512_loadu_pd(y + k)));
+        _mm512_storeu_pd(y + k + 8, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + k + 8), _mm512_loadu_pd(y + k + 8)));
+    }
+    for (; k + 8 <= n; k += 8) {
+        _mm512_storeu_pd(y + k, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + k), _mm512_loadu_pd(y + k)));
+    }
+    if (k < n) {
+        const __mmask8 m = (__mmask8)((1u << (n - k)) - 1);
+        _mm512_mask_storeu_pd(y + k, m, _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(m, x + k), _mm512_maskz_loadu_pd(m, y + k)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void sigmoid_avx512(double const *in, double *out, int n) {
+    const __m512d half = _mm512_set1_pd(0.5), lo = _mm512_set1_pd(-GENANN_SIGMOID_CLAMP), hi = _mm512_set1_pd(GENANN_SIGMOID_CLAMP);
+    const __m512d zero = _mm512_setzero_pd(), one = _mm512_set1_pd(1.0);
+    int k;
+    for (k = 0; k < n; k += 8) {
+        const __mmask8 m = n - k >= 8 ? 0xFF : (__mmask8)((1u << (n - k)) - 1);
+        __m512d t = _mm512_min_pd(_mm512_max_pd(_mm512_mul_pd(_mm512_maskz_loadu_pd(m, in + k), half), lo), hi);
+        __m512d t2 = _mm512_mul_pd(t, t);
+        __m512d p = _mm512_add_pd(_mm512_set1_pd(GENANN_SIGMOID_P2), t2);
+        p = _mm512_fmadd_pd(t2, p, _mm512_set1_pd(GENANN_SIGMOID_P1));
+        p = _mm512_mul_pd(t, _mm512_fmadd_pd(t2, p, _mm512_set1_pd(GENANN_SIGMOID_P0)));
+        __m512d q = _mm512_fmadd_pd(t2, _mm512_set1_pd(GENANN_SIGMOID_Q3), _mm512_set1_pd(GENANN_SIGMOID_Q2));
+        q = _mm512_fmadd_pd(t2, q, _mm512_set1_pd(GENANN_SIGMOID_Q1));
+        q = _mm512_fmadd_pd(t2, q, _mm512_set1_pd(GENANN_SIGMOID_P0));
+        __m512d s = _mm512_fmadd_pd(half, _mm512_div_pd(p, q), half);
+        _mm512_mask_storeu_pd(out + k, m, _mm512_min_pd(_mm512_max_pd(s, zero), one));
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static float sdot_avx512(float const *a, float const *b, int n) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    int k = 0;
+    for (; k + 64 <= n; k += 64) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + k), _mm512_loadu_ps(b + k), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + k + 16), _mm512_loadu_ps(b + k + 16), s1);
+        s2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + k + 32), _mm512_loadu_ps(b + k + 32), s2);
+        s3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + k + 48), _mm512_loadu_ps(b + k + 48), s3);
+    }
+    for (; k + 16 <= n; k += 16) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + k), _mm512_loadu_ps(b + k), s0);
+    }
+    if (k < n) {
+        const __mmask16 m = (__mmask16)((1u << (n - k)) - 1);
+        s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + k), _mm512_maskz_loadu_ps(m, b + k), s1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+
+__attribute__((target("avx512f")))
+static void saxpy_avx512(float *y, float a, float const *x, int n) {
+    const __m512 va = _mm512_set1_ps(a);
+    int k = 0;
+    for (; k + 16 <= n; k += 16) {
+        _mm512_storeu_ps(y + k, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + k), _mm512_loadu_ps(y + k)));
+    }
+    if (k < n) {
+        const __mmask16 m = (__mmask16)((1u << (n - k)) - 1);
+        _mm512_mask_storeu_ps(y + k, m, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + k), _mm512_maskz_loadu_ps(m, y + k)));
+    }
+}
+
+#endif /* GENANN_X86 */
+
+
+static const genann_kernels kernels_scalar = {"scalar", dot_scalar, dot4_scalar, axpy_scalar, sigmoid_scalar, sdot_scalar, saxpy_scalar};
+#ifdef GENANN_X86
+static const genann_kernels kernels_sse2 = {"sse2", dot_sse2, dot4_sse2, axpy_sse2, sigmoid_sse2, sdot_sse2, saxpy_sse2};
+static const genann_kernels kernels_avx2 = {"avx2", dot_avx2, dot4_avx2, axpy_avx2, sigmoid_avx2, sdot_avx2, saxpy_avx2};
+static const genann_kernels kernels_avx512 = {"avx512", dot_avx512, dot4_avx512, axpy_avx512, sigmoid_avx512, sdot_avx512, saxpy_avx512};
+#endif
+
+genann_kernels genann_simd = {"scalar", dot_scalar, dot4_scalar, axpy_scalar, sigmoid_scalar, sdot_scalar, saxpy_scalar};
+
+
+void genann_simd_select(void) {
+    const char *want = getenv("GENANN_SIMD");
+    genann_kernels const *best = &kernels_scalar;
+
+#ifdef GENANN_X86
+    /* __builtin_cpu_supports reads CPUID and also checks that the OS saves
+     * the wider registers, so AVX is not picked where it would fault. */
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) best = &kernels_sse2;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) best = &kernels_avx2;
+    if (__builtin_cpu_supports("avx512f")) best = &kernels_avx512;
+
+    /* A requested set is only honoured if it is not wider than what we have. */
+    if (want) {
+        if (!strcmp(want, "scalar")) best = &kernels_scalar;
+        else if (!strcmp(want, "sse2") && best != &kernels_scalar) best = &kernels_sse2;
+        else if (!strcmp(want, "avx2") && best == &kernels_avx512) best = &kernels_avx2;
+    }
+#else
+    (void)want;
+#endif
+
+    genann_simd = *best;
+}
+
+
+#ifdef __GNUC__
+__attribute__((constructor))
+static void genann_simd_startup(void) {
+    genann_simd_select();
+}
+#endif
+
+
+const char *genann_simd_name(void) {
+    return genann_simd.name;
+}
@@ -0,0 +1,75 @@
+/*
+ * Vector kernels used by genann.c and genannf.c. Not part of the public API.
+ *
+ * One kernel set is picked when the program starts: the widest one the CPU
+ * (and OS) supports, checked with CPUID, or the one named in the GENANN_SIMD
+ * environment variable (scalar, sse2, avx2 or avx512).
+ */
+
+#ifndef __GENANN_SIMD_H__
+#define __GENANN_SIMD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct genann_kernels {
+    const char *name;
+
+    /* Returns sum of a[k] * b[k] for k < n. */
+    double (*dot)(double const *a, double const *b, int n);
+
+    /* sum[r] = sum of w[k] * x[r*ldx + k] for k < n, for the four rows
+     * r < 4 of x: four samples against one weight row, which is loaded once
+     * for all four. Used by the batched forward pass. */
+    void (*dot4)(double const *w, double const *x, int ldx, int n, double *sum);
+
+    /* y[k] += a * x[k] for k < n. Used for weight updates, gradient
+     * accumulation and the row-wise backprop of deltas. */
+    void (*axpy)(double *y, double a, double const *x, int n);
+
+    /* out[k] = genann_sigmoid_fast(in[k]) for k < n. in may equal out. */
+    void (*sigmoid)(double const *in, double *out, int n);
+
+    /* dot and axpy on floats, for genannf. */
+    float (*sdot)(float const *a, float const *b, int n);
+    void (*saxpy)(float *y, float a, float const *x, int n);
+} genann_kernels;
+
+extern genann_kernels genann_simd;
+
+
+/* Constants of genann_sigmoid_fast, shared with the vector kernels. */
+#define GENANN_SIGMOID_CLAMP 4.97
+#define GENANN_SIGMOID_P0 135135.0
+#define GENANN_SIGMOID_P1 17325.0
+#define GENANN_SIGMOID_P2 378.0
+#define GENANN_SIGMOID_Q1 62370.0
+#define GENANN_SIGMOID_Q2 3150.0
+#define GENANN_SIGMOID_Q3 28.0
+
+/* sigmoid(a) = 0.5 + 0.5 * tanh(a/2), with tanh from its [7/6] Pade
+ * approximant, clamped where the approximant stops rising. Max absolute
+ * error against genann_act_sigmoid is 4.8e-5 (near |a| = 9.9), against
+ * about 9e-4 for the 4096-entry table. Only min/max, no branches, no table. */
+static inline double genann_sigmoid_fast(double a) {
+    double t = a * 0.5;
+    t = t < -GENANN_SIGMOID_CLAMP ? -GENANN_SIGMOID_CLAMP : t;
+    t = t > GENANN_SIGMOID_CLAMP ? GENANN_SIGMOID_CLAMP : t;
+    const double t2 = t * t;
+    const double p = t * (GENANN_SIGMOID_P0 + t2 * (GENANN_SIGMOID_P1 + t2 * (GENANN_SIGMOID_P2 + t2)));
+    const double q = GENANN_SIGMOID_P0 + t2 * (GENANN_SIGMOID_Q1 + t2 * (GENANN_SIGMOID_Q2 + t2 * GENANN_SIGMOID_Q3));
+    double s = 0.5 + 0.5 * p / q;
+    s = s < 0 ? 0 : s;
+    s = s > 1 ? 1 : s;
+    return s;
+}
+
+/* (Re)selects genann_simd. Runs automatically at startup. */
+void genann_simd_select(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GENANN_SIMD_H__*/
@@ -0,0 +1,164 @@
+/*
+ * GENANN_STATIC - compile-time sized GENANN networks for C++
+ *
+ * genann_static<Inputs, Layers, Hidden, Outputs, Act> has the same weight
+ * layout as struct genann (one row per neuron, bias first, layer after layer)
+ * but every size is a template argument. The layer loops have constant trip
+ * counts, the narrow ones are unrolled, the activation is a direct call
+ * (inlined for the fast sigmoid) instead of one through a pointer, and run()
+ * keeps its scratch on the stack, so it is reentrant and does no allocation.
+ *
+ * Models move between the two with genann_write/genann_read files or with
+ * from_genann()/to_genann(). Header only, but link with genann.c and
+ * genann_simd.c for the activations and the dot kernel.
+ *
+ *     genann_static<28*28, 3, 10, 10> net;
+ *     FILE *f = fopen("model.txt", "r");
+ *     if (net.read(f)) net.run(pixels, scores);
+ */
+
+#ifndef __GENANN_STATIC_HPP__
+#define __GENANN_STATIC_HPP__
+
+#include <stdio.h>
+#include <string.h>
+
+#include "genann.h"
+#include "genann_simd.h"
+
+
+/* Activations, as types so they inline. Each must match the genann_actfun
+ * the model was trained with; function() is that genann_actfun. The
+ * default, genann_static_sigmoid_cached, is genann_init's default; its
+ * table lives in genann.c, so it is a call rather than inlined. */
+struct genann_static_sigmoid_cached {
+    static double apply(double a) { return genann_act_sigmoid_cached(a); }
+    static genann_actfun function() { return genann_act_sigmoid_cached; }
+};
+
+struct genann_static_sigmoid_fast {
+    static double apply(double a) { return genann_sigmoid_fast(a); }
+    static genann_actfun function() { return genann_act_sigmoid_fast; }
+};
+
+struct genann_static_sigmoid {
+    static double apply(double a) { return genann_act_sigmoid(a); }
+    static genann_actfun function() { return genann_act_sigmoid; }
+};
+
+struct genann_static_linear {
+    static double apply(double a) { return a; }
+    static genann_actfun function() { return genann_act_linear; }
+};
+
+
+template <int Inputs, int Layers, int Hidden, int Outputs, class Act = genann_static_sigmoid_cached, class ActOut = Act>
+struct genann_static {
+    static_assert(Inputs > 0 && Outputs > 0 && Layers >= 0, "bad topology");
+    static_assert(Layers == 0 || Hidden > 0, "hidden layers need neurons");
+
+    typedef Act activation_hidden;
+    typedef ActOut activation_output;
+
+    static constexpr int inputs = Inputs;
+    static constexpr int hidden_layers = Layers;
+    static constexpr int hidden = Hidden;
+    static constexpr int outputs = Outputs;
+
+    static constexpr int hidden_weights = Layers ? (Inputs + 1) * Hidden + (Layers - 1) * (Hidden + 1) * Hidden : 0;
+    static constexpr int total_weights = hidden_weights + (Layers ? Hidden + 1 : Inputs + 1) * Outputs;
+    static constexpr int widest = Hidden > Outputs ? Hidden : Outputs;
+
+    alignas(64) double weight[total_weights];
+
+
+    /* out = ActT(W * in - bias) for one layer; w points at its first row.
+     * Narrow rows are unrolled inline. Wide rows (the 784-input layer) use
+     * the CPUID-selected dot kernel, which beats anything compiled for the
+     * baseline ISA, at the cost of one call per neuron. */
+    template <int In, int Out, class ActT>
+    static void layer(double const *w, double const *in, double *out) {
+#pragma GCC unroll 16
+        for (int j = 0; j < Out; ++j) {
+            double const *row = w + j * (In + 1);
+            double sum;
+            if (In >= 32) {
+                sum = genann_simd.dot(row + 1, in, In);
+            } else {
+                sum = 0;
+#pragma GCC unroll 32
+                for (int k = 0; k < In; ++k) {
+                    sum += row[k + 1] * in[k];
+                }
+            }
+            out[j] = ActT::apply(sum - row[0]);
+        }
+    }
+
+
+    /* Runs the network. Reentrant: one instance can serve many threads. */
+    void run(double const *in, double *out) const {
+        if (Layers == 0) {
+            layer<Inputs, Outputs, ActOut>(weight, in, out);
+            return;
+        }
+
+        double a[widest], b[widest];
+        double const *w = weight;
+
+        layer<Inputs, Hidden, Act>(w, in, a);
+        w += (Inputs + 1) * Hidden;
+
+        for (int h = 1; h < Layers; ++h) {
+            layer<Hidden, Hidden, Act>(w, a, b);
+            memcpy(a, b, sizeof(double) * Hidden);
+            w += (Hidden + 1) * Hidden;
+        }
+
+        layer<Hidden, Outputs, ActOut>(w, a, out);
+    }
+
+
+    /* Reads a genann_write file. Returns false if the topology differs or the
+     * file is short. The file does not record activations: it must come from
+     * a network trained with Act and ActOut. */
+    bool read(FILE *in) {
+        int i, l, h, o;
+        if (fscanf(in, "%d %d %d %d", &i, &l, &h, &o) != 4) return false;
+        if (i != Inputs || l != Layers || o != Outputs || (Layers && h != Hidden)) return false;
+        for (int k = 0; k < total_weights; ++k) {
+            if (fscanf(in, " %le", weight + k) != 1) return false;
+        }
+        return true;
+    }
+
+    /* Writes the same format as genann_write. */
+    void write(FILE *out) const {
+        fprintf(out, "%d %d %d %d", Inputs, Layers, Hidden, Outputs);
+        for (int k = 0; k < total_weights; ++k) {
+            fprintf(out, " %.20e", weight[k]);
+        }
+    }
+
+    /* Copies the weights of a matching genann. Returns false if the topology
+     * or the activations differ from Act and ActOut. */
+    bool from_genann(genann const *ann) {
+        if (ann->inputs != Inputs || ann->hidden_layers != Layers || ann->outputs != Outputs) return false;
+        if ((Layers && ann->activation_hidden != Act::function()) || ann->activation_output != ActOut::function()) return false;
+        if ((Layers && ann->hidden != Hidden) || !genann_is_uniform(ann)) return false;
+        memcpy(weight, ann->weight, sizeof(weight));
+        return true;
+    }
+
+    /* Returns a new genann with these weights and activations. */
+    genann *to_genann() const {
+        genann *ann = genann_init(Inputs, Layers, Hidden, Outputs);
+        if (!ann) return 0;
+        memcpy(ann->weight, weight, sizeof(weight));
+        ann->activation_hidden = Act::function();
+        ann->activation_output = ActOut::function();
+        return ann;
+    }
+};
+
+#endif /*__GENANN_STATIC_HPP__*/
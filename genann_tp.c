@@ -0,0 +1,356 @@
+/*
+ * GENANN_TP - one network split across MPI ranks by neuron
+ * See genann_tp.h.
+ */
+
+#include "genann_tp.h"
+#include "genann_simd.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static int genann_tp_n_in(genann_tp const *tp, int h) {
+    return h == 0 ? tp->inputs : tp->hidden;
+}
+
+static int const *genann_tp_count(genann_tp const *tp, int h) {
+    return h == tp->hidden_layers ? tp->output_count : tp->hidden_count;
+}
+
+static int const *genann_tp_first(genann_tp const *tp, int h) {
+    return h == tp->hidden_layers ? tp->output_first : tp->hidden_first;
+}
+
+/* Offset of layer h in the whole network's weights, as genann lays them out. */
+static size_t genann_tp_w0(genann_tp const *tp, int h) {
+    return h == 0 ? 0 : (size_t)(tp->inputs+1) * tp->hidden + (size_t)(tp->hidden+1) * tp->hidden * (h-1);
+}
+
+/* Own deltas per sample: one range of every hidden layer and one of the outputs. */
+static int genann_tp_n_delta(genann_tp const *tp) {
+    return tp->hidden_layers * tp->hidden_count[tp->rank] + tp->output_count[tp->rank];
+}
+
+static int genann_tp_total_neurons(genann_tp const *tp) {
+    return tp->inputs + tp->hidden * tp->hidden_layers + tp->outputs;
+}
+
+
+/* Same generator as the streaming reader's shuffle; here it makes weight i
+ * depend only on i, so any number of ranks starts from the same network. */
+static double genann_tp_random(uint64_t i) {
+    uint64_t z = i * 0x9e3779b97f4a7c15ull + 0x632be59bd9b4e019ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return (double)(z >> 11) / 9007199254740992.0;
+}
+
+
+static genann_tp *genann_tp_alloc(int inputs, int hidden_layers, int hidden, int outputs, MPI_Comm comm) {
+    if (hidden_layers < 0) return 0;
+    if (inputs < 1) return 0;
+    if (outputs < 1) return 0;
+    if (hidden_layers > 0 && hidden < 1) return 0;
+
+    genann_tp *tp = calloc(1, sizeof(genann_tp));
+    if (!tp) return 0;
+
+    tp->inputs = inputs;
+    tp->hidden_layers = hidden_layers;
+    tp->hidden = hidden;
+    tp->outputs = outputs;
+    tp->activation_hidden = genann_act_sigmoid_cached;
+    tp->activation_output = genann_act_sigmoid_cached;
+    tp->comm = comm;
+    MPI_Comm_rank(comm, &tp->rank);
+    MPI_Comm_size(comm, &tp->ranks);
+
+    tp->hidden_count = malloc(sizeof(int) * 6 * tp->ranks);
+    if (!tp->hidden_count) {
+        free(tp);
+        return 0;
+    }
+    tp->hidden_first = tp->hidden_count + tp->ranks;
+    tp->output_count = tp->hidden_first + tp->ranks;
+    tp->output_first = tp->output_count + tp->ranks;
+    tp->exchange_count = tp->output_first + tp->ranks;
+    tp->exchange_first = tp->exchange_count + tp->ranks;
+
+    int r, h;
+    for (r = 0; r < tp->ranks; ++r) {
+        tp->hidden_first[r] = (int)((long)hidden * r / tp->ranks);
+        tp->hidden_count[r] = (int)((long)hidden * (r+1) / tp->ranks) - tp->hidden_first[r];
+        tp->output_first[r] = (int)((long)outputs * r / tp->ranks);
+        tp->output_count[r] = (int)((long)outputs * (r+1) / tp->ranks) - tp->output_first[r];
+    }
+
+    tp->total_weights = 0;
+    for (h = 0; h <= hidden_layers; ++h) {
+        tp->total_weights += genann_tp_count(tp, h)[tp->rank] * (genann_tp_n_in(tp, h) + 1);
+    }
+
+    tp->weight = malloc(sizeof(double) * (tp->total_weights > 0 ? tp->total_weights : 1));
+    if (!tp->weight) {
+        genann_tp_free(tp);
+        return 0;
+    }
+
+    return tp;
+}
+
+
+genann_tp *genann_tp_init(int inputs, int hidden_layers, int hidden, int outputs, MPI_Comm comm) {
+    genann_tp *tp = genann_tp_alloc(inputs, hidden_layers, hidden, outputs, comm);
+    if (!tp) return 0;
+
+    double *w = tp->weight;
+    int h, i;
+    for (h = 0; h <= hidden_layers; ++h) {
+        const int n_in = genann_tp_n_in(tp, h);
+        const int first = genann_tp_first(tp, h)[tp->rank];
+        const int n = genann_tp_count(tp, h)[tp->rank] * (n_in + 1);
+        const uint64_t base = genann_tp_w0(tp, h) + (size_t)first * (n_in + 1);
+        /* Sets weights from -0.5 to 0.5. */
+        for (i = 0; i < n; ++i) {
+            w[i] = genann_tp_random(base + i) - 0.5;
+        }
+        w += n;
+    }
+
+    return tp;
+}
+
+
+genann_tp *genann_tp_scatter(genann const *ann, MPI_Comm comm) {
+    if (!genann_is_uniform(ann)) return 0;
+    genann_tp *tp = genann_tp_alloc(ann->inputs, ann->hidden_layers, ann->hidden, ann->outputs, comm);
+    if (!tp) return 0;
+
+    tp->activation_hidden = ann->activation_hidden;
+    tp->activation_output = ann->activation_output;
+
+    double *w = tp->weight;
+    int h;
+    for (h = 0; h <= tp->hidden_layers; ++h) {
+        const int n_in = genann_tp_n_in(tp, h);
+        const int first = genann_tp_first(tp, h)[tp->rank];
+        const size_t n = (size_t)genann_tp_count(tp, h)[tp->rank] * (n_in + 1);
+        memcpy(w, ann->weight + genann_tp_w0(tp, h) + (size_t)first * (n_in + 1), sizeof(double) * n);
+        w += n;
+    }
+
+    return tp;
+}
+
+
+genann *genann_tp_gather(genann_tp const *tp) {
+    genann *ann = 0;
+    int h, r, ok = 1;
+
+    if (tp->rank == 0) {
+        ann = genann_init(tp->inputs, tp->hidden_layers, tp->hidden, tp->outputs);
+        ok = ann != 0;
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, tp->comm);
+    if (!ok) return 0;
+
+    if (ann) {
+        ann->activation_hidden = tp->activation_hidden;
+        ann->activation_output = tp->activation_output;
+    }
+
+    double const *w = tp->weight;
+    for (h = 0; h <= tp->hidden_layers; ++h) {
+        const int n_in = genann_tp_n_in(tp, h);
+        int const *count = genann_tp_count(tp, h);
+        int const *first = genann_tp_first(tp, h);
+
+        for (r = 0; r < tp->ranks; ++r) {
+            tp->exchange_count[r] = count[r] * (n_in + 1);
+            tp->exchange_first[r] = first[r] * (n_in + 1);
+        }
+        MPI_Gatherv(w, tp->exchange_count[tp->rank], MPI_DOUBLE,
+                    ann ? ann->weight + genann_tp_w0(tp, h) : 0, tp->exchange_count, tp->exchange_first, MPI_DOUBLE,
+                    0, tp->comm);
+        w += tp->exchange_count[tp->rank];
+    }
+
+    return ann;
+}
+
+
+void genann_tp_free(genann_tp *tp) {
+    if (!tp) return;
+    free(tp->hidden_count);
+    free(tp->weight);
+    free(tp->output);
+    free(tp->delta);
+    free(tp->buf);
+    free(tp);
+}
+
+
+/* Grows the scratch to hold count samples. */
+static int genann_tp_reserve(genann_tp *tp, int count) {
+    if (count <= tp->capacity) return 0;
+
+    const int widest = tp->hidden > tp->outputs ? tp->hidden : tp->outputs;
+    double *output = realloc(tp->output, sizeof(double) * genann_tp_total_neurons(tp) * count);
+    if (output) tp->output = output;
+    double *delta = realloc(tp->delta, sizeof(double) * (genann_tp_n_delta(tp) > 0 ? genann_tp_n_delta(tp) : 1) * count);
+    if (delta) tp->delta = delta;
+    /* One layer in rank order, and this rank's part of a reduce-scatter. */
+    double *buf = realloc(tp->buf, sizeof(double) * 2 * widest * count);
+    if (buf) tp->buf = buf;
+
+    if (!output || !delta || !buf) return -1;
+    tp->capacity = count;
+    return 0;
+}
+
+
+/* Runs count samples through the network, leaving every neuron's output of
+ * sample s at tp->output + s * total_neurons, as genann_forward does. */
+static void genann_tp_forward(genann_tp *tp, double const *inputs, int count) {
+    const int total = genann_tp_total_neurons(tp);
+    double const *w = tp->weight;
+    int h, j, r, s;
+
+    for (s = 0; s < count; ++s) {
+        memcpy(tp->output + (size_t)total * s, inputs + (size_t)tp->inputs * s, sizeof(double) * tp->inputs);
+    }
+
+    for (h = 0; h <= tp->hidden_layers; ++h) {
+        const int n_in = genann_tp_n_in(tp, h);
+        const int i0 = h == 0 ? 0 : tp->inputs + tp->hidden * (h-1);
+        const int o0 = tp->inputs + tp->hidden * h;
+        const genann_actfun act = (h == tp->hidden_layers ? tp->activation_output : tp->activation_hidden);
+        int const *n = genann_tp_count(tp, h);
+        int const *first = genann_tp_first(tp, h);
+        const int mine = n[tp->rank];
+
+        /* The exchange wants each rank's neurons in one piece, so the layer
+         * is built rank by rank, samples within a rank. */
+        for (r = 0; r < tp->ranks; ++r) {
+            tp->exchange_count[r] = n[r] * count;
+            tp->exchange_first[r] = first[r] * count;
+        }
+        double *own = tp->buf + tp->exchange_first[tp->rank];
+
+        for (j = 0; j < mine; ++j) {
+            for (s = 0; s < count; ++s) {
+                own[s * mine + j] = act(genann_simd.dot(w + 1, tp->output + (size_t)total * s + i0, n_in) - w[0]);
+            }
+            w += n_in + 1;
+        }
+
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, tp->buf, tp->exchange_count, tp->exchange_first, MPI_DOUBLE, tp->comm);
+
+        for (r = 0; r < tp->ranks; ++r) {
+            for (s = 0; s < count; ++s) {
+                memcpy(tp->output + (size_t)total * s + o0 + first[r], tp->buf + tp->exchange_first[r] + s * n[r], sizeof(double) * n[r]);
+            }
+        }
+    }
+}
+
+
+int genann_tp_run(genann_tp *tp, double const *inputs, int count, double *outputs) {
+    const int total = genann_tp_total_neurons(tp);
+    int s;
+
+    if (genann_tp_reserve(tp, count)) return -1;
+    genann_tp_forward(tp, inputs, count);
+    for (s = 0; s < count; ++s) {
+        memcpy(outputs + (size_t)tp->outputs * s, tp->output + (size_t)total * s + total - tp->outputs, sizeof(double) * tp->outputs);
+    }
+    return 0;
+}
+
+
+int genann_tp_train(genann_tp *tp, double const *inputs, double const *desired_outputs, int count, double learning_rate) {
+    const int total = genann_tp_total_neurons(tp);
+    const int n_delta = genann_tp_n_delta(tp);
+    const int h_mine = tp->hidden_count[tp->rank];
+    const int h_first = tp->hidden_first[tp->rank];
+    int h, j, k, r, s;
+
+    if (genann_tp_reserve(tp, count)) return -1;
+    genann_tp_forward(tp, inputs, count);
+
+    /* Output deltas of this rank's outputs. */
+    {
+        const int mine = tp->output_count[tp->rank];
+        const int first = tp->output_first[tp->rank];
+        for (s = 0; s < count; ++s) {
+            double const *o = tp->output + (size_t)total * s + total - tp->outputs + first;
+            double const *t = desired_outputs + (size_t)tp->outputs * s + first;
+            double *d = tp->delta + (size_t)n_delta * s + tp->hidden_layers * h_mine;
+            for (j = 0; j < mine; ++j) {
+                d[j] = tp->activation_output == genann_act_linear ? t[j] - o[j] : (t[j] - o[j]) * o[j] * (1.0 - o[j]);
+            }
+        }
+    }
+
+    /* Hidden deltas, last layer first. Row k of the layer above adds
+     * dd[k] times its weights to every delta of layer h; this rank has some
+     * of the rows, so it makes a partial sum for all of layer h, split into
+     * the ranges of the neurons' owners, and the reduce-scatter hands each
+     * rank the total for its own range. */
+    double const *ww = tp->weight + tp->total_weights;
+    for (h = tp->hidden_layers - 1; h >= 0; --h) {
+        const int next_mine = genann_tp_count(tp, h+1)[tp->rank];
+        const int dd0 = (h+1) * h_mine;
+        double *partial = tp->buf;
+        double *sum = tp->buf + (size_t)tp->hidden * count;
+        ww -= (size_t)next_mine * (tp->hidden + 1);
+
+        for (r = 0; r < tp->ranks; ++r) {
+            tp->exchange_count[r] = tp->hidden_count[r] * count;
+            tp->exchange_first[r] = tp->hidden_first[r] * count;
+        }
+        memset(partial, 0, sizeof(double) * tp->hidden * count);
+        for (s = 0; s < count; ++s) {
+            double const *dd = tp->delta + (size_t)n_delta * s + dd0;
+            for (k = 0; k < next_mine; ++k) {
+                double const *row = ww + (size_t)k * (tp->hidden + 1) + 1;
+                for (r = 0; r < tp->ranks; ++r) {
+                    const int n = tp->hidden_count[r];
+                    genann_simd.axpy(partial + tp->exchange_first[r] + s * n, dd[k], row + tp->hidden_first[r], n);
+                }
+            }
+        }
+
+        MPI_Reduce_scatter(partial, sum, tp->exchange_count, MPI_DOUBLE, MPI_SUM, tp->comm);
+
+        for (s = 0; s < count; ++s) {
+            double const *o = tp->output + (size_t)total * s + tp->inputs + tp->hidden * h + h_first;
+            double *d = tp->delta + (size_t)n_delta * s + h * h_mine;
+            for (j = 0; j < h_mine; ++j) {
+                d[j] = sum[s * h_mine + j] * o[j] * (1.0 - o[j]);
+            }
+        }
+    }
+
+    /* Update this rank's rows with the gradient summed over the samples. */
+    double *w = tp->weight;
+    for (h = 0; h <= tp->hidden_layers; ++h) {
+        const int n_in = genann_tp_n_in(tp, h);
+        const int i0 = h == 0 ? 0 : tp->inputs + tp->hidden * (h-1);
+        const int mine = genann_tp_count(tp, h)[tp->rank];
+
+        for (j = 0; j < mine; ++j) {
+            for (s = 0; s < count; ++s) {
+                const double step = tp->delta[(size_t)n_delta * s + h * h_mine + j] * learning_rate;
+                w[0] -= step;
+                genann_simd.axpy(w + 1, step, tp->output + (size_t)total * s + i0, n_in);
+            }
+            w += n_in + 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * GENANN_TP - one network split across MPI ranks by neuron
+ *
+ * Every layer's neurons are divided into contiguous ranges, one per rank,
+ * and a rank stores only the weight rows of its own neurons. Layer widths
+ * are then bounded by the memory and FLOPs of all ranks together rather
+ * than of one process.
+ *
+ * All ranks see every sample. Going forward, each rank computes its
+ * neurons of a layer and the layer is put back together on every rank with
+ * MPI_Allgatherv, since the next layer needs all of it. Going back, a rank
+ * can only form the part of a hidden delta that comes through its own rows
+ * of the layer above; those partial sums are added up and handed to the
+ * owners of the neurons with MPI_Reduce_scatter. Deltas stay distributed,
+ * and each rank updates its own rows.
+ *
+ * With a batch of 1, genann_tp_train makes the same updates as genann_train
+ * on the whole network, up to rounding in the summation order.
+ */
+
+#ifndef __GENANN_TP_H__
+#define __GENANN_TP_H__
+
+#include <mpi.h>
+
+#include "genann.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct genann_tp {
+    /* Shape of the whole network, as in genann. */
+    int inputs, hidden_layers, hidden, outputs;
+    genann_actfun activation_hidden, activation_output;
+
+    MPI_Comm comm;
+    int rank, ranks;
+
+    /* Neurons of a hidden layer and of the output layer per rank, and the
+     * first neuron of each rank's range. */
+    int *hidden_count, *hidden_first;
+    int *output_count, *output_first;
+    int *exchange_count, *exchange_first;  /* the same, times the batch */
+
+    /* This rank's rows, layer after layer, each the bias weight followed
+     * by the layer's inputs (total_weights long). */
+    int total_weights;
+    double *weight;
+
+    /* Scratch for up to capacity samples. */
+    int capacity;
+    double *output;             /* every neuron, every sample, replicated */
+    double *delta;              /* own neurons only */
+    double *buf;                /* layer exchange */
+} genann_tp;
+
+/* Creates this rank's part of a network of the given shape, with the same
+ * random weights whatever the number of ranks. Collective over comm; the
+ * communicator is not duplicated. Returns 0 on bad shape or allocation
+ * failure. */
+genann_tp *genann_tp_init(int inputs, int hidden_layers, int hidden, int outputs, MPI_Comm comm);
+
+/* Like genann_tp_init, taking the weights and activations from ann, which
+ * every rank must hold. Returns 0 unless genann_is_uniform(ann). */
+genann_tp *genann_tp_scatter(genann const *ann, MPI_Comm comm);
+
+/* Collects the whole network into a new genann on rank 0; other ranks get 0.
+ * Collective. */
+genann *genann_tp_gather(genann_tp const *tp);
+
+void genann_tp_free(genann_tp *tp);
+
+/* Runs count samples forward and stores their outputs (outputs values each)
+ * on every rank. Collective; all ranks pass the same inputs. Returns 0, or
+ * -1 on allocation failure. */
+int genann_tp_run(genann_tp *tp, double const *inputs, int count, double *outputs);
+
+/* One training step on count samples: the gradient is summed over them and
+ * applied once, like genann_backprop and genann_apply. Collective; all
+ * ranks pass the same samples. Returns 0, or -1 on allocation failure. */
+int genann_tp_train(genann_tp *tp, double const *inputs, double const *desired_outputs, int count, double learning_rate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GENANN_TP_H__*/
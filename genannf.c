@@ -0,0 +1,364 @@
+/*
+ * GENANNF - single-precision variant of GENANN
+ *
+ * This is genann.c with float in place of double, plus the bf16 inference
+ * path. The dot products and weight updates go through the float kernels of
+ * genann_simd. See genann.c for the original copyright notice, which applies
+ * here.
+ */
+
+#include "genannf.h"
+#include "genann_simd.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOOKUP_SIZE 4096
+#define LOOKUP_MIN -15.0f
+#define LOOKUP_MAX 15.0f
+
+float genannf_act_sigmoid(float a) {
+    if (a < -45.0f) return 0;
+    if (a > 45.0f) return 1;
+    return 1.0f / (1 + expf(-a));
+}
+
+
+/* Filled by genannf_init (and before main with GCC), never lazily, so
+ * concurrent readers are safe. */
+static float lookup[LOOKUP_SIZE];
+static int lookup_ready = 0;
+
+static void genannf_act_init(void) {
+    const float interval = (LOOKUP_MAX - LOOKUP_MIN) / LOOKUP_SIZE;
+    int i;
+    if (lookup_ready) return;
+    for (i = 0; i < LOOKUP_SIZE; ++i) {
+        lookup[i] = genannf_act_sigmoid(LOOKUP_MIN + interval * i);
+    }
+    lookup_ready = 1;
+}
+
+#ifdef __GNUC__
+__attribute__((constructor))
+static void genannf_act_startup(void) {
+    genannf_act_init();
+}
+#endif
+
+
+float genannf_act_sigmoid_cached(float a) {
+    /* NaN fails x >= 0 and maps to lookup[0]. */
+    float x = (a - LOOKUP_MIN) * (LOOKUP_SIZE / (LOOKUP_MAX - LOOKUP_MIN)) + 0.5f;
+    x = !(x >= 0) ? 0 : x;
+    x = x > LOOKUP_SIZE - 1 ? LOOKUP_SIZE - 1 : x;
+    return lookup[(int)x];
+}
+
+
+float genannf_act_threshold(float a) {
+    return a > 0;
+}
+
+
+float genannf_act_linear(float a) {
+    return a;
+}
+
+
+/* bf16 is the top half of an IEEE float. Round to nearest even when packing. */
+static uint16_t genannf_to_bf16(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += 0x7FFF + ((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+
+static float genannf_from_bf16(uint16_t b) {
+    uint32_t u = (uint32_t)b << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+
+genannf *genannf_init(int inputs, int hidden_layers, int hidden, int outputs) {
+    if (hidden_layers < 0) return 0;
+    if (inputs < 1) return 0;
+    if (outputs < 1) return 0;
+    if (hidden_layers > 0 && hidden < 1) return 0;
+
+
+    const int hidden_weights = hidden_layers ? (inputs+1) * hidden + (hidden_layers-1) * (hidden+1) * hidden : 0;
+    const int output_weights = (hidden_layers ? (hidden+1) : (inputs+1)) * outputs;
+    const int total_weights = (hidden_weights + output_weights);
+
+    const int total_neurons = (inputs + hidden * hidden_layers + outputs);
+
+    /* Allocate extra size for weights, outputs, and deltas. */
+    const int size = sizeof(genannf) + sizeof(float) * (total_weights + total_neurons + (total_neurons - inputs));
+    genannf *ret = malloc(size);
+    if (!ret) return 0;
+
+    ret->inputs = inputs;
+    ret->hidden_layers = hidden_layers;
+    ret->hidden = hidden;
+    ret->outputs = outputs;
+
+    ret->total_weights = total_weights;
+    ret->total_neurons = total_neurons;
+
+    /* Set pointers. */
+    ret->weight = (float*)((char*)ret + sizeof(genannf));
+    ret->output = ret->weight + ret->total_weights;
+    ret->delta = ret->output + ret->total_neurons;
+    ret->weight_bf16 = 0;
+
+    genannf_act_init();
+    genannf_randomize(ret);
+
+    ret->activation_hidden = genannf_act_sigmoid_cached;
+    ret->activation_output = genannf_act_sigmoid_cached;
+
+    return ret;
+}
+
+
+genannf *genannf_read(FILE *in) {
+    int inputs, hidden_layers, hidden, outputs;
+    int rc;
+
+    errno = 0;
+    rc = fscanf(in, "%d %d %d %d", &inputs, &hidden_layers, &hidden, &outputs);
+    if (rc < 4 || errno != 0) {
+        perror("fscanf");
+        return NULL;
+    }
+
+    genannf *ann = genannf_init(inputs, hidden_layers, hidden, outputs);
+    if (!ann) {
+        fprintf(stderr, "genannf_read: bad topology\n");
+        return NULL;
+    }
+
+    int i;
+    for (i = 0; i < ann->total_weights; ++i) {
+        errno = 0;
+        rc = fscanf(in, " %e", ann->weight + i);
+        if (rc < 1 || errno != 0) {
+            perror("fscanf");
+            genannf_free(ann);
+
+            return NULL;
+        }
+    }
+
+    return ann;
+}
+
+
+genannf *genannf_copy(genannf const *ann) {
+    const int size = sizeof(genannf) + sizeof(float) * (ann->total_weights + ann->total_neurons + (ann->total_neurons - ann->inputs));
+    genannf *ret = malloc(size);
+    if (!ret) return 0;
+
+    memcpy(ret, ann, size);
+
+    /* Set pointers. */
+    ret->weight = (float*)((char*)ret + sizeof(genannf));
+    ret->output = ret->weight + ret->total_weights;
+    ret->delta = ret->output + ret->total_neurons;
+    ret->weight_bf16 = 0;
+
+    return ret;
+}
+
+
+void genannf_randomize(genannf *ann) {
+    int i;
+    for (i = 0; i < ann->total_weights; ++i) {
+        float r = GENANNF_RANDOM();
+        /* Sets weights from -0.5 to 0.5. */
+        ann->weight[i] = r - 0.5f;
+    }
+}
+
+
+void genannf_free(genannf *ann) {
+    /* The weight, output, and delta pointers go to the same buffer. */
+    free(ann->weight_bf16);
+    free(ann);
+}
+
+
+int genannf_pack_bf16(genannf *ann) {
+    if (!ann->weight_bf16) {
+        ann->weight_bf16 = malloc(sizeof(uint16_t) * ann->total_weights);
+        if (!ann->weight_bf16) return -1;
+    }
+
+    int i;
+    for (i = 0; i < ann->total_weights; ++i) {
+        ann->weight_bf16[i] = genannf_to_bf16(ann->weight[i]);
+    }
+    return 0;
+}
+
+
+float const *genannf_run(genannf const *ann, float const *inputs) {
+    float const *w = ann->weight;
+    float *o = ann->output + ann->inputs;
+    float const *i = ann->output;
+
+    memcpy(ann->output, inputs, sizeof(float) * ann->inputs);
+
+    int h, j;
+
+    const genannf_actfun act = ann->activation_hidden;
+    const genannf_actfun acto = ann->activation_output;
+
+    /* Figure hidden layers, if any. */
+    for (h = 0; h < ann->hidden_layers; ++h) {
+        const int n_in = (h == 0 ? ann->inputs : ann->hidden);
+        for (j = 0; j < ann->hidden; ++j) {
+            *o++ = act(genann_simd.sdot(w + 1, i, n_in) - w[0]);
+            w += n_in + 1;
+        }
+
+        i += n_in;
+    }
+
+    float const *ret = o;
+
+    /* Figure output layer. */
+    {
+        const int n_in = (ann->hidden_layers ? ann->hidden : ann->inputs);
+        for (j = 0; j < ann->outputs; ++j) {
+            *o++ = acto(genann_simd.sdot(w + 1, i, n_in) - w[0]);
+            w += n_in + 1;
+        }
+    }
+
+    /* Sanity check that we used all weights and wrote all outputs. */
+    assert(w - ann->weight == ann->total_weights);
+    assert(o - ann->output == ann->total_neurons);
+
+    return ret;
+}
+
+
+float const *genannf_run_bf16(genannf const *ann, float const *inputs) {
+    uint16_t const *w = ann->weight_bf16;
+    float *o = ann->output + ann->inputs;
+    float const *i = ann->output;
+
+    assert(w);
+    memcpy(ann->output, inputs, sizeof(float) * ann->inputs);
+
+    int h, j, k;
+
+    for (h = 0; h <= ann->hidden_layers; ++h) {
+        const int n_in = (h == 0 ? ann->inputs : ann->hidden);
+        const int n_out = (h == ann->hidden_layers ? ann->outputs : ann->hidden);
+        const genannf_actfun act = (h == ann->hidden_layers ? ann->activation_output : ann->activation_hidden);
+
+        for (j = 0; j < n_out; ++j) {
+            float sum = genannf_from_bf16(*w++) * -1.0f;
+            for (k = 0; k < n_in; ++k) {
+                sum += genannf_from_bf16(w[k]) * i[k];
+            }
+            w += n_in;
+            *o++ = act(sum);
+        }
+
+        i += n_in;
+    }
+
+    assert(w - ann->weight_bf16 == ann->total_weights);
+    assert(o - ann->output == ann->total_neurons);
+
+    return ann->output + ann->total_neurons - ann->outputs;
+}
+
+
+void genannf_train(genannf const *ann, float const *inputs, float const *desired_outputs, float learning_rate) {
+    /* To begin with, we must run the network forward. */
+    genannf_run(ann, inputs);
+
+    int h, j;
+
+    /* Set output layer deltas. */
+    {
+        float const *o = ann->output + ann->inputs + ann->hidden * ann->hidden_layers; /* First output. */
+        float *d = ann->delta + ann->hidden * ann->hidden_layers; /* First delta. */
+        float const *t = desired_outputs; /* First desired output. */
+
+        if (ann->activation_output == genannf_act_linear) {
+            for (j = 0; j < ann->outputs; ++j) {
+                d[j] = t[j] - o[j];
+            }
+        } else {
+            for (j = 0; j < ann->outputs; ++j) {
+                d[j] = (t[j] - o[j]) * o[j] * (1.0f - o[j]);
+            }
+        }
+    }
+
+    /* Set hidden layer deltas, start on last layer and work backwards.
+     * Each neuron of the next layer adds its delta times its weight row
+     * to the sums, so the weights are read in order. */
+    for (h = ann->hidden_layers - 1; h >= 0; --h) {
+        float const *o = ann->output + ann->inputs + (h * ann->hidden);
+        float *d = ann->delta + (h * ann->hidden);
+        float const * const dd = ann->delta + ((h+1) * ann->hidden);
+        float const * const ww = ann->weight + ((ann->inputs+1) * ann->hidden) + ((ann->hidden+1) * ann->hidden * (h));
+        const int next = (h == ann->hidden_layers-1 ? ann->outputs : ann->hidden);
+
+        memset(d, 0, sizeof(float) * ann->hidden);
+        for (j = 0; j < next; ++j) {
+            genann_simd.saxpy(d, dd[j], ww + j * (ann->hidden + 1) + 1, ann->hidden);
+        }
+        for (j = 0; j < ann->hidden; ++j) {
+            d[j] *= o[j] * (1.0f-o[j]);
+        }
+    }
+
+    /* Update every layer's weights, in weight order. */
+    {
+        float *w = ann->weight;
+        float const *d = ann->delta;
+        float const *i = ann->output;
+
+        for (h = 0; h <= ann->hidden_layers; ++h) {
+            const int n_in = (h == 0 ? ann->inputs : ann->hidden);
+            const int n_out = (h == ann->hidden_layers ? ann->outputs : ann->hidden);
+
+            for (j = 0; j < n_out; ++j) {
+                const float step = d[j] * learning_rate;
+                *w++ += step * -1.0f;
+                genann_simd.saxpy(w, step, i, n_in);
+                w += n_in;
+            }
+
+            i += n_in;
+            d += n_out;
+        }
+
+        assert(w - ann->weight == ann->total_weights);
+    }
+}
+
+
+void genannf_write(genannf const *ann, FILE *out) {
+    fprintf(out, "%d %d %d %d", ann->inputs, ann->hidden_layers, ann->hidden, ann->outputs);
+
+    int i;
+    for (i = 0; i < ann->total_weights; ++i) {
+        fprintf(out, " %.9e", ann->weight[i]);
+    }
+}
@@ -0,0 +1,102 @@
+/*
+ * GENANNF - single-precision variant of GENANN
+ *
+ * Same network layout and text file format as genann.h, with float weights,
+ * outputs and deltas. Models written by genann_write can be read by
+ * genannf_read and the other way round.
+ *
+ * For inference there is also a bf16 copy of the weights (the upper 16 bits
+ * of each float) that is run with float accumulation. It halves the weight
+ * bandwidth again and is built from the float weights with genannf_pack_bf16.
+ */
+
+
+#ifndef __GENANNF_H__
+#define __GENANNF_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef GENANNF_RANDOM
+#define GENANNF_RANDOM() (((float)rand())/RAND_MAX)
+#endif
+
+
+typedef float (*genannf_actfun)(float a);
+
+
+typedef struct genannf {
+    /* How many inputs, outputs, and hidden neurons. */
+    int inputs, hidden_layers, hidden, outputs;
+
+    /* Activation functions for hidden and output neurons. Default: genannf_act_sigmoid_cached */
+    genannf_actfun activation_hidden;
+    genannf_actfun activation_output;
+
+    /* Total number of weights, and size of weights buffer. */
+    int total_weights;
+
+    /* Total number of neurons + inputs and size of output buffer. */
+    int total_neurons;
+
+    /* All weights (total_weights long). */
+    float *weight;
+
+    /* Stores input array and output of each neuron (total_neurons long). */
+    float *output;
+
+    /* Stores delta of each hidden and output neuron (total_neurons - inputs long). */
+    float *delta;
+
+    /* bf16 copy of weight, or 0 until genannf_pack_bf16 is called. */
+    uint16_t *weight_bf16;
+
+} genannf;
+
+
+/* Creates and returns a new ann. */
+genannf *genannf_init(int inputs, int hidden_layers, int hidden, int outputs);
+
+/* Creates ANN from file saved with genannf_write or genann_write. */
+genannf *genannf_read(FILE *in);
+
+/* Sets weights randomly. Called by init. */
+void genannf_randomize(genannf *ann);
+
+/* Returns a new copy of ann (without the bf16 copy). */
+genannf *genannf_copy(genannf const *ann);
+
+/* Frees the memory used by an ann. */
+void genannf_free(genannf *ann);
+
+/* Runs the feedforward algorithm to calculate the ann's output. */
+float const *genannf_run(genannf const *ann, float const *inputs);
+
+/* Does a single backprop update. */
+void genannf_train(genannf const *ann, float const *inputs, float const *desired_outputs, float learning_rate);
+
+/* Saves the ann, in the same format as genann_write. */
+void genannf_write(genannf const *ann, FILE *out);
+
+/* (Re)builds the bf16 copy of the weights. Call again after training. Returns 0 on success. */
+int genannf_pack_bf16(genannf *ann);
+
+/* Like genannf_run, but reads the bf16 weights. Needs genannf_pack_bf16 first. */
+float const *genannf_run_bf16(genannf const *ann, float const *inputs);
+
+
+float genannf_act_sigmoid(float a);
+float genannf_act_sigmoid_cached(float a);
+float genannf_act_threshold(float a);
+float genannf_act_linear(float a);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GENANNF_H__*/
@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#define USE_MNIST_LOADER
+#define MNIST_DOUBLE
+#include "mnist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "genann.h"
+#include "mnist_cache.h"
+#include "mnist_stream.h"
+#include <time.h>
+#include <mpi.h>
+#include <omp.h>
+#include <sched.h>
+
+double *input, *class;
+unsigned int samples;
+mnist_cache cache; /* set when the data came from a pre-converted cache file */
+const char *class_names[] = {"0","1","2","3","4","5","6","7","8","9"};
+
+
+void load_mnist(char *images_fname, char *labels_fname)
+{
+    mnist_data *data_t, *temp;
+    unsigned int cnt;
+    int ret;
+    char cache_fname[256];
+
+    /* A cache written by mnist_convert next to the images is mapped instead. */
+    snprintf(cache_fname, sizeof(cache_fname), "%s.cache", images_fname);
+    if (mnist_cache_open(cache_fname, &cache) == 0) {
+        if (cache.pixels == 28*28 && mnist_cache_doubles(&cache, &input, &class) == 0) {
+            samples = cache.count;
+            printf("image count: %d (cached)\n", samples);
+            return;
+        }
+        mnist_cache_close(&cache);
+    }
+    
+    if (ret = mnist_load(images_fname, labels_fname, &data_t, &cnt)) {
+        printf("An error occured: %d\n", ret);
+    } else {
+        printf("image count: %d\n", cnt);
+    }
+    //cnt = 500; // was used for debugging with smaller data, to reduce run time
+    /* Allocate memory for input and output data. */
+    input = (double *) malloc(sizeof(double) * cnt * 28*28);
+    if (input == NULL)
+    {
+        printf("Input malloc error");
+        exit(-1);
+    }
+    class = (double *) malloc(sizeof(double) * cnt * 10);
+    if (class == NULL)
+    {
+        printf("class malloc error");
+        exit(-1);
+    }
+    
+
+    temp = data_t;
+    int i, j,k;
+    for (i = 0; i <cnt; ++i) {
+        double *p = input + i * 28*28;
+        double *c = class + i * 10;
+        c[0] = c[1] = c[2] = c[4] = c[5] = c[6] = c[7] = c[8] = c[9] = 0.0;
+        //printf("pointers allocated for data row %d \n",i);
+        for (j = 0; j < 28*28; ++j) {
+               //printf("data line %d, j %d, image row %d,image col %d value = %f \n",i,j,j/28,j%28, temp->data[j/28][j%28]);
+               *(p + j) = temp->data[j/28][j%28];
+            }
+
+        *(c + (int)temp->label) = 1.0;
+        temp = temp + 1;
+    }
+    samples = cnt;
+    //printf("image count %d", cnt);
+    free(data_t);
+}
+
+void unload_mnist(void)
+{
+    if (cache.map) {
+        mnist_cache_close(&cache);
+    } else {
+        free(input);
+        free(class);
+    }
+    input = class = NULL;
+}
+
+int correct_predictions(genann *ann) {
+    int correct = 0, j =0;
+    double *guesses = (double *) malloc(sizeof(double) * samples * 10);
+    if (guesses == NULL || genann_run_batch(ann, input, samples, guesses))
+    {
+        printf("guesses malloc error");
+        exit(-1);
+    }
+    for (j = 0; j < samples; ++j) 
+    {
+        const double *guess = guesses + j*10;
+        double max = 0.0;
+        int k =0, actual =0, max_cls = 0;
+        for (k =0; k < 10; k++)
+        {
+            if (guess[k]> max) {
+                max = guess[k];
+                max_cls = k;
+            }
+            if (class[j*10 + k]== 1.0) actual = k;
+        } 
+//        printf(" predicted %d, actual %d \n",max_cls, actual);
+        if (class[j*10 + (int)max_cls] == 1.0) ++correct;
+        //else {printf("Logic error.\n"); exit(1);
+    }
+    free(guesses);
+    return correct;
+}
+
+
+/* Thread placement inside a rank. */
+enum { PIN_NONE, PIN_COMPACT, PIN_SCATTER };
+
+/* Pins each OpenMP thread to one CPU of the set this rank was started with,
+ * which is what mpirun --bind-to socket|numa|core|none decided. compact
+ * takes the CPUs in order, scatter spreads the threads evenly over the set. */
+void pin_threads(int mode, int rank)
+{
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE], n = 0, c;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    for (c = 0; c < CPU_SETSIZE; ++c) {
+        if (CPU_ISSET(c, &allowed)) cpus[n++] = c;
+    }
+
+#pragma omp parallel
+    {
+        const int t = omp_get_thread_num();
+        const int nt = omp_get_num_threads();
+        int cpu = -1;
+
+        if (mode != PIN_NONE && n > 0) {
+            cpu_set_t one;
+            cpu = cpus[mode == PIN_COMPACT ? t % n : (int)((long)t * n / nt) % n];
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            sched_setaffinity(0, sizeof(one), &one);
+        }
+#pragma omp critical
+        {
+            if (cpu >= 0) printf("rank %d thread %d on cpu %d\n", rank, t, cpu);
+            else if (t == 0) printf("rank %d: %d threads over %d cpus, unpinned\n", rank, nt, n);
+        }
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    /* Only the main thread makes MPI calls. */
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int w_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &w_size);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) printf("The MPI library does not support threads (MPI_THREAD_FUNNELED)\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    /* Samples per rank per step, threads per rank (0: the OpenMP default),
+     * thread pinning, per-epoch reshuffling of the shards, and the learning
+     * rate on the mean gradient of a step (the all-reduced sum is divided by
+     * batch * ranks). Rank placement is left to mpirun, e.g.
+     * mpirun -n 2 --map-by socket --bind-to socket ./hybrid_exe 64 16 compact 1 */
+    int batch = argc > 1 ? atoi(argv[1]) : 64;
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    int pin = PIN_NONE;
+    if (argc > 3 && !strcmp(argv[3], "compact")) pin = PIN_COMPACT;
+    if (argc > 3 && !strcmp(argv[3], "scatter")) pin = PIN_SCATTER;
+    double rate = argc > 5 ? atof(argv[5]) : 5;
+    if (batch < 1) batch = 1;
+    if (threads > 0) omp_set_num_threads(threads);
+
+    pin_threads(pin, rank);
+
+    /* Every rank reads its own shard straight from the files (the cache
+     * file if mnist_convert made one), once per rank rather than per core,
+     * and nothing goes through rank 0. With
+     * reshuffle set, the blocks are dealt out again every epoch. */
+    int reshuffle = argc > 4 ? atoi(argv[4]) : 0;
+    const char *images = "mnist/train-images-idx3-ubyte.cache", *labels = NULL;
+    const int blocks = 8;
+    samples = mnist_file_count(images, labels);
+    if (samples == 0) {
+        images = "mnist/train-images-idx3-ubyte";
+        labels = "mnist/train-labels-idx1-ubyte";
+        samples = mnist_file_count(images, labels);
+    }
+    if (samples == 0) {
+        printf("An error occured opening %s\n", images);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    /* Initialize time elements */
+    double ts, te;
+    ts = MPI_Wtime();
+
+    const unsigned int shard_max = mnist_shard_max(samples, w_size, blocks);
+    double *s_data, *s_class;
+    s_data = (double *) malloc(sizeof(double) * shard_max * 28*28);
+    s_class = (double *) malloc(sizeof(double) * shard_max * 10);
+    int s_size = s_data && s_class ? mnist_read_shard(images, labels, samples, rank, w_size, blocks, reshuffle ? 42 : 0, 0, s_data, s_class) : -1;
+    if (s_size < 0) {
+        printf("An error occured reading the shard of rank %d\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (rank == 0) printf("image count: %d, read by %d ranks\n", samples, w_size);
+
+    /* 28*28 inputs.
+     * 3 hidden layer(s) of 10 neurons.
+     * 10 outputs (1 per class)
+     */
+    genann *ann = genann_init(28*28, 3, 10, 10);
+
+    int i;
+    int loops = 20;
+
+    /* Every step, the threads of each rank compute the gradient of the
+     * rank's slice (genann_gradient_omp), the ranks sum them with one
+     * MPI_Allreduce and all apply the same update. */
+    const int per_rank = shard_max;
+    const int steps = (per_rank + batch - 1) / batch;
+    double *grad = (double *) malloc(sizeof(double) * ann->total_weights);
+    if (grad == NULL)
+    {
+        printf("grad malloc error");
+        exit(-1);
+    }
+    if (rank == 0) printf("hybrid: %d ranks x %d threads, %d samples per rank per step\n", w_size, omp_get_max_threads(), batch);
+
+    double compute = 0, comm = 0;
+    for (i = 0; i < loops; ++i) {
+        int s;
+        if (reshuffle && i > 0) {
+            s_size = mnist_read_shard(images, labels, samples, rank, w_size, blocks, 42, i, s_data, s_class);
+            if (s_size < 0) MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        for (s = 0; s < steps; ++s) {
+            const int first = s * batch < s_size ? s * batch : s_size;
+            const int end = (s + 1) * batch < s_size ? (s + 1) * batch : s_size;
+            double t0 = MPI_Wtime();
+            memset(grad, 0, sizeof(double) * ann->total_weights);
+            if (genann_gradient_omp(ann, s_data + first*28*28, s_class + first*10, 28*28, 10, end - first, grad))
+            {
+                printf("gradient malloc error");
+                exit(-1);
+            }
+            double t1 = MPI_Wtime();
+            MPI_Allreduce(MPI_IN_PLACE, grad, ann->total_weights, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+            comm += MPI_Wtime() - t1;
+            compute += t1 - t0;
+            genann_apply(ann, grad, rate / ((double)batch * w_size));
+        }
+    }
+
+    te = MPI_Wtime();
+    if (rank == 0) printf("train time taken : %f (compute %f, all-reduce %f)\n", te - ts, compute, comm);
+
+    if (rank == 0)
+    {
+    /* Load data from file to test */
+    load_mnist("mnist/t10k-images-idx3-ubyte","mnist/t10k-labels-idx1-ubyte");
+
+    /* find accuracy */
+    int correct = correct_predictions(ann);
+    printf("\n\n %d/%d correct (%0.1f%%).\n", correct, samples, (double)correct / samples * 100.0);
+    unload_mnist();
+    }
+    MPI_Finalize();
+    free(s_data);
+    free(s_class);
+    free(grad);
+    genann_free(ann);
+
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * Pre-converted MNIST dataset file. See mnist_cache.h.
+ */
+
+#include "mnist_cache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MNIST_CACHE_MAGIC "MNISTC"
+#define MNIST_CACHE_VERSION 1
+#define MNIST_CACHE_BYTE_ORDER 0x01020304u
+#define MNIST_CLASSES 10
+
+typedef struct mnist_cache_header {
+    char magic[8];              /* MNIST_CACHE_MAGIC, NUL terminated */
+    uint32_t version;
+    uint32_t byte_order;        /* MNIST_CACHE_BYTE_ORDER as written */
+    uint32_t count, rows, cols;
+    uint32_t dtype, label_type;
+    uint32_t reserved0;
+    uint64_t image_offset;      /* multiples of 64 */
+    uint64_t label_offset;
+    uint64_t reserved1;
+} mnist_cache_header;
+
+typedef char mnist_cache_header_is_64_bytes[sizeof(mnist_cache_header) == 64 ? 1 : -1];
+
+
+static size_t dtype_size(int dtype) {
+    switch (dtype) {
+        case MNIST_CACHE_U8: return 1;
+        case MNIST_CACHE_F32: return sizeof(float);
+        case MNIST_CACHE_F64: return sizeof(double);
+    }
+    return 0;
+}
+
+
+static size_t align64(size_t n) {
+    return (n + 63) / 64 * 64;
+}
+
+
+/* Load a unsigned int from raw data, MSB first. */
+static unsigned int read_be32(FILE *fp, int *ok) {
+    unsigned char v[4];
+    if (fread(v, 1, 4, fp) != 4) *ok = 0;
+    return ((unsigned int)v[0] << 24) | ((unsigned int)v[1] << 16) | ((unsigned int)v[2] << 8) | v[3];
+}
+
+
+static int write_pad(FILE *out, size_t from, size_t to) {
+    static const char zeros[64];
+    return to > from && fwrite(zeros, 1, to - from, out) != to - from ? -1 : 0;
+}
+
+
+int mnist_cache_write(const char *image_filename, const char *label_filename, const char *cache_filename, int dtype, int label_type) {
+    int return_code = 0, ok = 1;
+    unsigned int i, j, rows, cols, count;
+    unsigned char *raw = 0;
+    void *row = 0;
+    FILE *out = 0;
+
+    FILE *ifp = fopen(image_filename, "rb");
+    FILE *lfp = fopen(label_filename, "rb");
+
+    if (!ifp || !lfp) {
+        return_code = -1; /* No such files */
+        goto cleanup;
+    }
+    if (read_be32(ifp, &ok) != 2051) {
+        return_code = -2; /* Not a valid image file */
+        goto cleanup;
+    }
+    if (read_be32(lfp, &ok) != 2049) {
+        return_code = -3; /* Not a valid label file */
+        goto cleanup;
+    }
+    count = read_be32(ifp, &ok);
+    if (read_be32(lfp, &ok) != count) {
+        return_code = -4; /* Element counts of 2 files mismatch */
+        goto cleanup;
+    }
+    rows = read_be32(ifp, &ok);
+    cols = read_be32(ifp, &ok);
+    if (!ok || !dtype_size(dtype) || (label_type != MNIST_CACHE_INDEX && label_type != MNIST_CACHE_ONEHOT)) {
+        return_code = -2;
+        goto cleanup;
+    }
+
+    const size_t pixels = (size_t)rows * cols;
+    mnist_cache_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MNIST_CACHE_MAGIC, sizeof(MNIST_CACHE_MAGIC));
+    hdr.version = MNIST_CACHE_VERSION;
+    hdr.byte_order = MNIST_CACHE_BYTE_ORDER;
+    hdr.count = count;
+    hdr.rows = rows;
+    hdr.cols = cols;
+    hdr.dtype = dtype;
+    hdr.label_type = label_type;
+    hdr.image_offset = 64;
+    hdr.label_offset = align64(hdr.image_offset + pixels * dtype_size(dtype) * count);
+
+    out = fopen(cache_filename, "wb");
+    raw = malloc(pixels);
+    row = malloc(pixels * sizeof(double));
+    if (!out || !raw || !row || fwrite(&hdr, sizeof(hdr), 1, out) != 1) {
+        return_code = -5;
+        goto cleanup;
+    }
+
+    /* One image at a time: nothing but the output file ever holds the whole set. */
+    for (i = 0; i < count; ++i) {
+        if (fread(raw, 1, pixels, ifp) != pixels) {
+            return_code = -2;
+            goto cleanup;
+        }
+        for (j = 0; j < pixels; ++j) {
+            if (dtype == MNIST_CACHE_F32) ((float *)row)[j] = raw[j] / 255.0f;
+            else if (dtype == MNIST_CACHE_F64) ((double *)row)[j] = raw[j] / 255.0;
+        }
+        if (fwrite(dtype == MNIST_CACHE_U8 ? (void *)raw : row, dtype_size(dtype), pixels, out) != pixels) {
+            return_code = -5;
+            goto cleanup;
+        }
+    }
+
+    if (write_pad(out, hdr.image_offset + pixels * dtype_size(dtype) * count, hdr.label_offset) != 0) {
+        return_code = -5;
+        goto cleanup;
+    }
+
+    for (i = 0; i < count; ++i) {
+        unsigned char label;
+        if (fread(&label, 1, 1, lfp) != 1 || label >= MNIST_CLASSES) {
+            return_code = -3;
+            goto cleanup;
+        }
+        if (label_type == MNIST_CACHE_INDEX) {
+            ok = fwrite(&label, 1, 1, out) == 1;
+        } else {
+            double onehot[MNIST_CLASSES] = {0};
+            onehot[label] = 1.0;
+            ok = fwrite(onehot, sizeof(double), MNIST_CLASSES, out) == MNIST_CLASSES;
+        }
+        if (!ok) {
+            return_code = -5;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    if (ifp) fclose(ifp);
+    if (lfp) fclose(lfp);
+    if (out && fclose(out) != 0 && return_code == 0) return_code = -5;
+    if (return_code && out) remove(cache_filename);
+    free(raw);
+    free(row);
+
+    return return_code;
+}
+
+
+int mnist_cache_open(const char *cache_filename, mnist_cache *c) {
+    struct stat st;
+    mnist_cache_header const *hdr;
+
+    memset(c, 0, sizeof(*c));
+
+    int fd = open(cache_filename, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(mnist_cache_header)) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    hdr = map;
+    const size_t pixels = (size_t)hdr->rows * hdr->cols;
+    const size_t label_bytes = hdr->label_type == MNIST_CACHE_ONEHOT ? sizeof(double) * MNIST_CLASSES : 1;
+    size_t image_bytes = 0, labels_bytes = 0;
+    /* The sizes come from the file, so check the arithmetic as well as the
+     * values: both sections have to lie inside the mapping. */
+    if (memcmp(hdr->magic, MNIST_CACHE_MAGIC, sizeof(MNIST_CACHE_MAGIC)) != 0
+            || hdr->version != MNIST_CACHE_VERSION
+            || hdr->byte_order != MNIST_CACHE_BYTE_ORDER
+            || !dtype_size(hdr->dtype)
+            || (hdr->label_type != MNIST_CACHE_INDEX && hdr->label_type != MNIST_CACHE_ONEHOT)
+            || hdr->image_offset % 64 || hdr->label_offset % 64
+            || __builtin_mul_overflow(pixels * dtype_size(hdr->dtype), (size_t)hdr->count, &image_bytes)
+            || __builtin_mul_overflow(label_bytes, (size_t)hdr->count, &labels_bytes)
+            || hdr->image_offset > hdr->label_offset
+            || hdr->label_offset - hdr->image_offset < image_bytes
+            || hdr->label_offset > (size_t)st.st_size
+            || (size_t)st.st_size - hdr->label_offset < labels_bytes) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    c->count = hdr->count;
+    c->pixels = pixels;
+    c->dtype = hdr->dtype;
+    c->label_type = hdr->label_type;
+    c->images = (char *)map + hdr->image_offset;
+    c->labels = (char *)map + hdr->label_offset;
+    c->map = map;
+    c->map_size = st.st_size;
+
+    return 0;
+}
+
+
+int mnist_cache_doubles(mnist_cache *c, double **input, double **output) {
+    size_t i, j;
+
+    if (c->dtype == MNIST_CACHE_F64) {
+        *input = (double *)c->images;
+    } else {
+        if (!c->input) {
+            c->input = malloc(sizeof(double) * c->pixels * c->count);
+            if (!c->input) return -1;
+            for (i = 0; i < (size_t)c->pixels * c->count; ++i) {
+                c->input[i] = c->dtype == MNIST_CACHE_U8
+                    ? ((unsigned char const *)c->images)[i] / 255.0
+                    : ((float const *)c->images)[i];
+            }
+        }
+        *input = c->input;
+    }
+
+    if (c->label_type == MNIST_CACHE_ONEHOT) {
+        *output = (double *)c->labels;
+    } else {
+        if (!c->output) {
+            c->output = calloc((size_t)MNIST_CLASSES * c->count, sizeof(double));
+            if (!c->output) return -1;
+            for (j = 0; j < c->count; ++j) {
+                const unsigned char label = ((unsigned char const *)c->labels)[j];
+                if (label >= MNIST_CLASSES) {
+                    free(c->output);
+                    c->output = NULL;
+                    return -1;
+                }
+                c->output[j * MNIST_CLASSES + label] = 1.0;
+            }
+        }
+        *output = c->output;
+    }
+
+    return 0;
+}
+
+
+void mnist_cache_close(mnist_cache *c) {
+    if (c->map) munmap(c->map, c->map_size);
+    free(c->input);
+    free(c->output);
+    memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,65 @@
+#ifndef __MNIST_CACHE_H__
+#define __MNIST_CACHE_H__
+
+/*
+ * Pre-converted MNIST dataset file.
+ *
+ * mnist_convert reads the IDX image and label files once and writes a cache
+ * file: a 64-byte header, then all images packed back to back, then all
+ * labels, each section 64-byte aligned. Images are stored as uint8 (0-255),
+ * float or double (0.0-1.0); labels as a uint8 class index or as a one-hot
+ * row of 10 doubles.
+ *
+ * mnist_cache_open maps the file read-only. A double/one-hot cache is laid
+ * out exactly like the input/class arrays the examples train on, so those
+ * are used straight from the mapping with no copy at all.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum { MNIST_CACHE_U8 = 1, MNIST_CACHE_F32 = 2, MNIST_CACHE_F64 = 3 };
+enum { MNIST_CACHE_INDEX = 1, MNIST_CACHE_ONEHOT = 2 };
+
+typedef struct mnist_cache {
+    unsigned int count;             /* number of samples */
+    unsigned int pixels;            /* per image, 28*28 */
+    int dtype;                      /* MNIST_CACHE_U8, _F32 or _F64 */
+    int label_type;                 /* MNIST_CACHE_INDEX or _ONEHOT */
+
+    void const *images;             /* count * pixels values of dtype */
+    void const *labels;             /* count uint8, or count * 10 doubles */
+
+    /* Mapping, and buffers made by mnist_cache_doubles when it had to convert. */
+    void *map;
+    size_t map_size;
+    double *input, *output;
+} mnist_cache;
+
+
+/* Converts the IDX files to a cache file. Returns 0, or the mnist_load style
+ * negative code: -1 no such file, -2 bad image file, -3 bad label file, -4
+ * count mismatch, -5 write error. */
+int mnist_cache_write(const char *image_filename, const char *label_filename, const char *cache_filename, int dtype, int label_type);
+
+/* Maps a cache file. Returns 0 on success, -1 if missing or not a cache. */
+int mnist_cache_open(const char *cache_filename, mnist_cache *c);
+
+/* Gives the samples as doubles, 28*28 inputs and 10 one-hot outputs each.
+ * No copy for a double/one-hot cache; any other layout is converted once
+ * into buffers owned by c. Returns 0 on success, or -1 on allocation failure
+ * or a class index out of range. */
+int mnist_cache_doubles(mnist_cache *c, double **input, double **output);
+
+/* Unmaps the file and frees anything mnist_cache_doubles allocated. */
+void mnist_cache_close(mnist_cache *c);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MNIST_CACHE_H__ */
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mnist_cache.h"
+
+/*
+ * Converts an IDX image/label pair to a cache file that load_mnist in the
+ * examples maps instead of parsing the IDX files.
+ *
+ *   ./mnist_convert <images> <labels> [f64|f32|u8] [onehot|index] [output]
+ *
+ * The default is f64/onehot written to <images>.cache, the layout the
+ * examples use without any copy. f32 and u8 files are 2x and 8x smaller
+ * and are widened once when loaded.
+ */
+
+int main(int argc, char *argv[])
+{
+    int dtype = MNIST_CACHE_F64, label_type = MNIST_CACHE_ONEHOT;
+    char out[256];
+    int ret;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <images> <labels> [f64|f32|u8] [onehot|index] [output]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 3) {
+        if (!strcmp(argv[3], "f64")) dtype = MNIST_CACHE_F64;
+        else if (!strcmp(argv[3], "f32")) dtype = MNIST_CACHE_F32;
+        else if (!strcmp(argv[3], "u8")) dtype = MNIST_CACHE_U8;
+        else {
+            fprintf(stderr, "unknown image type %s\n", argv[3]);
+            return 1;
+        }
+    }
+
+    if (argc > 4) {
+        if (!strcmp(argv[4], "onehot")) label_type = MNIST_CACHE_ONEHOT;
+        else if (!strcmp(argv[4], "index")) label_type = MNIST_CACHE_INDEX;
+        else {
+            fprintf(stderr, "unknown label type %s\n", argv[4]);
+            return 1;
+        }
+    }
+
+    if (argc > 5) snprintf(out, sizeof(out), "%s", argv[5]);
+    else snprintf(out, sizeof(out), "%s.cache", argv[1]);
+
+    if ((ret = mnist_cache_write(argv[1], argv[2], out, dtype, label_type))) {
+        printf("An error occured: %d\n", ret);
+        return 1;
+    }
+
+    printf("wrote %s\n", out);
+    return 0;
+}
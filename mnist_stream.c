@@ -0,0 +1,468 @@
+/*
+ * Streaming MNIST reader. See mnist_stream.h.
+ */
+
+#include "mnist_stream.h"
+#include "mnist_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MNIST_PIXELS (28*28)
+#define MNIST_CLASSES 10
+
+enum { BUF_FREE, BUF_FILLING, BUF_READY, BUF_IN_USE };
+
+typedef struct mnist_stream_buffer {
+    int state;
+    unsigned long seq;              /* window sequence number, across epochs */
+    unsigned int n;                 /* samples in it */
+    double *input, *output;
+} mnist_stream_buffer;
+
+typedef struct mnist_stream_reader {
+    mnist_stream *s;
+    pthread_t thread;
+    unsigned char *raw;             /* one window of images as stored */
+    unsigned char *raw_labels;
+    unsigned int *order;            /* window visiting order of an epoch */
+    unsigned int *perm;             /* sample order within a window */
+} mnist_stream_reader;
+
+struct mnist_stream {
+    /* Where the samples are: IDX pair, or both sections of one cache file. */
+    int image_fd, label_fd;
+    off_t image_offset, label_offset;
+    int dtype;                      /* MNIST_CACHE_U8, _F32 or _F64 */
+    int onehot;                     /* labels stored as 10 doubles */
+
+    unsigned int count, batch, window, windows;
+    unsigned int seed;
+
+    int buffers;
+    int readers, threads;           /* allocated, and running */
+    mnist_stream_buffer *buf;
+    mnist_stream_reader *reader;
+
+    pthread_mutex_t lock;
+    pthread_cond_t filled, freed;
+    unsigned long next_fill;        /* next window a reader will take */
+    unsigned long next_use;         /* next window to train on */
+    int stop, error;
+
+    /* Consumer side only. */
+    int current;                    /* buffer being trained on, or -1 */
+    unsigned int pos;
+    double waited;
+};
+
+
+static size_t dtype_size(int dtype) {
+    return dtype == MNIST_CACHE_F64 ? sizeof(double) : dtype == MNIST_CACHE_F32 ? sizeof(float) : 1;
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* splitmix64; each window gets its own state so readers share nothing. */
+static uint64_t next_random(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+
+static void shuffle(unsigned int *a, unsigned int n, uint64_t state) {
+    unsigned int i;
+    for (i = 0; i < n; ++i) a[i] = i;
+    for (i = n; i > 1; --i) {
+        const unsigned int j = next_random(&state) % i;
+        const unsigned int t = a[i-1];
+        a[i-1] = a[j];
+        a[j] = t;
+    }
+}
+
+
+static int read_at(int fd, void *buf, size_t n, off_t offset) {
+    char *p = buf;
+    while (n) {
+        const ssize_t r = pread(fd, p, n, offset);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        n -= r;
+        offset += r;
+    }
+    return 0;
+}
+
+
+static unsigned int read_be32(unsigned char const *v) {
+    return ((unsigned int)v[0] << 24) | ((unsigned int)v[1] << 16) | ((unsigned int)v[2] << 8) | v[3];
+}
+
+
+/* Reads samples [first, first + n) into raw/raw_labels and widens sample i
+ * into slot perm[i] of input/output (slot i if perm is 0). Returns 0 or -1. */
+static int read_samples(mnist_stream const *s, unsigned int first, unsigned int n, unsigned char *raw, unsigned char *raw_labels, unsigned int const *perm, double *input, double *output) {
+    const size_t px = dtype_size(s->dtype);
+    const size_t label_size = s->onehot ? sizeof(double) * MNIST_CLASSES : 1;
+    unsigned int i, j;
+
+    if (read_at(s->image_fd, raw, px * MNIST_PIXELS * n, s->image_offset + (off_t)px * MNIST_PIXELS * first) != 0) return -1;
+    if (read_at(s->label_fd, raw_labels, label_size * n, s->label_offset + (off_t)label_size * first) != 0) return -1;
+
+    for (i = 0; i < n; ++i) {
+        const size_t slot = perm ? perm[i] : i;
+        double *in = input + slot * MNIST_PIXELS;
+        double *out = output + slot * MNIST_CLASSES;
+        if (s->dtype == MNIST_CACHE_F64) {
+            memcpy(in, raw + sizeof(double) * MNIST_PIXELS * i, sizeof(double) * MNIST_PIXELS);
+        } else if (s->dtype == MNIST_CACHE_F32) {
+            float const *f = (float const *)raw + (size_t)MNIST_PIXELS * i;
+            for (j = 0; j < MNIST_PIXELS; ++j) in[j] = f[j];
+        } else {
+            unsigned char const *u = raw + (size_t)MNIST_PIXELS * i;
+            for (j = 0; j < MNIST_PIXELS; ++j) in[j] = u[j] / 255.0;
+        }
+
+        if (s->onehot) {
+            memcpy(out, raw_labels + sizeof(double) * MNIST_CLASSES * i, sizeof(double) * MNIST_CLASSES);
+        } else {
+            if (raw_labels[i] >= MNIST_CLASSES) return -1;
+            memset(out, 0, sizeof(double) * MNIST_CLASSES);
+            out[raw_labels[i]] = 1.0;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Reads window seq into b, samples shuffled. Returns 0 or -1. */
+static int fill(mnist_stream_reader *r, mnist_stream_buffer *b, unsigned long seq) {
+    mnist_stream *s = r->s;
+    const unsigned long epoch = seq / s->windows;
+
+    shuffle(r->order, s->windows, s->seed * 0x100000001B3ull + epoch);
+    const unsigned int first = r->order[seq % s->windows] * s->window;
+    const unsigned int n = s->count - first < s->window ? s->count - first : s->window;
+
+    shuffle(r->perm, n, (s->seed * 0x100000001B3ull + epoch) ^ ((uint64_t)first << 32));
+    if (read_samples(s, first, n, r->raw, r->raw_labels, r->perm, b->input, b->output) != 0) return -1;
+
+    b->n = n;
+    return 0;
+}
+
+
+static void *reader_main(void *arg) {
+    mnist_stream_reader *r = arg;
+    mnist_stream *s = r->s;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        mnist_stream_buffer *b = &s->buf[s->next_fill % s->buffers];
+        while (!s->stop && b->state != BUF_FREE) {
+            pthread_cond_wait(&s->freed, &s->lock);
+            b = &s->buf[s->next_fill % s->buffers];
+        }
+        if (s->stop) break;
+
+        const unsigned long seq = s->next_fill++;
+        b->state = BUF_FILLING;
+        b->seq = seq;
+        pthread_mutex_unlock(&s->lock);
+
+        const int rc = fill(r, b, seq);
+
+        pthread_mutex_lock(&s->lock);
+        b->state = BUF_READY;
+        if (rc) s->error = 1;
+        pthread_cond_broadcast(&s->filled);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return 0;
+}
+
+
+/* Fills in where the samples are. Returns 0 or -1. */
+static int open_source(mnist_stream *s, const char *images, const char *labels) {
+    if (!labels) {
+        mnist_cache c;
+        if (mnist_cache_open(images, &c) != 0) return -1;
+        s->count = c.count;
+        s->dtype = c.dtype;
+        s->onehot = c.label_type == MNIST_CACHE_ONEHOT;
+        s->image_offset = (char const *)c.images - (char const *)c.map;
+        s->label_offset = (char const *)c.labels - (char const *)c.map;
+        const int ok = c.pixels == MNIST_PIXELS;
+        mnist_cache_close(&c);
+        if (!ok) return -1;
+
+        s->image_fd = open(images, O_RDONLY);
+        s->label_fd = dup(s->image_fd);
+    } else {
+        unsigned char ih[16], lh[8];
+        s->image_fd = open(images, O_RDONLY);
+        s->label_fd = open(labels, O_RDONLY);
+        if (s->image_fd < 0 || s->label_fd < 0) return -1;
+        if (read_at(s->image_fd, ih, sizeof(ih), 0) || read_at(s->label_fd, lh, sizeof(lh), 0)) return -1;
+        if (read_be32(ih) != 2051 || read_be32(lh) != 2049) return -1;
+        if (read_be32(ih + 4) != read_be32(lh + 4)) return -1;
+        if (read_be32(ih + 8) != 28 || read_be32(ih + 12) != 28) return -1;
+
+        s->count = read_be32(ih + 4);
+        s->dtype = MNIST_CACHE_U8;
+        s->onehot = 0;
+        s->image_offset = sizeof(ih);
+        s->label_offset = sizeof(lh);
+    }
+
+    if (s->image_fd < 0 || s->label_fd < 0) return -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(s->image_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return 0;
+}
+
+
+mnist_stream *mnist_stream_open(const char *images, const char *labels, unsigned int batch, unsigned int window, int buffers, int threads, unsigned int seed) {
+    int i;
+
+    if (batch < 1 || buffers < 2 || threads < 1) return 0;
+    if (threads > buffers) threads = buffers;
+
+    mnist_stream *s = calloc(1, sizeof(mnist_stream));
+    if (!s) return 0;
+    s->image_fd = s->label_fd = -1;
+    pthread_mutex_init(&s->lock, 0);
+    pthread_cond_init(&s->filled, 0);
+    pthread_cond_init(&s->freed, 0);
+
+    if (open_source(s, images, labels) != 0 || s->count == 0) {
+        mnist_stream_close(s);
+        return 0;
+    }
+
+    if (window > s->count) window = s->count;
+    s->batch = batch;
+    s->window = (window + batch - 1) / batch * batch;
+    s->windows = (s->count + s->window - 1) / s->window;
+    s->seed = seed;
+    s->current = -1;
+
+    const size_t px = dtype_size(s->dtype);
+    s->buf = calloc(buffers, sizeof(mnist_stream_buffer));
+    s->reader = calloc(threads, sizeof(mnist_stream_reader));
+    if (!s->buf || !s->reader) {
+        mnist_stream_close(s);
+        return 0;
+    }
+    s->buffers = buffers;
+    s->readers = threads;
+    for (i = 0; i < buffers; ++i) {
+        s->buf[i].input = malloc(sizeof(double) * MNIST_PIXELS * s->window);
+        s->buf[i].output = malloc(sizeof(double) * MNIST_CLASSES * s->window);
+        if (!s->buf[i].input || !s->buf[i].output) {
+            mnist_stream_close(s);
+            return 0;
+        }
+    }
+    for (i = 0; i < threads; ++i) {
+        mnist_stream_reader *r = &s->reader[i];
+        r->s = s;
+        r->raw = malloc(px * MNIST_PIXELS * s->window);
+        r->raw_labels = malloc((s->onehot ? sizeof(double) * MNIST_CLASSES : 1) * s->window);
+        r->order = malloc(sizeof(unsigned int) * s->windows);
+        r->perm = malloc(sizeof(unsigned int) * s->window);
+        if (!r->raw || !r->raw_labels || !r->order || !r->perm || pthread_create(&r->thread, 0, reader_main, r) != 0) {
+            mnist_stream_close(s);
+            return 0;
+        }
+        s->threads = i + 1;
+    }
+
+    return s;
+}
+
+
+int mnist_stream_next(mnist_stream *s, double const **input, double const **output) {
+    if (s->current >= 0) {
+        mnist_stream_buffer *b = &s->buf[s->current];
+        if (s->pos >= b->n) {
+            const int last = b->seq % s->windows == s->windows - 1;
+            pthread_mutex_lock(&s->lock);
+            b->state = BUF_FREE;
+            pthread_cond_broadcast(&s->freed);
+            pthread_mutex_unlock(&s->lock);
+            s->current = -1;
+            if (last) return 0;
+        }
+    }
+
+    if (s->current < 0) {
+        mnist_stream_buffer *b = &s->buf[s->next_use % s->buffers];
+        pthread_mutex_lock(&s->lock);
+        if (!s->error && b->state != BUF_READY) {
+            const double t0 = now();
+            while (!s->error && b->state != BUF_READY) pthread_cond_wait(&s->filled, &s->lock);
+            s->waited += now() - t0;
+        }
+        const int error = s->error;
+        if (!error) b->state = BUF_IN_USE;
+        pthread_mutex_unlock(&s->lock);
+        if (error) return -1;
+
+        s->current = s->next_use++ % s->buffers;
+        s->pos = 0;
+    }
+
+    mnist_stream_buffer *b = &s->buf[s->current];
+    const unsigned int n = b->n - s->pos < s->batch ? b->n - s->pos : s->batch;
+    *input = b->input + (size_t)s->pos * MNIST_PIXELS;
+    *output = b->output + (size_t)s->pos * MNIST_CLASSES;
+    s->pos += n;
+    return n;
+}
+
+
+unsigned int mnist_stream_count(mnist_stream const *s) {
+    return s->count;
+}
+
+
+double mnist_stream_wait_time(mnist_stream const *s) {
+    return s->waited;
+}
+
+
+void mnist_stream_close(mnist_stream *s) {
+    int i;
+
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->freed);
+    pthread_mutex_unlock(&s->lock);
+    for (i = 0; i < s->threads; ++i) pthread_join(s->reader[i].thread, 0);
+
+    for (i = 0; s->reader && i < s->readers; ++i) {
+        free(s->reader[i].raw);
+        free(s->reader[i].raw_labels);
+        free(s->reader[i].order);
+        free(s->reader[i].perm);
+    }
+    for (i = 0; s->buf && i < s->buffers; ++i) {
+        free(s->buf[i].input);
+        free(s->buf[i].output);
+    }
+    free(s->reader);
+    free(s->buf);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->filled);
+    pthread_cond_destroy(&s->freed);
+
+    if (s->image_fd >= 0) close(s->image_fd);
+    if (s->label_fd >= 0) close(s->label_fd);
+    free(s);
+}
+
+
+/* Chunk size of the direct reads, in samples. */
+#define MNIST_READ_CHUNK 1024
+
+unsigned int mnist_file_count(const char *images, const char *labels) {
+    mnist_stream s;
+    memset(&s, 0, sizeof(s));
+    s.image_fd = s.label_fd = -1;
+    const int rc = open_source(&s, images, labels);
+    if (s.image_fd >= 0) close(s.image_fd);
+    if (s.label_fd >= 0) close(s.label_fd);
+    return rc == 0 ? s.count : 0;
+}
+
+
+int mnist_read_range(const char *images, const char *labels, unsigned int first, unsigned int n, double *input, double *output) {
+    mnist_stream s;
+    unsigned char *raw = 0, *raw_labels = 0;
+    unsigned int done;
+    int rc = -1;
+
+    memset(&s, 0, sizeof(s));
+    s.image_fd = s.label_fd = -1;
+    if (open_source(&s, images, labels) != 0 || first > s.count || n > s.count - first) goto cleanup;
+
+    raw = malloc(dtype_size(s.dtype) * MNIST_PIXELS * MNIST_READ_CHUNK);
+    raw_labels = malloc((s.onehot ? sizeof(double) * MNIST_CLASSES : 1) * MNIST_READ_CHUNK);
+    if (!raw || !raw_labels) goto cleanup;
+
+    for (done = 0; done < n; done += MNIST_READ_CHUNK) {
+        const unsigned int m = n - done < MNIST_READ_CHUNK ? n - done : MNIST_READ_CHUNK;
+        if (read_samples(&s, first + done, m, raw, raw_labels, 0, input + (size_t)done * MNIST_PIXELS, output + (size_t)done * MNIST_CLASSES) != 0) goto cleanup;
+    }
+    rc = 0;
+
+cleanup:
+    if (s.image_fd >= 0) close(s.image_fd);
+    if (s.label_fd >= 0) close(s.label_fd);
+    free(raw);
+    free(raw_labels);
+    return rc;
+}
+
+
+/* Block b of count samples cut into blocks blocks: [start, start + size). */
+static unsigned int block_start(unsigned int count, unsigned int blocks, unsigned int b) {
+    return (unsigned int)((uint64_t)count * b / blocks);
+}
+
+
+unsigned int mnist_shard_max(unsigned int count, int ranks, int blocks) {
+    const unsigned int total = ranks * blocks;
+    const unsigned int longest = block_start(count, total, 1) + 1;
+    return longest * blocks < count ? longest * blocks : count;
+}
+
+
+int mnist_read_shard(const char *images, const char *labels, unsigned int count, int rank, int ranks, int blocks, unsigned int seed, unsigned int epoch, double *input, double *output) {
+    const unsigned int total = ranks * blocks;
+    unsigned int *order = malloc(sizeof(unsigned int) * total);
+    unsigned int n = 0;
+    int k;
+
+    if (!order) return -1;
+    if (seed) {
+        shuffle(order, total, seed * 0x100000001B3ull + epoch);
+    } else {
+        for (k = 0; k < (int)total; ++k) order[k] = k;
+    }
+
+    for (k = 0; k < blocks; ++k) {
+        const unsigned int b = order[rank * blocks + k];
+        const unsigned int first = block_start(count, total, b);
+        const unsigned int size = block_start(count, total, b + 1) - first;
+        if (mnist_read_range(images, labels, first, size, input + (size_t)n * MNIST_PIXELS, output + (size_t)n * MNIST_CLASSES) != 0) {
+            free(order);
+            return -1;
+        }
+        n += size;
+    }
+
+    free(order);
+    return n;
+}
@@ -0,0 +1,82 @@
+#ifndef __MNIST_STREAM_H__
+#define __MNIST_STREAM_H__
+
+/*
+ * Streaming MNIST reader, for training sets that do not fit in memory.
+ *
+ * The training set is cut into windows of consecutive samples. Background
+ * threads read whole windows with pread, from the IDX files or from a
+ * mnist_convert cache file, widen them to doubles and shuffle the samples
+ * within the window, into a ring of buffers (two by default: one being
+ * trained on while the next is read). Windows are visited in a new random
+ * order every epoch. Memory is buffers * window samples, whatever the size
+ * of the files.
+ *
+ *     mnist_stream *s = mnist_stream_open("train-images-idx3-ubyte", "train-labels-idx1-ubyte", 16, 4096, 2, 1, 42);
+ *     while ((n = mnist_stream_next(s, &input, &class)) > 0)
+ *         genann_train_batch_omp(ann, input, class, .1, 28*28, 10, n, n);
+ *
+ * Readers run ahead into the next epoch, so epochs follow each other with
+ * no refill stall.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mnist_stream mnist_stream;
+
+/* Opens the IDX pair images/labels, or the cache file images if labels is
+ * NULL, and starts the readers. window is rounded up to a multiple of batch.
+ * Returns 0 if the files are missing or malformed or on allocation failure. */
+mnist_stream *mnist_stream_open(const char *images, const char *labels, unsigned int batch, unsigned int window, int buffers, int threads, unsigned int seed);
+
+/* Points input and output at the next batch (28*28 and 10 doubles per
+ * sample) and returns its size. The pointers stay valid until the next call.
+ * Returns 0 once at the end of each epoch; the call after that starts the
+ * next epoch. Returns -1 if a read failed. Only one thread may consume. */
+int mnist_stream_next(mnist_stream *s, double const **input, double const **output);
+
+/* Number of samples per epoch. */
+unsigned int mnist_stream_count(mnist_stream const *s);
+
+/* Seconds mnist_stream_next has spent waiting for the readers so far. Close
+ * to zero when the readers keep up with training. */
+double mnist_stream_wait_time(mnist_stream const *s);
+
+/* Stops the readers and frees the buffers. */
+void mnist_stream_close(mnist_stream *s);
+
+
+
+/*
+ * Direct reads, for distributed training where every rank reads its own
+ * part of the files instead of receiving it from one reader.
+ *
+ * mnist_read_shard cuts the samples into ranks * blocks blocks of nearly
+ * equal size and deals blocks out to the ranks: block rank*blocks + k goes to
+ * rank, or, with a non-zero seed, the same position of a permutation of the
+ * blocks that every rank computes from seed and epoch. So all ranks agree on
+ * a new assignment each epoch without exchanging anything.
+ */
+
+/* Number of samples in the IDX pair, or in the cache file images if labels
+ * is NULL. 0 if missing or malformed. */
+unsigned int mnist_file_count(const char *images, const char *labels);
+
+/* Reads samples [first, first + n) into input and output (28*28 and 10
+ * doubles per sample) with pread. Returns 0 or -1. */
+int mnist_read_range(const char *images, const char *labels, unsigned int first, unsigned int n, double *input, double *output);
+
+/* Largest shard mnist_read_shard can return, in samples. */
+unsigned int mnist_shard_max(unsigned int count, int ranks, int blocks);
+
+/* Reads rank's shard of the count samples for the given epoch into input and
+ * output, which hold mnist_shard_max samples. Returns its size, or -1. */
+int mnist_read_shard(const char *images, const char *labels, unsigned int count, int rank, int ranks, int blocks, unsigned int seed, unsigned int epoch, double *input, double *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MNIST_STREAM_H__ */
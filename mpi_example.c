@@ -6,11 +6,15 @@
 #include <string.h>
 #include <math.h>
 #include "genann.h"
+#include "mnist_cache.h"
+#include "mnist_stream.h"
+#include "genann_mpi.h"
 #include <time.h>
 #include <mpi.h>
 
 double *input, *class;
 unsigned int samples;
+mnist_cache cache; /* set when the data came from a pre-converted cache file */
 const char *class_names[] = {"0","1","2","3","4","5","6","7","8","9"};
 
 
@@ -19,6 +23,18 @@ void load_mnist(char *images_fname, char *labels_fname)
     mnist_data *data_t, *temp;
     unsigned int cnt;
     int ret;
+    char cache_fname[256];
+
+    /* A cache written by mnist_convert next to the images is mapped instead. */
+    snprintf(cache_fname, sizeof(cache_fname), "%s.cache", images_fname);
+    if (mnist_cache_open(cache_fname, &cache) == 0) {
+        if (mnist_cache_doubles(&cache, &input, &class) == 0) {
+            samples = cache.count;
+            printf("image count: %d (cached)\n", samples);
+            return;
+        }
+        mnist_cache_close(&cache);
+    }
     
     if (ret = mnist_load(images_fname, labels_fname, &data_t, &cnt)) {
         printf("An error occured: %d\n", ret);
@@ -61,11 +77,28 @@ void load_mnist(char *images_fname, char *labels_fname)
     free(data_t);
 }
 
+void unload_mnist(void)
+{
+    if (cache.map) {
+        mnist_cache_close(&cache);
+    } else {
+        free(input);
+        free(class);
+    }
+    input = class = NULL;
+}
+
 int correct_predictions(genann *ann) {
     int correct = 0, j =0;
+    double *guesses = (double *) malloc(sizeof(double) * samples * 10);
+    if (guesses == NULL || genann_run_batch(ann, input, samples, guesses))
+    {
+        printf("guesses malloc error");
+        exit(-1);
+    }
     for (j = 0; j < samples; ++j) 
     {
-        const double *guess = genann_run(ann, input + j*28*28);
+        const double *guess = guesses + j*10;
         double max = 0.0;
         int k =0, actual =0, max_cls = 0;
         for (k =0; k < 10; k++)
@@ -80,6 +113,7 @@ int correct_predictions(genann *ann) {
         if (class[j*10 + (int)max_cls] == 1.0) ++correct;
         //else {printf("Logic error.\n"); exit(1);
     }
+    free(guesses);
     return correct;
 }
 
@@ -97,6 +131,34 @@ void genann_randomize(genann *ann) {
 */
 
 
+/* The per-layer gradient all-reduces of one training step. */
+typedef struct layer_exchange {
+    MPI_Request *req;
+    int posted;
+    double first_post;          /* when the first layer went out */
+    double done_at;             /* when all were first seen complete, or 0 */
+} layer_exchange;
+
+/* Checks the posted all-reduces. MPI libraries often only move nonblocking
+ * collectives along inside MPI calls, so this also keeps them going. */
+static void poll_layers(layer_exchange *x)
+{
+    int flag;
+    MPI_Testall(x->posted, x->req, &flag, MPI_STATUSES_IGNORE);
+    if (flag && x->done_at == 0) x->done_at = MPI_Wtime();
+}
+
+/* genann_layer_done callback: one layer's gradient is final, send it. */
+static void post_layer(int layer, double *grad, int n, void *user)
+{
+    layer_exchange *x = user;
+    if (x->posted == 0) x->first_post = MPI_Wtime();
+    else poll_layers(x);
+    x->done_at = 0;
+    MPI_Iallreduce(MPI_IN_PLACE, grad, n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, &x->req[x->posted++]);
+}
+
+
 int main(int argc, char *argv[])
 {
 //    printf("GENANN example 4.\n");
@@ -109,41 +171,37 @@ int main(int argc, char *argv[])
     int rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-    if (rank == 0)
-    {
-      load_mnist("mnist/train-images-idx3-ubyte","mnist/train-labels-idx1-ubyte");
+    /* Every rank reads its own shard straight from the files (the cache
+     * file if mnist_convert made one), so nothing goes through rank 0. With
+     * reshuffle set, the blocks are dealt out again every epoch. */
+    int reshuffle = argc > 3 ? atoi(argv[3]) : 0;
+    const char *images = "mnist/train-images-idx3-ubyte.cache", *labels = NULL;
+    const int blocks = 8;
+    samples = mnist_file_count(images, labels);
+    if (samples == 0) {
+        images = "mnist/train-images-idx3-ubyte";
+        labels = "mnist/train-labels-idx1-ubyte";
+        samples = mnist_file_count(images, labels);
+    }
+    if (samples == 0) {
+        printf("An error occured opening %s\n", images);
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
-      /* Initialize time elements */
-      double ts, te;     
-      ts = MPI_Wtime();
-      MPI_Bcast(&samples, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-    
-
-
-    /* scatter data to all the other nodes */
 
-    int *count, *disp, *count_c, *disp_c,sum =0, sum_c = 0;
-    count =(int *)  malloc(sizeof(int)*w_size); //to define limits of transfer total floats
-    disp = (int *) malloc(sizeof(int)*w_size);
-    count_c = (int *)  malloc(sizeof(int)*w_size);
-    disp_c = (int *) malloc(sizeof(int)*w_size); 
+    /* Initialize time elements */
+    double ts, te;
+    ts = MPI_Wtime();
 
-    int s_size= samples/w_size;
-    if (rank < samples%w_size) s_size++;
-    
-    for (int i = 0; i < w_size; i++) { //find the number of elems to send to each processor
-        count[i] = samples/w_size*28*28;
-        count_c[i] = samples/w_size*10;
-        if (i < samples%w_size) {  count[i] += 28*28; count_c[i] +=10;  }
-        disp[i] = sum; disp_c[i] = sum_c;
-        sum += count[i]; sum_c +=count_c[i];
-    }  
+    const unsigned int shard_max = mnist_shard_max(samples, w_size, blocks);
     double *s_data, *s_class;
-    s_data = (double *) malloc(sizeof(double) * count[rank]);
-    s_class = (double *) malloc(sizeof(double) * count_c[rank]);
-
-    MPI_Scatterv(input,count, disp, MPI_DOUBLE,s_data,count[rank],MPI_DOUBLE,0,MPI_COMM_WORLD);
-    MPI_Scatterv(class,count_c, disp_c, MPI_DOUBLE,s_class,count_c[rank],MPI_DOUBLE,0,MPI_COMM_WORLD);
+    s_data = (double *) malloc(sizeof(double) * shard_max * 28*28);
+    s_class = (double *) malloc(sizeof(double) * shard_max * 10);
+    int s_size = s_data && s_class ? mnist_read_shard(images, labels, samples, rank, w_size, blocks, reshuffle ? 42 : 0, 0, s_data, s_class) : -1;
+    if (s_size < 0) {
+        printf("An error occured reading the shard of rank %d\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (rank == 0) printf("image count: %d, read by %d ranks\n", samples, w_size);
 //    printf(" rank %d, cls[20]  =%f, %f, %f, %f, %f, %f, %f, %f, %f, %f \n",rank,s_class[20],s_class[21],s_class[22],s_class[23],s_class[24],s_class[25],s_class[26],s_class[27],s_class[28],s_class[29]);
     /* 28*28 inputs.
      * 3 hidden layer(s) of 10 neurons.
@@ -154,18 +212,112 @@ int main(int argc, char *argv[])
 
     int i, j;
     int loops = 20;
+    /* Samples per rank per step for gradient all-reduce; 0 runs the old
+     * train-locally-then-average-weights loop. */
+    int batch = argc > 1 ? atoi(argv[1]) : 16;
+    /* Batches of gradient to accumulate between all-reduces. */
+    int every = argc > 2 ? atoi(argv[2]) : 1;
+    if (every < 1) every = 1;
+    /* Gradient compression: none, fp16, bf16, int8 or topk[:fraction], see
+     * genann_compress.h. Compressed exchanges go out after the whole
+     * backward pass rather than per layer. */
+    double ratio = 0.01;
+    int compress = argc > 4 ? genann_compress_parse(argv[4], &ratio) : GENANN_COMPRESS_NONE;
+    if (compress < 0) {
+        if (rank == 0) printf("unknown compression %s\n", argv[4]);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    /* Learning rate on the mean gradient of a step: the all-reduced sum
+     * covers batch * every samples on each of the ranks, so it is divided
+     * by that many, and the update size does not depend on the batch or
+     * the number of ranks. */
+    double rate = argc > 5 ? atof(argv[5]) : 2;
 
     /* Train the network with backpropagation. */
 //    printf("Training for %d loops over data by rank %d\n", loops, rank);
-    for (i = 0; i < loops; ++i) {
+    if (batch > 0) {
+        /* Synchronous data parallel. Each rank computes the gradient of its
+         * slice of a step, the sums are all-reduced, and every rank applies
+         * the same update, so all ranks hold the same model and N ranks train
+         * it like one batch N times larger. Each layer's gradient is sent with
+         * MPI_Iallreduce as soon as genann_backprop_layers finishes it, output
+         * layer first, so it travels while the earlier layers are computed.
+         * Every rank runs the same number of steps even when the shards
+         * differ by one sample. */
+        const int step = batch * every;
+        const int per_rank = shard_max;
+        const int steps = (per_rank + step - 1) / step;
+        double *grad = (double *) malloc(sizeof(double) * ann->total_weights);
+        layer_exchange x;
+        x.req = (MPI_Request *) malloc(sizeof(MPI_Request) * (ann->hidden_layers + 1));
+        genann_compressor zc;
+        void *msgs = NULL;
+        if (genann_compress_init(&zc, compress, ann->total_weights, ratio) == 0) {
+            msgs = malloc(genann_compress_size(&zc) * w_size);
+        }
+        if (grad == NULL || x.req == NULL || msgs == NULL)
+        {
+            printf("grad malloc error");
+            exit(-1);
+        }
+        if (rank == 0) printf("gradient all-reduce, %d samples per rank per batch, every %d batches, %s, %.0f bytes sent per rank per step\n",
+                              batch, every, genann_compress_name(compress), genann_allreduce_bytes(&zc, w_size));
+
+        for (i = 0; i < loops; ++i) {
+            double compute = 0, comm = 0, exposed = 0;
+            int s;
+            if (reshuffle && i > 0) {
+                s_size = mnist_read_shard(images, labels, samples, rank, w_size, blocks, 42, i, s_data, s_class);
+                if (s_size < 0) MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            for (s = 0; s < steps; ++s) {
+                const int first = s * step < s_size ? s * step : s_size;
+                const int end = (s + 1) * step < s_size ? (s + 1) * step : s_size;
+                double t0 = MPI_Wtime();
+                x.posted = 0;
+                x.done_at = 0;
+                memset(grad, 0, sizeof(double) * ann->total_weights);
+                if (genann_backprop_layers(ann, s_data + first*28*28, s_class + first*10, end - first, grad,
+                                           compress == GENANN_COMPRESS_NONE ? post_layer : NULL, &x))
+                {
+                    printf("backprop malloc error");
+                    exit(-1);
+                }
+                double t1 = MPI_Wtime();
+                if (compress == GENANN_COMPRESS_NONE) {
+                    poll_layers(&x);
+                    MPI_Waitall(x.posted, x.req, MPI_STATUSES_IGNORE);
+                } else {
+                    x.first_post = t1;
+                    genann_allreduce_compressed(&zc, grad, msgs, MPI_COMM_WORLD);
+                }
+                double t2 = MPI_Wtime();
+                if (x.done_at == 0) x.done_at = t2;
+                genann_apply(ann, grad, rate / ((double)step * w_size));
+
+                compute += t1 - t0;
+                comm += x.done_at - x.first_post;
+                exposed += t2 - t1;
+            }
+            if (rank == 0) printf("epoch %d: compute %f s, all-reduce %f s, exposed %f s, %.0f%% hidden\n",
+                                  i, compute, comm, exposed, comm > 0 ? 100.0 * (comm - exposed) / comm : 0.0);
+        }
+        free(grad);
+        free(x.req);
+        free(msgs);
+        genann_compress_free(&zc);
+    }
+    else for (i = 0; i < loops; ++i) {
+        if (reshuffle && i > 0) {
+            s_size = mnist_read_shard(images, labels, samples, rank, w_size, blocks, 42, i, s_data, s_class);
+            if (s_size < 0) MPI_Abort(MPI_COMM_WORLD, 1);
+        }
         for (j = 0; j < s_size; ++j) {
             genann_train(ann, s_data + j*28*28,s_class + j*10, .1);
         }
 //        printf("before reduce rank %d, ann->weight[20] : %f \n",rank,ann->weight[20]);
-        MPI_Barrier(MPI_COMM_WORLD);
         MPI_Allreduce(MPI_IN_PLACE,ann->weight,ann->total_weights,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
         for (j=0;j<ann->total_weights;j++) { ann->weight[j] = ann->weight[j]/w_size; }
-        MPI_Barrier(MPI_COMM_WORLD);
 //        printf("after reduce rank %d, ann->weight[20] : %f \n",rank,ann->weight[20]);
     }
     
@@ -173,9 +325,6 @@ int main(int argc, char *argv[])
     double cpu_time_used = (double) (te - ts);
     if (rank == 0) { printf("train time taken : %f \n",cpu_time_used);}
 
-    free(input);
-    free(class);
-    
     if (rank == 0)
     {
     /* Load data from file to test */
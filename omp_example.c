@@ -6,10 +6,13 @@
 #include <string.h>
 #include <math.h>
 #include "genann.h"
+#include "mnist_cache.h"
+#include "mnist_stream.h"
 #include <time.h>
 #include<omp.h>
 double *input, *class;
 unsigned int samples;
+mnist_cache cache; /* set when the data came from a pre-converted cache file */
 const char *class_names[] = {"0","1","2","3","4","5","6","7","8","9"};
 
 
@@ -18,6 +21,18 @@ void load_mnist(char *images_fname, char *labels_fname)
     mnist_data *data_t, *temp;
     unsigned int cnt;
     int ret;
+    char cache_fname[256];
+
+    /* A cache written by mnist_convert next to the images is mapped instead. */
+    snprintf(cache_fname, sizeof(cache_fname), "%s.cache", images_fname);
+    if (mnist_cache_open(cache_fname, &cache) == 0) {
+        if (cache.pixels == 28*28 && mnist_cache_doubles(&cache, &input, &class) == 0) {
+            samples = cache.count;
+            printf("image count: %d (cached)\n", samples);
+            return;
+        }
+        mnist_cache_close(&cache);
+    }
     
     if (ret = mnist_load(images_fname, labels_fname, &data_t, &cnt)) {
         printf("An error occured: %d\n", ret);
@@ -60,10 +75,27 @@ void load_mnist(char *images_fname, char *labels_fname)
     free(data_t);
 }
 
+void unload_mnist(void)
+{
+    if (cache.map) {
+        mnist_cache_close(&cache);
+    } else {
+        free(input);
+        free(class);
+    }
+    input = class = NULL;
+}
+
 int correct_predictions(genann *ann) {
     int correct = 0, j =0;
+    double *guesses = (double *) malloc(sizeof(double) * samples * 10);
+    if (guesses == NULL || genann_run_batch(ann, input, samples, guesses))
+    {
+        printf("guesses malloc error");
+        exit(-1);
+    }
     for (j = 0; j < samples; ++j) {
-        const double *guess = genann_run(ann, input + j*28*28);
+        const double *guess = guesses + j*10;
         double max = 0.0, max_cls = 0;
         int k =0, actual =0;
         for (k =0; k < 10; k++)
@@ -78,6 +110,7 @@ int correct_predictions(genann *ann) {
         if (class[j*10 + (int)max_cls] == 1.0) ++correct;
         //else {printf("Logic error.\n"); exit(1);
     }
+    free(guesses);
     return correct;
 }
 
@@ -87,8 +120,30 @@ int main(int argc, char *argv[])
     printf("GENANN example 4.\n");
     printf("Train an ANN on the MNIST dataset using backpropagation.\n");
 
+    /* Samples per weight update; 0 runs the old shared-scratch genann_train_omp
+     * and a negative value the lock-free genann_train_hogwild_omp. The
+     * default is mini-batch training, which does not lose accuracy as
+     * threads are added; pass 0 for the original behaviour. */
+    int batch = argc > 1 ? atoi(argv[1]) : 16;
+    /* Training window in samples when streaming the training set from disk
+     * (see mnist_stream.h); 0 loads it all into memory first. */
+    int window = argc > 2 ? atoi(argv[2]) : 0;
+    mnist_stream *stream = NULL;
+
     /* Load the data from file to train */
-    load_mnist("mnist/train-images-idx3-ubyte","mnist/train-labels-idx1-ubyte");
+    if (window > 0) {
+        /* genann_train_omp takes one stream batch at a time instead. */
+        const unsigned int chunk = batch > 0 ? batch : 256;
+        stream = mnist_stream_open("mnist/train-images-idx3-ubyte.cache", NULL, chunk, window, 2, 1, 42);
+        if (!stream) stream = mnist_stream_open("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte", chunk, window, 2, 1, 42);
+        if (!stream) {
+            printf("An error occured opening the training stream\n");
+            exit(-1);
+        }
+        printf("streaming %d images, window %d\n", mnist_stream_count(stream), window);
+    } else {
+        load_mnist("mnist/train-images-idx3-ubyte","mnist/train-labels-idx1-ubyte");
+    }
     printf("load done\n");
     
     /* Initialize time elements */
@@ -101,25 +156,52 @@ int main(int argc, char *argv[])
      * 3 hidden layer(s) of 5 neurons.
      * 10 outputs (1 per class)
      */
-    genann *ann = genann_init(28*28, 3, 10, 10);
+    /* Hogwild writes the weights from every thread: padded rows keep
+     * different neurons on different cache lines. */
+    genann *ann = batch < 0 ? genann_init_padded(28*28, 3, 10, 10) : genann_init(28*28, 3, 10, 10);
 
     int i, j;
     int loops = 40;
 
     /* Train the network with backpropagation. */
-    printf("Training for %d loops over data.\n", loops);
+    printf("Training for %d loops over data, batch %d.\n", loops, batch);
     for (i = 0; i < loops; ++i) {
+        if (stream) {
+            double const *in, *cls;
+            int n;
+            while ((n = mnist_stream_next(stream, &in, &cls)) > 0) {
+                if (batch > 0) {
+                    genann_train_batch_omp(ann, in, cls, .1, 28*28, 10, n, batch);
+                } else if (batch < 0) {
+                    genann_train_hogwild_omp(ann, in, cls, .1, 28*28, 10, n);
+                } else {
+                    genann_train_omp(ann, in, cls, .1, 28*28, 10, n);
+                }
+            }
+            if (n < 0) {
+                printf("An error occured reading the training stream\n");
+                exit(-1);
+            }
+        } else if (batch > 0) {
+            genann_train_batch_omp(ann, input, class, .1, 28*28, 10, samples, batch);
+        } else if (batch < 0) {
+            genann_train_hogwild_omp(ann, input, class, .1, 28*28, 10, samples);
+        } else {
             genann_train_omp(ann, input, class, .1, 28*28, 10,samples);
         }
+    }
     double time = omp_get_wtime() - start_time;
 //    end = clock();
 //    cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
 //    printf("train time taken time.h: %f \n",cpu_time_used);
     printf("train time omp : %f\n",time);
+    if (stream) {
+        printf("waited for data : %f\n", mnist_stream_wait_time(stream));
+        mnist_stream_close(stream);
+    }
   
     /* Load data from file to test */
-    free(input);
-    free(class);
+    unload_mnist();
     load_mnist("mnist/t10k-images-idx3-ubyte","mnist/t10k-labels-idx1-ubyte");
     
     /* find accuracy */
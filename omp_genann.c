@@ -25,9 +25,18 @@
  *   1. Removed dependency on previous iteration from loop
  *   2. Added omp parallelism
  *   3. Changed design of genann_train()
+ *   4. Only the OpenMP training paths live here; link with genann.c.
+ *   5. Added genann_train_batch_omp() with per-thread scratch.
+ *   6. Added genann_gradient_omp() for the hybrid MPI trainer.
+ *   7. Added genann_train_hogwild_omp(), lock-free with private scratch,
+ *      in place on the network's own (ideally padded) rows.
+ *   8. Added genann_train_numa_omp(), Hogwild on per-node data and weights.
+ *   9. Scratch comes from genann_heap_alloc, or from an arena with
+ *      genann_train_batch_arena_omp().
  */
 
 #include "genann.h"
+#include "genann_numa.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -37,206 +46,18 @@
 #include <string.h>
 #include <omp.h>
 
-#define LOOKUP_SIZE 4096
-
-double genann_act_sigmoid(double a) {
-    if (a < -45.0) return 0;
-    if (a > 45.0) return 1;
-    return 1.0 / (1 + exp(-a));
-}
-
-
-double genann_act_sigmoid_cached(double a) {
-    /* If you're optimizing for memory usage, just
-     * delete this entire function and replace references
-     * of genann_act_sigmoid_cached to genann_act_sigmoid
-     */
-    const double min = -15.0;
-    const double max = 15.0;
-    static double interval;
-    static int initialized = 0;
-    static double lookup[LOOKUP_SIZE];
-    
-    /* Calculate entire lookup table on first run. */
-    if (!initialized) {
-        interval = (max - min) / LOOKUP_SIZE;
-        int i;
-        for (i = 0; i < LOOKUP_SIZE; ++i) {
-            lookup[i] = genann_act_sigmoid(min + interval * i);
-        }
-        /* This is down here to make this thread safe. */
-        initialized = 1;
-    }
-    
-    int i;
-    i = (int)((a-min)/interval+0.5);
-    if (i <= 0) return lookup[0];
-    if (i >= LOOKUP_SIZE) return lookup[LOOKUP_SIZE-1];
-    return lookup[i];
-}
-
-
-double genann_act_threshold(double a) {
-    return a > 0;
-}
-
-
-double genann_act_linear(double a) {
-    return a;
-}
-
-
-genann *genann_init(int inputs, int hidden_layers, int hidden, int outputs) {
-    if (hidden_layers < 0) return 0;
-    if (inputs < 1) return 0;
-    if (outputs < 1) return 0;
-    if (hidden_layers > 0 && hidden < 1) return 0;
-    
-    
-    const int hidden_weights = hidden_layers ? (inputs+1) * hidden + (hidden_layers-1) * (hidden+1) * hidden : 0;
-    const int output_weights = (hidden_layers ? (hidden+1) : (inputs+1)) * outputs;
-    const int total_weights = (hidden_weights + output_weights);
-    
-    const int total_neurons = (inputs + hidden * hidden_layers + outputs);
-    
-    /* Allocate extra size for weights, outputs, and deltas. */
-    const int size = sizeof(genann) + sizeof(double) * (total_weights + total_neurons + (total_neurons - inputs));
-    genann *ret = malloc(size);
-    if (!ret) return 0;
-    
-    ret->inputs = inputs;
-    ret->hidden_layers = hidden_layers;
-    ret->hidden = hidden;
-    ret->outputs = outputs;
-    
-    ret->total_weights = total_weights;
-    ret->total_neurons = total_neurons;
-    
-    /* Set pointers. */
-    ret->weight = (double*)((char*)ret + sizeof(genann));
-    ret->output = ret->weight + ret->total_weights;
-    ret->delta = ret->output + ret->total_neurons;
-    
-    genann_randomize(ret);
-    
-    ret->activation_hidden = genann_act_sigmoid_cached;
-    ret->activation_output = genann_act_sigmoid_cached;
-    
-    return ret;
-}
-
-
-genann *genann_read(FILE *in) {
-    int inputs, hidden_layers, hidden, outputs;
-    int rc;
-    
-    errno = 0;
-    rc = fscanf(in, "%d %d %d %d", &inputs, &hidden_layers, &hidden, &outputs);
-    if (rc < 4 || errno != 0) {
-        perror("fscanf");
-        return NULL;
-    }
-    
-    genann *ann = genann_init(inputs, hidden_layers, hidden, outputs);
-    
-    int i;
-    for (i = 0; i < ann->total_weights; ++i) {
-        errno = 0;
-        rc = fscanf(in, " %le", ann->weight + i);
-        if (rc < 1 || errno != 0) {
-            perror("fscanf");
-            genann_free(ann);
-            
-            return NULL;
-        }
-    }
-    
-    return ann;
-}
-
-
-genann *genann_copy(genann const *ann) {
-    const int size = sizeof(genann) + sizeof(double) * (ann->total_weights + ann->total_neurons + (ann->total_neurons - ann->inputs));
-    genann *ret = malloc(size);
-    if (!ret) return 0;
-    
-    memcpy(ret, ann, size);
-    
-    /* Set pointers. */
-    ret->weight = (double*)((char*)ret + sizeof(genann));
-    ret->output = ret->weight + ret->total_weights;
-    ret->delta = ret->output + ret->total_neurons;
-    
-    return ret;
-}
-
-
-void genann_randomize(genann *ann) {
-    int i;
-    for (i = 0; i < ann->total_weights; ++i) {
-        double r = GENANN_RANDOM();
-        /* Sets weights from -0.5 to 0.5. */
-        ann->weight[i] = r - 0.5;
-    }
-}
-
-
-void genann_free(genann *ann) {
-    /* The weight, output, and delta pointers go to the same buffer. */
-    free(ann);
-}
 
+void genann_train_omp(genann const *ann, double const *input, double const *desired_output, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count) {
+    int I = 0;
 
-double const *genann_run(genann const *ann, double const *inputs) {
-    double const *w = ann->weight;
-    double *o = ann->output + ann->inputs;
-    double const *i = ann->output;
-    
-    /* Copy the inputs to the scratch area, where we also store each neuron's
-     * output, for consistency. This way the first layer isn't a special case. */
-    memcpy(ann->output, inputs, sizeof(double) * ann->inputs);
-    
-    int h, j, k;
-    
-    const genann_actfun act = ann->activation_hidden;
-    const genann_actfun acto = ann->activation_output;
-    //printf("ann->hidden_layers : %f; ann->hidden : %f \n",ann->hidden_layers, ann->hidden);
-    /* Figure hidden layers, if any. */
-    for (h = 0; h < ann->hidden_layers; ++h) {
-        for (j = 0; j < ann->hidden; ++j) {
-            double sum = *w++ * -1.0;
-            //printf("sum : %f",sum);
-            for (k = 0; k < (h == 0 ? ann->inputs : ann->hidden); ++k) {
-                sum += *w++ * i[k];
-            }
-            *o++ = act(sum);
+    /* The offsets below are genann_init's; other layouts train serially. */
+    if (!genann_is_uniform(ann)) {
+        for (I = 0; I < count; I++) {
+            genann_train(ann, input + (size_t)I*size_i, desired_output + (size_t)I*size_c, learning_rate);
         }
-        
-        
-        i += (h == 0 ? ann->inputs : ann->hidden);
+        return;
     }
-    
-    double const *ret = o;
-    
-    /* Figure output layer. */
-    for (j = 0; j < ann->outputs; ++j) {
-        double sum = *w++ * -1.0;
-        for (k = 0; k < (ann->hidden_layers ? ann->hidden : ann->inputs); ++k) {
-            sum += *w++ * i[k];
-        }
-        *o++ = acto(sum);
-    }
-    
-    /* Sanity check that we used all weights and wrote all outputs. */
-    assert(w - ann->weight == ann->total_weights);
-    assert(o - ann->output == ann->total_neurons);
-    
-    return ret;
-}
 
-
-void genann_train_omp(genann const *ann, double const *input, double const *desired_output, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count) {
-    int I = 0;
 #pragma omp parallel
     {
 #pragma omp for
@@ -431,15 +252,272 @@ void genann_train_omp(genann const *ann, double const *input, double const *desi
     } //end of parallel
 }
 
+/* Per-thread scratch for the mini-batch paths: forward outputs, deltas and
+ * the gradient sum, each rounded up to a 64-byte line so threads never share one. */
+#define GENANN_LINE_DOUBLES 8
+#define GENANN_PAD(n) (((n) + GENANN_LINE_DOUBLES - 1) / GENANN_LINE_DOUBLES * GENANN_LINE_DOUBLES)
+
+typedef struct genann_omp_scratch {
+    double *base;
+    size_t n_output, n_delta, per_thread;
+    genann_arena *arena;        /* base was carved from it, else from the heap */
+    size_t mark;
+} genann_omp_scratch;
+
+static int genann_omp_scratch_alloc(genann const *ann, genann_omp_scratch *sc, int threads, genann_arena *arena) {
+    sc->n_output = GENANN_PAD(ann->total_neurons);
+    sc->n_delta = GENANN_PAD(ann->total_neurons - ann->inputs);
+    sc->per_thread = sc->n_output + sc->n_delta + GENANN_PAD(ann->total_weights);
+    sc->arena = arena;
+    sc->mark = arena ? genann_arena_mark(arena) : 0;
+    sc->base = arena ? genann_arena_alloc(arena, sizeof(double) * sc->per_thread * threads)
+                     : genann_heap_alloc(64, sizeof(double) * sc->per_thread * threads);
+    if (!sc->base) {
+        fprintf(stderr, "genann: no memory for %d threads' scratch\n", threads);
+        return -1;
+    }
+    return 0;
+}
+
+static void genann_omp_scratch_free(genann_omp_scratch *sc) {
+    if (sc->arena) genann_arena_reset(sc->arena, sc->mark);
+    else free(sc->base);
+}
+
+/* Gradient of samples [start, end) into thread 0's gradient. Called by every
+ * thread of a parallel region. */
+static void genann_omp_batch_grad(genann const *ann, genann_omp_scratch const *sc, double const *input, double const *desired_output, unsigned int size_i, unsigned int size_c, unsigned int start, unsigned int end) {
+    const int t = omp_get_thread_num();
+    const int nt = omp_get_num_threads();
+    double *output = sc->base + sc->per_thread * t;
+    double *delta = output + sc->n_output;
+    double *grad = delta + sc->n_delta;
+    const size_t g0 = sc->n_output + sc->n_delta;
+    unsigned int s;
+    int stride, i, u;
+
+    memset(grad, 0, sizeof(double) * ann->total_weights);
+
+    /* Static schedule: thread t always gets the same slice of a batch,
+     * so the reduction below adds the same numbers in the same order. */
+#pragma omp for schedule(static)
+    for (s = start; s < end; ++s) {
+        genann_backprop(ann, output, delta, input + (size_t)s * size_i, desired_output + (size_t)s * size_c, grad);
+    }
+
+    /* Pairwise tree reduction into thread 0's gradient, split over weights. */
+    for (stride = 1; stride < nt; stride *= 2) {
+#pragma omp for schedule(static)
+        for (i = 0; i < ann->total_weights; ++i) {
+            for (u = 0; u + stride < nt; u += 2 * stride) {
+                sc->base[sc->per_thread * u + g0 + i] += sc->base[sc->per_thread * (u + stride) + g0 + i];
+            }
+        }
+    }
+}
+
+
+void genann_train_batch_omp(genann *ann, double const *input, double const *desired_output, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count, unsigned int batch) {
+    genann_train_batch_arena_omp(ann, input, desired_output, learning_rate, size_i, size_c, count, batch, 0);
+}
+
+
+void genann_train_batch_arena_omp(genann *ann, double const *input, double const *desired_output, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count, unsigned int batch, genann_arena *arena) {
+    if (batch < 1) batch = 1;
+
+    const int threads = omp_get_max_threads();
+    genann_omp_scratch sc;
+    if (genann_omp_scratch_alloc(ann, &sc, threads, arena)) return;
+    double const *sum = sc.base + sc.n_output + sc.n_delta;
+
+#pragma omp parallel num_threads(threads)
+    {
+        unsigned int start;
+        int i;
+
+        /* Touch our own scratch first so it lands near this thread. */
+        memset(sc.base + sc.per_thread * omp_get_thread_num(), 0, sizeof(double) * sc.per_thread);
+
+        for (start = 0; start < count; start += batch) {
+            const unsigned int end = start + batch < count ? start + batch : count;
+
+            genann_omp_batch_grad(ann, &sc, input, desired_output, size_i, size_c, start, end);
+
+            /* One update for the whole batch. */
+#pragma omp for schedule(static)
+            for (i = 0; i < ann->total_weights; ++i) {
+                ann->weight[i] += learning_rate * sum[i];
+            }
+        }
+    }
+
+    genann_omp_scratch_free(&sc);
+}
+
+
+int genann_gradient_omp(genann const *ann, double const *input, double const *desired_output, unsigned int size_i, unsigned int size_c, unsigned int count, double *grad) {
+    const int threads = omp_get_max_threads();
+    genann_omp_scratch sc;
+    if (genann_omp_scratch_alloc(ann, &sc, threads, 0)) return -1;
+    double const *sum = sc.base + sc.n_output + sc.n_delta;
+
+#pragma omp parallel num_threads(threads)
+    {
+        int i;
+
+        memset(sc.base + sc.per_thread * omp_get_thread_num(), 0, sizeof(double) * sc.per_thread);
+        genann_omp_batch_grad(ann, &sc, input, desired_output, size_i, size_c, 0, count);
+
+#pragma omp for schedule(static)
+        for (i = 0; i < ann->total_weights; ++i) {
+            grad[i] += sum[i];
+        }
+    }
+
+    genann_omp_scratch_free(&sc);
+    return 0;
+}
+
+
+void genann_train_hogwild_omp(genann *ann, double const *input, double const *desired_output, double learning_rate, unsigned int size_i, unsigned int size_c, unsigned int count) {
+    const int threads = omp_get_max_threads();
+    const size_t n_output = GENANN_PAD(ann->total_neurons);
+    const size_t per_thread = n_output + GENANN_PAD(ann->total_neurons - ann->inputs);
+    double *scratch = genann_heap_alloc(64, sizeof(double) * per_thread * threads);
+    if (!scratch) {
+        perror("aligned_alloc");
+        return;
+    }
+
+    /* Straight on ann's weights: its layout decides which rows share lines. */
+#pragma omp parallel num_threads(threads)
+    {
+        double *output = scratch + per_thread * omp_get_thread_num();
+        double *delta = output + n_output;
+        unsigned int s;
 
-void genann_write(genann const *ann, FILE *out) {
-    fprintf(out, "%d %d %d %d", ann->inputs, ann->hidden_layers, ann->hidden, ann->outputs);
-    
-    int i;
-    for (i = 0; i < ann->total_weights; ++i) {
-        fprintf(out, " %.20e", ann->weight[i]);
+#pragma omp for schedule(static)
+        for (s = 0; s < count; ++s) {
+            genann_train_step(ann, output, delta, input + (size_t)s * size_i, desired_output + (size_t)s * size_c, learning_rate);
+        }
     }
+
+    free(scratch);
 }
 
 
+void genann_train_numa_omp(genann *ann, genann_numa_set const *set, double learning_rate, int replicas, unsigned int sync) {
+    const int threads = set->threads;
+    const int copies = replicas && set->nodes > 1 ? set->nodes : 1;
+    const size_t n_output = GENANN_PAD(ann->total_neurons);
+    const size_t per_thread = n_output + GENANN_PAD(ann->total_neurons - ann->inputs);
+    const size_t n_weights = ann->total_weights;
+    unsigned int most = 0;
+    int k, failed = 0;
+
+    /* Every thread runs the same number of rounds, so they meet at each sync. */
+    for (k = 0; k < set->nodes; ++k) {
+        const unsigned int n = (set->count[k] + set->node_threads[k] - 1) / set->node_threads[k];
+        if (n > most) most = n;
+    }
+    if (sync == 0 || sync > most) sync = most > 0 ? most : 1;
+    const unsigned int rounds = (most + sync - 1) / sync;
+
+    /* One copy of the weights is ann's own. Replicas are one copy per node
+     * in ann's layout, plus the weights as of the last sync. */
+    double **w = genann_heap_alloc(0, sizeof(double *) * (copies + 1));
+    if (!w) {
+        perror("genann_heap_alloc");
+        return;
+    }
+    memset(w, 0, sizeof(double *) * (copies + 1));
+    if (copies == 1) {
+        w[0] = ann->weight;
+    } else {
+        for (k = 0; k <= copies; ++k) {
+            w[k] = genann_heap_alloc(64, sizeof(double) * n_weights);
+            failed |= !w[k];
+        }
+    }
+    double *base = w[copies];
+    if (failed) {
+        perror("aligned_alloc");
+        for (k = 0; k <= copies; ++k) free(w[k]);
+        free(w);
+        return;
+    }
+
+#pragma omp parallel num_threads(threads)
+    {
+        const int me = omp_get_thread_num();
+        const int node = set->thread_node[me];
+        const int mine = set->thread_index[me];
+        const int on_node = set->node_threads[node];
+        /* The same network, on this node's copy of the weights. */
+        genann net = *ann;
+        net.weight = w[copies > 1 ? node : 0];
+        /* Scratch allocated and first written by the thread that uses it. */
+        double *output = genann_heap_alloc(64, sizeof(double) * per_thread);
+        double *delta = output + n_output;
+        const unsigned int lo = (unsigned int)((unsigned long long)set->count[node] * mine / on_node);
+        const unsigned int hi = (unsigned int)((unsigned long long)set->count[node] * (mine + 1) / on_node);
+        unsigned int s, r;
+        int c;
+
+        if (output) memset(output, 0, sizeof(double) * per_thread);
+
+        /* A replica is copied in by its node's threads, a slice each, so
+         * its pages are on the node. */
+        if (copies > 1) {
+            const size_t from = n_weights * mine / on_node, to = n_weights * (mine + 1) / on_node;
+            memcpy(net.weight + from, ann->weight + from, sizeof(double) * (to - from));
+            if (node == 0) memcpy(base + from, ann->weight + from, sizeof(double) * (to - from));
+        }
+#pragma omp barrier
+
+        for (r = 0; r < rounds; ++r) {
+            const unsigned int end = lo + (r + 1) * sync < hi ? lo + (r + 1) * sync : hi;
+            if (output) {
+                for (s = lo + r * sync; s < end; ++s) {
+                    genann_train_step(&net, output, delta, set->input[node] + (size_t)s * set->size_i,
+                                      set->output[node] + (size_t)s * set->size_c, learning_rate);
+                }
+            }
+
+            /* Merge the replicas, each thread a slice of the weights: every
+             * node's change since the last sync is applied to all of them,
+             * as if they had shared one copy. */
+            if (copies > 1) {
+                size_t i;
+#pragma omp barrier
+#pragma omp for schedule(static)
+                for (i = 0; i < n_weights; ++i) {
+                    double sum = base[i];
+                    for (c = 0; c < copies; ++c) sum += w[c][i] - base[i];
+                    for (c = 0; c < copies; ++c) w[c][i] = sum;
+                    base[i] = sum;
+                }
+            }
+        }
 
+        if (copies > 1) {
+            size_t i;
+#pragma omp barrier
+#pragma omp for schedule(static)
+            for (i = 0; i < n_weights; ++i) ann->weight[i] = w[0][i];
+        }
+
+        if (!output) {
+#pragma omp atomic write
+            failed = 1;
+        }
+        free(output);
+    }
+
+    /* A thread without scratch skipped its samples. */
+    if (failed) perror("aligned_alloc");
+    if (copies > 1) {
+        for (k = 0; k <= copies; ++k) free(w[k]);
+    }
+    free(w);
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "genann.h"
+#include "genann_pp.h"
+#include "mnist_stream.h"
+#include <mpi.h>
+
+
+/* Picks the cache file next to the IDX images if mnist_convert made one. */
+static unsigned int open_set(const char *idx_images, const char *idx_labels, char *images, size_t size, const char **labels)
+{
+    unsigned int count;
+    snprintf(images, size, "%s.cache", idx_images);
+    *labels = NULL;
+    count = mnist_file_count(images, *labels);
+    if (count == 0) {
+        snprintf(images, size, "%s", idx_images);
+        *labels = idx_labels;
+        count = mnist_file_count(images, *labels);
+    }
+    return count;
+}
+
+/* Test accuracy of ann in percent, on rank 0 only. */
+static double accuracy(genann const *ann)
+{
+    char images[256];
+    const char *labels;
+    unsigned int tests = open_set("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte", images, sizeof(images), &labels);
+    double *input = (double *) malloc(sizeof(double) * tests * 28*28);
+    double *class = (double *) malloc(sizeof(double) * tests * 10);
+    double *guess = (double *) malloc(sizeof(double) * tests * 10);
+    unsigned int s;
+    int k, correct = 0;
+
+    if (tests == 0 || !input || !class || !guess || mnist_read_range(images, labels, 0, tests, input, class) || genann_run_batch(ann, input, tests, guess)) {
+        printf("An error occured testing\n");
+        exit(-1);
+    }
+    for (s = 0; s < tests; ++s) {
+        int max_cls = 0;
+        for (k = 1; k < 10; ++k) {
+            if (guess[s*10 + k] > guess[s*10 + max_cls]) max_cls = k;
+        }
+        if (class[s*10 + max_cls] == 1.0) ++correct;
+    }
+    free(input);
+    free(class);
+    free(guess);
+    return 100.0 * correct / tests;
+}
+
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    int w_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &w_size);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    /* Neurons per hidden layer, hidden layers, samples per micro-batch,
+     * micro-batches per step, epochs and learning rate on the mean gradient
+     * of a step, as in the other MPI drivers: the gradient is summed over
+     * the step, so the rate is divided by the step size. There must be at
+     * least as many layers (hidden + 1) as ranks. */
+    int hidden = argc > 1 ? atoi(argv[1]) : 128;
+    int layers = argc > 2 ? atoi(argv[2]) : 3;
+    int micro = argc > 3 ? atoi(argv[3]) : 8;
+    int micro_batches = argc > 4 ? atoi(argv[4]) : 16;
+    int loops = argc > 5 ? atoi(argv[5]) : 5;
+    double rate = argc > 6 ? atof(argv[6]) : 1;
+    if (micro < 1) micro = 1;
+    if (micro_batches < 1) micro_batches = 1;
+    const int step = micro * micro_batches;
+    rate /= step;
+
+    char images[256];
+    const char *labels;
+    unsigned int samples = open_set("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte", images, sizeof(images), &labels);
+    if (samples == 0) {
+        if (rank == 0) printf("An error occured opening the MNIST files\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    const unsigned int steps = samples / step;
+
+    /* Both runs start from the same weights: rand() is unseeded on every rank. */
+    genann *ann = genann_init(28*28, layers, hidden, 10);
+    genann_pp *pp = ann ? genann_pp_init(ann, micro, MPI_COMM_WORLD) : NULL;
+    double *input = (double *) malloc(sizeof(double) * step * 28*28);
+    double *class = (double *) malloc(sizeof(double) * step * 10);
+    double *grad = ann ? (double *) malloc(sizeof(double) * ann->total_weights) : NULL;
+    if (pp == NULL || input == NULL || class == NULL || grad == NULL)
+    {
+        if (rank == 0) printf("setup failed: %d ranks need at least %d layers\n", w_size, w_size);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (rank == 0) {
+        printf("784-%d(x%d)-10, %d ranks, %d micro-batches of %d per step, layers per rank:", hidden, layers, w_size, micro_batches, micro);
+        int r;
+        for (r = 0; r < w_size; ++r) printf(" %d", pp->layer_first[r+1] - pp->layer_first[r]);
+        printf("\n");
+    }
+
+    /* Pipeline parallel. Only the first rank needs the images and only the
+     * last the labels, but reading both is simpler. */
+    genann_pp_stats st = {0, 0};
+    int i;
+    unsigned int s;
+    double ts = MPI_Wtime();
+    for (i = 0; i < loops; ++i) {
+        for (s = 0; s < steps; ++s) {
+            if ((rank == 0 || rank == w_size - 1) && mnist_read_range(images, labels, s * step, step, input, class)) MPI_Abort(MPI_COMM_WORLD, 1);
+            if (genann_pp_train(pp, input, class, micro_batches, rate, &st)) MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    double pp_time = MPI_Wtime() - ts;
+
+    double idle = 1.0 - st.busy / st.total, idle_max, idle_sum;
+    MPI_Reduce(&idle, &idle_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&idle, &idle_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    genann *trained = genann_pp_gather(pp);
+    if (rank == 0) {
+        printf("pipeline:      %8.0f samples/s, idle %.1f%% average, %.1f%% worst rank, schedule bubble %.1f%%, %.1f%% correct\n",
+               (double)steps * step * loops / pp_time, 100.0 * idle_sum / w_size, 100.0 * idle_max,
+               100.0 * (w_size - 1) / (micro_batches + w_size - 1), accuracy(trained));
+        genann_free(trained);
+    }
+
+    /* Data parallel on the same ranks, same step size: every rank holds
+     * the whole network and takes an equal slice of the step. */
+    ts = MPI_Wtime();
+    for (i = 0; i < loops; ++i) {
+        for (s = 0; s < steps; ++s) {
+            const int first = step * rank / w_size, end = step * (rank + 1) / w_size;
+            if (mnist_read_range(images, labels, s * step + first, end - first, input, class)) MPI_Abort(MPI_COMM_WORLD, 1);
+            memset(grad, 0, sizeof(double) * ann->total_weights);
+            if (genann_backprop_layers(ann, input, class, end - first, grad, NULL, NULL)) MPI_Abort(MPI_COMM_WORLD, 1);
+            MPI_Allreduce(MPI_IN_PLACE, grad, ann->total_weights, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+            genann_apply(ann, grad, rate);
+        }
+    }
+    double dp_time = MPI_Wtime() - ts;
+    if (rank == 0) {
+        printf("data parallel: %8.0f samples/s, %.1f%% correct\n", (double)steps * step * loops / dp_time, accuracy(ann));
+    }
+
+    free(input);
+    free(class);
+    free(grad);
+    genann_pp_free(pp);
+    genann_free(ann);
+    MPI_Finalize();
+
+    return 0;
+}
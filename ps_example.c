@@ -0,0 +1,259 @@
+#define USE_MNIST_LOADER
+#define MNIST_DOUBLE
+#include "mnist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "genann.h"
+#include "mnist_cache.h"
+#include "mnist_stream.h"
+#include "genann_mpi.h"
+#include <time.h>
+#include <mpi.h>
+
+double *input, *class;
+unsigned int samples;
+mnist_cache cache; /* set when the data came from a pre-converted cache file */
+const char *class_names[] = {"0","1","2","3","4","5","6","7","8","9"};
+
+
+void load_mnist(char *images_fname, char *labels_fname)
+{
+    mnist_data *data_t, *temp;
+    unsigned int cnt;
+    int ret;
+    char cache_fname[256];
+
+    /* A cache written by mnist_convert next to the images is mapped instead. */
+    snprintf(cache_fname, sizeof(cache_fname), "%s.cache", images_fname);
+    if (mnist_cache_open(cache_fname, &cache) == 0) {
+        if (mnist_cache_doubles(&cache, &input, &class) == 0) {
+            samples = cache.count;
+            printf("image count: %d (cached)\n", samples);
+            return;
+        }
+        mnist_cache_close(&cache);
+    }
+    
+    if (ret = mnist_load(images_fname, labels_fname, &data_t, &cnt)) {
+        printf("An error occured: %d\n", ret);
+    } else {
+        printf("image count: %d\n", cnt);
+    }
+    //cnt = 500; // was used for debugging with smaller data, to reduce run time
+    /* Allocate memory for input and output data. */
+    input = (double *) malloc(sizeof(double) * cnt * 28*28);
+    if (input == NULL)
+    {
+        printf("Input malloc error");
+        exit(-1);
+    }
+    class = (double *) malloc(sizeof(double) * cnt * 10);
+    if (class == NULL)
+    {
+        printf("class malloc error");
+        exit(-1);
+    }
+    
+
+    temp = data_t;
+    int i, j,k;
+    for (i = 0; i <cnt; ++i) {
+        double *p = input + i * 28*28;
+        double *c = class + i * 10;
+        c[0] = c[1] = c[2] = c[4] = c[5] = c[6] = c[7] = c[8] = c[9] = 0.0;
+        //printf("pointers allocated for data row %d \n",i);
+        for (j = 0; j < 28*28; ++j) {
+               //printf("data line %d, j %d, image row %d,image col %d value = %f \n",i,j,j/28,j%28, temp->data[j/28][j%28]);
+               *(p + j) = temp->data[j/28][j%28];
+            }
+
+        *(c + (int)temp->label) = 1.0;
+        temp = temp + 1;
+    }
+    samples = cnt;
+    //printf("image count %d", cnt);
+    free(data_t);
+}
+
+void unload_mnist(void)
+{
+    if (cache.map) {
+        mnist_cache_close(&cache);
+    } else {
+        free(input);
+        free(class);
+    }
+    input = class = NULL;
+}
+
+int correct_predictions(genann *ann) {
+    int correct = 0, j =0;
+    double *guesses = (double *) malloc(sizeof(double) * samples * 10);
+    if (guesses == NULL || genann_run_batch(ann, input, samples, guesses))
+    {
+        printf("guesses malloc error");
+        exit(-1);
+    }
+    for (j = 0; j < samples; ++j) 
+    {
+        const double *guess = guesses + j*10;
+        double max = 0.0;
+        int k =0, actual =0, max_cls = 0;
+        for (k =0; k < 10; k++)
+        {
+            if (guess[k]> max) {
+                max = guess[k];
+                max_cls = k;
+            }
+            if (class[j*10 + k]== 1.0) actual = k;
+        } 
+//        printf(" predicted %d, actual %d \n",max_cls, actual);
+        if (class[j*10 + (int)max_cls] == 1.0) ++correct;
+        //else {printf("Logic error.\n"); exit(1);
+    }
+    free(guesses);
+    return correct;
+}
+
+/* Per-worker timings gathered on rank 0 at the end. */
+typedef struct worker_times {
+    double steps, compute, wait;
+} worker_times;
+
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    int w_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &w_size);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    /* A worker may be at most staleness steps ahead of the slowest one. */
+    int staleness = argc > 1 ? atoi(argv[1]) : 4;
+    /* Ranks 0 .. servers-1 hold the weights, the rest train. */
+    int servers = argc > 2 ? atoi(argv[2]) : 1;
+    /* Samples per worker per step. */
+    int batch = argc > 3 ? atoi(argv[3]) : 16;
+    /* Milliseconds added to every step of the last worker, to stand in for
+     * a slower node. */
+    int slow = argc > 4 ? atoi(argv[4]) : 0;
+    /* Learning rate on the mean gradient of a push, as in the other MPI
+     * drivers: a push is the sum over a batch, so the servers apply
+     * rate / batch. */
+    double rate = argc > 5 ? atof(argv[5]) : 2;
+    if (staleness < 0) staleness = 0;
+    if (batch < 1) batch = 1;
+    if (servers < 1 || servers >= w_size) {
+        if (rank == 0) printf("need more ranks than the %d server(s)\n", servers);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    const int workers = w_size - servers;
+    const int worker = rank - servers;
+
+    const char *images = "mnist/train-images-idx3-ubyte.cache", *labels = NULL;
+    const int blocks = 8;
+    samples = mnist_file_count(images, labels);
+    if (samples == 0) {
+        images = "mnist/train-images-idx3-ubyte";
+        labels = "mnist/train-labels-idx1-ubyte";
+        samples = mnist_file_count(images, labels);
+    }
+    if (samples == 0) {
+        printf("An error occured opening %s\n", images);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    /* Every rank starts from the same weights, since rand() is unseeded. */
+    genann *ann = genann_init(28*28, 3, 10, 10);
+    int loops = 20;
+    worker_times mine = {0, 0, 0};
+    genann_ps_stats st = {0, 0, 0};
+
+    double ts, te;
+    ts = MPI_Wtime();
+
+    if (rank < servers) {
+        genann_ps_serve(ann, servers, staleness, rate / batch, MPI_COMM_WORLD, &st);
+        genann_ps_gather(ann, servers, MPI_COMM_WORLD);
+    } else {
+        /* Workers read their shard like the mpi_exe ranks do. */
+        const unsigned int shard_max = mnist_shard_max(samples, workers, blocks);
+        double *s_data = (double *) malloc(sizeof(double) * shard_max * 28*28);
+        double *s_class = (double *) malloc(sizeof(double) * shard_max * 10);
+        double *grad = (double *) malloc(sizeof(double) * ann->total_weights);
+        int s_size = s_data && s_class && grad ? mnist_read_shard(images, labels, samples, worker, workers, blocks, 0, 0, s_data, s_class) : -1;
+        if (s_size < 0) {
+            printf("An error occured reading the shard of worker %d\n", worker);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (worker == 0) printf("image count: %d, %d workers, %d servers, staleness %d\n", samples, workers, servers, staleness);
+
+        int i, first;
+        for (i = 0; i < loops; ++i) {
+            for (first = 0; first < s_size; first += batch) {
+                const int n = first + batch < s_size ? batch : s_size - first;
+                double t0 = MPI_Wtime();
+                memset(grad, 0, sizeof(double) * ann->total_weights);
+                if (genann_backprop_layers(ann, s_data + first*28*28, s_class + first*10, n, grad, NULL, NULL))
+                {
+                    printf("backprop malloc error");
+                    exit(-1);
+                }
+                if (slow > 0 && worker == workers - 1) {
+                    struct timespec d = {slow / 1000, (slow % 1000) * 1000000L};
+                    nanosleep(&d, NULL);
+                }
+                double t1 = MPI_Wtime();
+                if (genann_ps_push_pull(ann, grad, servers, MPI_COMM_WORLD) != MPI_SUCCESS) {
+                    printf("push/pull failed on worker %d\n", worker);
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+                mine.compute += t1 - t0;
+                mine.wait += MPI_Wtime() - t1;
+                mine.steps += 1;
+            }
+        }
+        genann_ps_done(servers, MPI_COMM_WORLD);
+        free(s_data);
+        free(s_class);
+        free(grad);
+    }
+
+    te = MPI_Wtime();
+
+    /* Report: server counters summed, worker timings one line each. */
+    long updates = 0, held = 0;
+    int spread = 0;
+    MPI_Reduce(&st.updates, &updates, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&st.held, &held, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&st.max_spread, &spread, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    worker_times *all = rank == 0 ? (worker_times *) malloc(sizeof(worker_times) * w_size) : NULL;
+    MPI_Gather(&mine, 3, MPI_DOUBLE, all, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (rank == 0)
+    {
+    int w;
+    for (w = 0; w < workers; ++w) {
+        worker_times *t = &all[servers + w];
+        printf("worker %d: %.0f steps, compute %f s, push/pull %f s\n", w, t->steps, t->compute, t->wait);
+    }
+    printf("updates per server %ld, replies held %ld, largest step gap %d\n", updates / servers, held / servers, spread);
+    printf("train time taken : %f \n", te - ts);
+
+    /* Load data from file to test */
+    load_mnist("mnist/t10k-images-idx3-ubyte","mnist/t10k-labels-idx1-ubyte");
+
+    /* find accuracy */
+    int correct = correct_predictions(ann);
+    printf("\n\n %d/%d correct (%0.1f%%).\n", correct, samples, (double)correct / samples * 100.0);
+    unload_mnist();
+    free(all);
+    }
+    MPI_Finalize();
+    genann_free(ann);
+
+    return 0;
+}
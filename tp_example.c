@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "genann.h"
+#include "genann_tp.h"
+#include "mnist_stream.h"
+#include <mpi.h>
+
+/* Samples read from the files at a time; every rank reads the same ones. */
+#define CHUNK 1024
+
+
+/* Picks the cache file next to the IDX images if mnist_convert made one. */
+static unsigned int open_set(const char *idx_images, const char *idx_labels, char *images, size_t size, const char **labels)
+{
+    unsigned int count;
+    snprintf(images, size, "%s.cache", idx_images);
+    *labels = NULL;
+    count = mnist_file_count(images, *labels);
+    if (count == 0) {
+        snprintf(images, size, "%s", idx_images);
+        *labels = idx_labels;
+        count = mnist_file_count(images, *labels);
+    }
+    return count;
+}
+
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    int w_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &w_size);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    /* Neurons per hidden layer, hidden layers, samples per step, epochs and
+     * learning rate on the mean gradient of a step, as in the other MPI
+     * drivers (every rank sees all the step's samples). The
+     * neurons of every layer are split across the ranks, so hidden can grow
+     * with the number of ranks. */
+    int hidden = argc > 1 ? atoi(argv[1]) : 2048;
+    int layers = argc > 2 ? atoi(argv[2]) : 1;
+    int batch = argc > 3 ? atoi(argv[3]) : 32;
+    int loops = argc > 4 ? atoi(argv[4]) : 1;
+    double rate = argc > 5 ? atof(argv[5]) : 1;
+    if (batch < 1) batch = 1;
+    if (batch > CHUNK) batch = CHUNK;
+
+    char images[256], test_images[256];
+    const char *labels, *test_labels;
+    unsigned int samples = open_set("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte", images, sizeof(images), &labels);
+    unsigned int tests = open_set("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte", test_images, sizeof(test_images), &test_labels);
+    if (samples == 0 || tests == 0) {
+        if (rank == 0) printf("An error occured opening the MNIST files\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    genann_tp *tp = genann_tp_init(28*28, layers, hidden, 10, MPI_COMM_WORLD);
+    double *input = (double *) malloc(sizeof(double) * CHUNK * 28*28);
+    double *class = (double *) malloc(sizeof(double) * CHUNK * 10);
+    double *guess = (double *) malloc(sizeof(double) * CHUNK * 10);
+    if (tp == NULL || input == NULL || class == NULL || guess == NULL)
+    {
+        printf("malloc error");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    /* Weights per rank against a whole copy of the network. */
+    long mine = tp->total_weights, most;
+    MPI_Reduce(&mine, &most, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    const double full = (28*28+1.0) * hidden + (hidden+1.0) * hidden * (layers-1) + (hidden+1.0) * 10;
+    if (rank == 0) printf("784-%d(x%d)-10 over %d ranks: %ld weights per rank, %.1f MB, against %.0f (%.1f MB) whole\n",
+                          hidden, layers, w_size, most, most * 8e-6, full, full * 8e-6);
+
+    double ts = MPI_Wtime();
+    int i;
+    unsigned int first, s;
+    for (i = 0; i < loops; ++i) {
+        double t0 = MPI_Wtime();
+        for (first = 0; first < samples; first += CHUNK) {
+            const unsigned int n = samples - first < CHUNK ? samples - first : CHUNK;
+            if (mnist_read_range(images, labels, first, n, input, class)) MPI_Abort(MPI_COMM_WORLD, 1);
+            for (s = 0; s < n; s += batch) {
+                const int count = n - s < (unsigned int)batch ? (int)(n - s) : batch;
+                if (genann_tp_train(tp, input + s*28*28, class + s*10, count, rate / count)) MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+        if (rank == 0) printf("epoch %d: %f s\n", i, MPI_Wtime() - t0);
+    }
+    double te = MPI_Wtime();
+    if (rank == 0) printf("train time taken : %f \n", te - ts);
+
+    /* Test on the split network too, since the whole one may not fit. */
+    int correct = 0, k;
+    for (first = 0; first < tests; first += CHUNK) {
+        const unsigned int n = tests - first < CHUNK ? tests - first : CHUNK;
+        if (mnist_read_range(test_images, test_labels, first, n, input, class)) MPI_Abort(MPI_COMM_WORLD, 1);
+        if (genann_tp_run(tp, input, n, guess)) MPI_Abort(MPI_COMM_WORLD, 1);
+        for (s = 0; s < n; ++s) {
+            int max_cls = 0;
+            for (k = 1; k < 10; ++k) {
+                if (guess[s*10 + k] > guess[s*10 + max_cls]) max_cls = k;
+            }
+            if (class[s*10 + max_cls] == 1.0) ++correct;
+        }
+    }
+    if (rank == 0) printf("\n\n %d/%d correct (%0.1f%%).\n", correct, tests, (double)correct / tests * 100.0);
+
+    free(input);
+    free(class);
+    free(guess);
+    genann_tp_free(tp);
+    MPI_Finalize();
+
+    return 0;
+}